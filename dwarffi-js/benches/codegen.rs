@@ -0,0 +1,62 @@
+//! bindings generation throughput on the synthetic libraries of the
+//! `dwarffi` benchmarks.
+//!
+//! `cargo bench -p dwarffi-js --bench codegen`. see `fixture` for the sizes.
+
+#[path = "../../dwarffi/benches/fixture/mod.rs"]
+mod fixture;
+
+use dwarffi::DwarfAnalyzer;
+use dwarffi_js::codegen::{FfiBackend, JsCodegen};
+use fixture::{Fixture, best_of, per_second};
+use std::path::Path;
+
+fn main() {
+    let dir = Path::new(env!("CARGO_TARGET_TMPDIR")).join("bench-fixtures");
+    let runs = fixture::runs();
+
+    for dwarf_version in [4, 5] {
+        let fixture = Fixture::from_env(dwarf_version);
+        let (debug_info, library) = fixture.build(&dir);
+        let mut result = DwarfAnalyzer::from_file(&debug_info)
+            .and_then(|analyzer| analyzer.extract_analysis(true))
+            .expect("analysis failed");
+        result.signatures.sort_by(|a, b| a.name.cmp(&b.name));
+        println!(
+            "{}: {} functions, {} types",
+            fixture.name(),
+            result.signatures.len(),
+            result.type_registry.len()
+        );
+
+        for threads in [1, 0] {
+            let codegen = JsCodegen::new(FfiBackend::default(), threads);
+            let (elapsed, module) = best_of(runs, || {
+                let mut module = Vec::new();
+                codegen
+                    .generate_module(
+                        &mut module,
+                        &result.type_registry,
+                        &result.signatures,
+                        true,
+                        true,
+                        &library.display().to_string(),
+                    )
+                    .expect("code generation failed");
+                module
+            });
+            println!(
+                "  generate, {}: {:>9.2?}  {} bytes of JS/s  {} functions/s  ({} bytes)",
+                if threads == 0 {
+                    "all threads"
+                } else {
+                    "1 thread"
+                },
+                elapsed,
+                per_second(module.len(), elapsed),
+                per_second(result.signatures.len(), elapsed),
+                module.len(),
+            );
+        }
+    }
+}
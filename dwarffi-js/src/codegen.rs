@@ -2,6 +2,8 @@
 pub mod backend;
 pub mod js;
 mod koffi;
+mod type_graph;
+mod views;
 
 pub use backend::FfiBackend;
-pub use js::JsCodegen;
+pub use js::{Binding, JsCodegen};
@@ -1,28 +1,100 @@
 /// JavaScript code generation dispatch
 use anyhow::Result;
 use dwarffi::{FunctionSignature, TypeRegistry};
+use std::io::Write;
 
 use super::backend::FfiBackend;
-use super::koffi;
+use super::koffi::{self, KoffiOptions};
 
-pub struct JsCodegen;
+/// when the generated module declares its types and binds its functions
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum Binding {
+    /// everything, when the module is loaded
+    #[default]
+    Eager,
+    /// each function when it is first used, and the types it needs with it,
+    /// so loading the module costs little however many functions it has
+    Lazy,
+}
+
+pub struct JsCodegen {
+    // Currently only Koffi is supported
+    _backend: FfiBackend,
+    options: KoffiOptions,
+}
 
 impl JsCodegen {
+    pub fn new(backend: FfiBackend, threads: usize) -> Self {
+        Self {
+            _backend: backend,
+            options: KoffiOptions {
+                threads,
+                binding: Binding::default(),
+                views: false,
+            },
+        }
+    }
+
+    pub fn with_binding(mut self, binding: Binding) -> Self {
+        self.options.binding = binding;
+        self
+    }
+
+    /// also generate a view class of each plain struct, reading and writing
+    /// its fields in place
+    pub fn with_views(mut self, views: bool) -> Self {
+        self.options.views = views;
+        self
+    }
+
     pub fn generate_module(
+        &self,
+        out: &mut impl Write,
         type_registry: &TypeRegistry,
         functions: &[FunctionSignature],
         generate_types: bool,
         generate_functions: bool,
         library_path: &str,
-        _backend: FfiBackend,
-    ) -> Result<String> {
-        // Currently only Koffi is supported
+    ) -> Result<()> {
         koffi::generate(
+            out,
             type_registry,
             functions,
             generate_types,
             generate_functions,
             library_path,
+            self.options,
+        )
+    }
+
+    /// shared type definitions for [`Self::generate_library_module`], of the
+    /// functions of each library, after its name
+    pub fn generate_types_module(
+        &self,
+        out: &mut impl Write,
+        type_registry: &TypeRegistry,
+        libraries: &[(&str, &[FunctionSignature])],
+    ) -> Result<()> {
+        koffi::generate_shared_types(out, type_registry, libraries, self.options)
+    }
+
+    /// function bindings of one library, with its types taken from the module
+    /// at `types_module`
+    pub fn generate_library_module(
+        &self,
+        out: &mut impl Write,
+        type_registry: &TypeRegistry,
+        functions: &[FunctionSignature],
+        library_path: &str,
+        types_module: &str,
+    ) -> Result<()> {
+        koffi::generate_library(
+            out,
+            type_registry,
+            functions,
+            library_path,
+            types_module,
+            self.options,
         )
     }
 }
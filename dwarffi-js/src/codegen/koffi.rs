@@ -1,470 +1,663 @@
 /// javascript code generation using koffi
 /// (https://koffi.dev)
-use anyhow::{Result, anyhow};
+///
+/// every generator writes straight into the output, so a module is never
+/// held in memory as a whole. type definitions and function bindings are
+/// independent of each other: they are rendered on several threads into a
+/// buffer each and written out in order, so the output does not depend on
+/// the thread count.
+///
+/// with [`Binding::Lazy`] nothing is declared with koffi when the module
+/// loads. every type becomes a getter of a `types` object that declares it,
+/// after the types its definition uses, on first access, and every function
+/// a getter of `module.exports` that declares the types of its signature and
+/// replaces itself with the koffi function.
+///
+/// with [`KoffiOptions::views`] the plain structs also get a view class each,
+/// see [`super::views`].
+use super::js::Binding;
+use super::{type_graph, views};
+use anyhow::{Result, anyhow, bail};
 use dwarffi::{
-    BaseTypeKind, EnumVariant, FunctionSignature, StructField, Type, TypeId, TypeRegistry,
-    UnionField,
+    BaseTypeKind, EnumVariant, FunctionSignature, StructField, Type, TypeId, TypeIndex,
+    TypeRegistry, UnionField, parallel_map_ordered,
 };
-use std::collections::HashSet;
+use std::collections::{HashMap, HashSet};
+use std::io::Write;
+
+/// below this many items per worker, rendering on another thread costs more
+/// than it saves
+const MIN_ITEMS_PER_THREAD: usize = 64;
+
+#[derive(Debug, Clone, Copy)]
+pub struct KoffiOptions {
+    /// worker threads rendering definitions (0 = all available cores)
+    pub threads: usize,
+    pub binding: Binding,
+    /// also write a view class of each plain struct
+    pub views: bool,
+}
 
 pub fn generate(
+    out: &mut impl Write,
     type_registry: &TypeRegistry,
     functions: &[FunctionSignature],
     generate_types: bool,
     generate_functions: bool,
     library_path: &str,
-) -> Result<String> {
-    let mut output = String::new();
-
-    output.push_str(&generate_header());
-
-    output.push_str(&generate_imports());
-
-    // need types that are referenced in functions
-    let required_types = collect_required_types(type_registry, functions)?;
+    options: KoffiOptions,
+) -> Result<()> {
+    write_header(out)?;
 
-    let mut generated_names = HashSet::new();
+    write_imports(out)?;
 
-    if generate_types {
-        let sorted_types = topological_sort(type_registry, required_types)?;
+    let reachable = type_graph::reachable(type_registry, functions)?;
+    let required: &[TypeIndex] = if generate_types {
+        &reachable.required
+    } else {
+        &[]
+    };
+    let callback_types: &[(String, TypeId)] = if generate_functions {
+        &reachable.callbacks
+    } else {
+        &[]
+    };
+    let declarations = declarations(out, options, type_registry, required, callback_types)?;
 
-        // dependency order
-        for type_id in sorted_types {
-            if let Some(type_) = type_registry.get_type(type_id) {
-                let type_def =
-                    generate_type_definition(type_registry, type_, &mut generated_names)?;
-                output.push_str(&type_def);
-            }
-        }
-    }
+    let generated_names = if generate_types {
+        generate_type_definitions(
+            out,
+            type_registry,
+            required,
+            declarations.as_ref(),
+            options.threads,
+        )?
+    } else {
+        Vec::new()
+    };
+    let view_classes = if generate_types && options.views {
+        views::generate(out, type_registry, required)?
+    } else {
+        Vec::new()
+    };
 
     if generate_functions {
-        let callback_types = collect_callback_types(type_registry, functions)?;
-
         // in koffi, callbacks need to be created with .proto() before library
         // is loaded, so do that first.
         if !callback_types.is_empty() {
-            output.push_str(&generate_callback_protos(type_registry, &callback_types)?);
+            generate_callback_protos(out, type_registry, callback_types, declarations.as_ref())?;
         }
 
-        output.push_str(&generate_function_bindings(
+        generate_function_bindings(
+            out,
             type_registry,
             functions,
             library_path,
-        )?);
+            declarations.as_ref(),
+            options.threads,
+        )?;
     }
 
-    output.push_str(&generate_exports(
-        generate_types,
-        generate_functions,
-        &generated_names,
-        functions,
-    )?);
-
-    Ok(output)
-}
-
-fn generate_header() -> String {
-    "// Auto-generated by dwarffi-js\n\
-         // Do not edit manually!\n\
-         // Backend: Koffi (https://koffi.dev)\n\
-         //\n\
-         // `npm install koffi` in your project to use the generated bindings\n"
-        .to_string()
-}
-
-fn generate_imports() -> String {
-    "const koffi = require('koffi')\n\n".to_string()
-}
-
-/// collect all types referenced by function signatures
-fn collect_required_types(
-    type_registry: &TypeRegistry,
-    functions: &[FunctionSignature],
-) -> Result<HashSet<TypeId>> {
-    let mut required = HashSet::new();
-
-    for func in functions {
-        // add return type
-        add_type_transitive(type_registry, func.return_type_id, &mut required)?;
-
-        // add parameter types
-        for param in &func.parameters {
-            add_type_transitive(type_registry, param.type_id, &mut required)?;
+    match declarations {
+        None => generate_exports(
+            out,
+            generate_types,
+            generate_functions,
+            &generated_names,
+            functions,
+        )?,
+        // the functions are already there
+        Some(_) if generate_functions => {
+            out.write_all(b"// Exports\nmodule.exports.types = types\n")?
         }
+        Some(_) => out.write_all(b"// Exports\nmodule.exports = types\n")?,
     }
+    views::write_export(out, &view_classes)?;
 
-    Ok(required)
+    Ok(())
 }
 
-/// collect all function pointer types (callbacks) used in function signatures
-fn collect_callback_types(
+/// a module defining every type the functions of several libraries use, so
+/// each type is registered with koffi once. see [`generate_library`].
+/// `libraries` are the functions of each library, after a name for errors.
+/// koffi registers one type per name, two libraries that define a name
+/// differently cannot share the module
+pub fn generate_shared_types(
+    out: &mut impl Write,
     type_registry: &TypeRegistry,
-    functions: &[FunctionSignature],
-) -> Result<Vec<(String, TypeId)>> {
-    let mut callbacks = Vec::new();
-    let mut seen = HashSet::new();
-
-    for func in functions {
-        // check return type
-        collect_callbacks_from_type(
-            type_registry,
-            func.return_type_id,
-            &mut callbacks,
-            &mut seen,
-        )?;
+    libraries: &[(&str, &[FunctionSignature])],
+    options: KoffiOptions,
+) -> Result<()> {
+    let functions: Vec<FunctionSignature> = libraries
+        .iter()
+        .flat_map(|(_, functions)| functions.iter().cloned())
+        .collect();
+    let reachable = type_graph::reachable(type_registry, &functions)?;
+    check_shared_names(type_registry, libraries, &reachable.required)?;
+
+    write_header(out)?;
+    write_imports(out)?;
+
+    let callback_types = reachable.callbacks;
+    let declarations = declarations(
+        out,
+        options,
+        type_registry,
+        &reachable.required,
+        &callback_types,
+    )?;
+    let generated_names = generate_type_definitions(
+        out,
+        type_registry,
+        &reachable.required,
+        declarations.as_ref(),
+        options.threads,
+    )?;
+    let view_classes = if options.views {
+        views::generate(out, type_registry, &reachable.required)?
+    } else {
+        Vec::new()
+    };
 
-        // check parameter types
-        for param in &func.parameters {
-            collect_callbacks_from_type(type_registry, param.type_id, &mut callbacks, &mut seen)?;
-        }
+    if !callback_types.is_empty() {
+        generate_callback_protos(out, type_registry, &callback_types, declarations.as_ref())?;
     }
 
-    Ok(callbacks)
-}
-
-/// recursively collect function pointer types from a type
-fn collect_callbacks_from_type(
-    type_registry: &TypeRegistry,
-    type_id: TypeId,
-    callbacks: &mut Vec<(String, TypeId)>,
-    seen: &mut HashSet<TypeId>,
-) -> Result<()> {
-    if seen.contains(&type_id) {
+    if declarations.is_some() {
+        out.write_all(b"// Exports\nmodule.exports = types\n")?;
+        views::write_export(out, &view_classes)?;
         return Ok(());
     }
-    seen.insert(type_id);
 
-    let type_ = type_registry
-        .get_type(type_id)
-        .ok_or_else(|| anyhow!("Type not found: {:?}", type_id))?;
-
-    // check if this is a function pointer (pointer to function)
-    if type_.pointer_depth > 0
-        && let BaseTypeKind::Function { .. } = &type_.kind
-    {
-        // this is a function pointer - but we need to find its typedef name
-        // look for a typedef that points to this function type
-        // for now, we'll handle typedefs to function pointers
-        return Ok(());
+    let mut exported: Vec<&str> = generated_names
+        .iter()
+        .map(String::as_str)
+        .chain(callback_types.iter().map(|(name, _)| name.as_str()))
+        .collect();
+    exported.sort_unstable();
+    exported.dedup();
+
+    out.write_all(b"// Exports\nmodule.exports = {\n")?;
+    for name in exported {
+        writeln!(out, "  {},", name)?;
     }
+    out.write_all(b"}\n")?;
+    views::write_export(out, &view_classes)?;
 
-    // check if this is a typedef to a function pointer
-    if let BaseTypeKind::Typedef {
-        name,
-        aliased_type_id,
-    } = &type_.kind
-    {
-        let aliased = type_registry
-            .get_type(*aliased_type_id)
-            .ok_or_else(|| anyhow!("Aliased type not found"))?;
+    Ok(())
+}
 
-        // check if typedef points to a function pointer
-        if aliased.pointer_depth > 0
-            && let BaseTypeKind::Function { .. } = &aliased.kind
-        {
-            // This is a typedef to a function pointer (e.g., "typedef void (*Callback)(...)")
-            callbacks.push((name.clone(), *aliased_type_id));
-            return Ok(());
+/// fail when a library needs another definition of a name than the one the
+/// shared module writes for the `required` types: the first in emit order,
+/// as in [`generate_type_definitions`]. a library that only declares an
+/// opaque struct works with any definition of its name
+fn check_shared_names(
+    type_registry: &TypeRegistry,
+    libraries: &[(&str, &[FunctionSignature])],
+    required: &[TypeIndex],
+) -> Result<()> {
+    let mut written = HashMap::new();
+    for index in type_graph::emit_order(type_registry, required) {
+        let type_ = type_registry.get_by_index(index);
+        if let Some((name, _)) = registered_name(type_registry, type_) {
+            written.entry(name).or_insert(&type_.kind);
         }
     }
 
-    // recursively check composite types
-    match &type_.kind {
-        BaseTypeKind::Struct { fields, .. } => {
-            for field in fields {
-                collect_callbacks_from_type(type_registry, field.type_id, callbacks, seen)?;
+    for &(library, functions) in libraries {
+        for index in type_graph::reachable(type_registry, functions)?.required {
+            let type_ = type_registry.get_by_index(index);
+            let Some((name, false)) = registered_name(type_registry, type_) else {
+                continue;
+            };
+            if written.get(name) != Some(&&type_.kind) {
+                bail!(
+                    "{} defines {} unlike the other libraries, and koffi registers one type per name",
+                    library,
+                    name
+                );
             }
         }
-        BaseTypeKind::Array {
-            element_type_id, ..
-        } => {
-            collect_callbacks_from_type(type_registry, *element_type_id, callbacks, seen)?;
-        }
-        _ => {}
     }
-
     Ok(())
 }
 
-/// recursively add a type and all types it references
-fn add_type_transitive(
+/// the name a definition of `type_` registers with koffi, and whether it is
+/// an opaque struct. `None` for types without a definition of their own,
+/// see [`generate_type_definition`]
+fn registered_name<'a>(type_registry: &TypeRegistry, type_: &'a Type) -> Option<(&'a str, bool)> {
+    let name = definition_name(type_)?;
+    if name.starts_with("<") {
+        return None;
+    }
+    match &type_.kind {
+        BaseTypeKind::Struct { is_opaque, .. } => Some((name, *is_opaque)),
+        BaseTypeKind::Union { .. } | BaseTypeKind::Enum { .. } => Some((name, false)),
+        // only typedefs of anonymous types define something
+        BaseTypeKind::Typedef {
+            aliased_type_id, ..
+        } => match &type_registry.get_type(*aliased_type_id)?.kind {
+            BaseTypeKind::Struct { name: aliased, .. }
+            | BaseTypeKind::Union { name: aliased, .. }
+            | BaseTypeKind::Enum { name: aliased, .. }
+                if aliased.starts_with("<") =>
+            {
+                Some((name, false))
+            }
+            _ => None,
+        },
+        _ => None,
+    }
+}
+
+/// function bindings of one library whose types are defined in the shared
+/// module `types_module` (a `require` path). its views, if any, are
+/// `types.views`
+pub fn generate_library(
+    out: &mut impl Write,
     type_registry: &TypeRegistry,
-    type_id: TypeId,
-    collected: &mut HashSet<TypeId>,
+    functions: &[FunctionSignature],
+    library_path: &str,
+    types_module: &str,
+    options: KoffiOptions,
 ) -> Result<()> {
-    if collected.contains(&type_id) {
+    write_header(out)?;
+    write_imports(out)?;
+    write!(
+        out,
+        "// types shared with the other libraries\nconst types = require('{}')\n\n",
+        types_module
+    )?;
+
+    // the shared module defines at least the types these functions use
+    let reachable = match options.binding {
+        Binding::Eager => None,
+        Binding::Lazy => Some(type_graph::reachable(type_registry, functions)?),
+    };
+    let declarations = reachable.as_ref().map(|reachable| {
+        Declarations::new(type_registry, &reachable.required, &reachable.callbacks)
+    });
+    generate_function_bindings(
+        out,
+        type_registry,
+        functions,
+        library_path,
+        declarations.as_ref(),
+        options.threads,
+    )?;
+
+    if declarations.is_some() {
+        out.write_all(b"// Exports\nmodule.exports.types = types\n")?;
         return Ok(());
     }
 
-    let type_ = type_registry
-        .get_type(type_id)
-        .ok_or_else(|| anyhow!("Type not found: {:?}", type_id))?;
+    out.write_all(b"// Exports\nmodule.exports = {\n  types,\n")?;
+    for func in functions.iter().filter(|func| !func.is_variadic) {
+        writeln!(out, "  {},", func.name)?;
+    }
+    out.write_all(b"}\n")?;
 
-    // skip primitives - they don't need definitions
-    if matches!(&type_.kind, BaseTypeKind::Primitive { .. }) {
-        return Ok(());
+    Ok(())
+}
+
+/// for lazy bindings, write the `types` object and `define()` and return the
+/// names its definitions will declare. `None` for eager bindings
+fn declarations<'a>(
+    out: &mut impl Write,
+    options: KoffiOptions,
+    type_registry: &'a TypeRegistry,
+    required: &[TypeIndex],
+    callbacks: &'a [(String, TypeId)],
+) -> Result<Option<Declarations<'a>>> {
+    if options.binding == Binding::Eager {
+        return Ok(None);
     }
 
-    collected.insert(type_id);
+    out.write_all(
+        b"// Types, each declared with koffi on first use: by a function, by\n\
+          // another type or through `types`\n\
+          const types = {}\n\
+          \n\
+          function define(name, dependencies, declare) {\n\
+          \x20 let type\n\
+          \x20 Object.defineProperty(types, name, {\n\
+          \x20   configurable: true,\n\
+          \x20   enumerable: true,\n\
+          \x20   get() {\n\
+          \x20     if (type === undefined) {\n\
+          \x20       // pointers may form cycles, a type on the way is not declared again\n\
+          \x20       type = null\n\
+          \x20       for (const dependency of dependencies) types[dependency]\n\
+          \x20       type = declare()\n\
+          \x20     }\n\
+          \x20     return type\n\
+          \x20   },\n\
+          \x20 })\n\
+          }\n\n",
+    )?;
+
+    Ok(Some(Declarations::new(type_registry, required, callbacks)))
+}
 
-    // recursively collect referenced types
-    match &type_.kind {
-        BaseTypeKind::Struct { fields, .. } => {
-            for field in fields {
-                add_type_transitive(type_registry, field.type_id, collected)?;
-            }
-        }
-        BaseTypeKind::Union { variants, .. } => {
-            for variant in variants {
-                add_type_transitive(type_registry, variant.type_id, collected)?;
+/// the names lazy definitions declare with koffi: named structs and unions,
+/// typedefs of anonymous ones and callbacks. enums are plain objects, koffi
+/// never sees their names.
+struct Declarations<'a> {
+    type_registry: &'a TypeRegistry,
+    names: HashSet<&'a str>,
+}
+
+impl<'a> Declarations<'a> {
+    fn new(
+        type_registry: &'a TypeRegistry,
+        required: &[TypeIndex],
+        callbacks: &'a [(String, TypeId)],
+    ) -> Self {
+        let mut names: HashSet<&str> = callbacks.iter().map(|(name, _)| name.as_str()).collect();
+        for &index in required {
+            let type_ = type_registry.get_by_index(index);
+            let name = match &type_.kind {
+                BaseTypeKind::Struct { name, .. } | BaseTypeKind::Union { name, .. } => name,
+                BaseTypeKind::Typedef {
+                    name,
+                    aliased_type_id,
+                } => match type_registry.get_type(*aliased_type_id).map(|t| &t.kind) {
+                    Some(
+                        BaseTypeKind::Struct {
+                            name: aliased_name, ..
+                        }
+                        | BaseTypeKind::Union {
+                            name: aliased_name, ..
+                        },
+                    ) if aliased_name.starts_with("<") => name,
+                    _ => continue,
+                },
+                _ => continue,
+            };
+            if !name.starts_with("<") {
+                names.insert(name);
             }
         }
-        BaseTypeKind::Enum { backing_id, .. } => {
-            add_type_transitive(type_registry, *backing_id, collected)?;
-        }
-        BaseTypeKind::Array {
-            element_type_id, ..
-        } => {
-            add_type_transitive(type_registry, *element_type_id, collected)?;
-        }
-        BaseTypeKind::Typedef {
-            aliased_type_id, ..
-        } => {
-            add_type_transitive(type_registry, *aliased_type_id, collected)?;
+        Self {
+            type_registry,
+            names,
         }
-        BaseTypeKind::Function {
-            return_type_id,
-            parameter_type_ids,
-            ..
-        } => {
-            if let Some(ret_id) = return_type_id {
-                add_type_transitive(type_registry, *ret_id, collected)?;
+    }
+
+    /// the declarations `type_ids` refer to, directly or through types that
+    /// are not declared themselves, except `own`. a declaration takes care
+    /// of the ones it needs, so the walk stops there.
+    fn dependencies(
+        &self,
+        type_ids: impl IntoIterator<Item = TypeId>,
+        own: Option<&str>,
+    ) -> Result<Vec<&'a str>> {
+        let mut found = Vec::new();
+        let mut seen = HashSet::new();
+        let mut stack: Vec<TypeId> = type_ids.into_iter().collect();
+        stack.reverse();
+        while let Some(type_id) = stack.pop() {
+            if !seen.insert(type_id) {
+                continue;
             }
-            for param_id in parameter_type_ids {
-                add_type_transitive(type_registry, *param_id, collected)?;
+            let type_ = self
+                .type_registry
+                .get_type(type_id)
+                .ok_or_else(|| anyhow!("Type not found: {:?}", type_id))?;
+            let name = match &type_.kind {
+                BaseTypeKind::Struct { name, .. }
+                | BaseTypeKind::Union { name, .. }
+                | BaseTypeKind::Typedef { name, .. } => self.names.get(name.as_str()),
+                // bare function pointers are void *
+                BaseTypeKind::Function { .. } => continue,
+                _ => None,
+            };
+            match name {
+                Some(&name) => {
+                    if Some(name) != own && !found.contains(&name) {
+                        found.push(name);
+                    }
+                }
+                None => stack.extend(type_.kind.referenced_type_ids().into_iter().rev()),
             }
         }
-        BaseTypeKind::Primitive { .. } => {}
+        Ok(found)
     }
+}
 
-    Ok(())
+/// how a definition is declared with koffi
+#[derive(Clone, Copy)]
+enum Declare<'a> {
+    /// as a constant, when the module loads
+    Now,
+    /// by a getter of `types`, after the declarations it names
+    OnFirstUse(&'a [&'a str]),
 }
 
-/// sort types by dependencies
-fn topological_sort(type_registry: &TypeRegistry, types: HashSet<TypeId>) -> Result<Vec<TypeId>> {
-    let mut sorted = Vec::new();
-    let mut visited = HashSet::new();
-    let mut visiting = HashSet::new();
+impl Declare<'_> {
+    /// `const name = ` or the start of a `define()` call, followed by the
+    /// definition's value
+    fn write_start(self, out: &mut impl Write, name: &str) -> Result<()> {
+        match self {
+            Declare::Now => write!(out, "const {} = ", name)?,
+            Declare::OnFirstUse(dependencies) => {
+                write!(out, "define('{}', ", name)?;
+                write_names(out, dependencies)?;
+                out.write_all(b", () => ")?;
+            }
+        }
+        Ok(())
+    }
 
-    for &type_id in &types {
-        visit_type(
-            type_registry,
-            type_id,
-            &types,
-            &mut visited,
-            &mut visiting,
-            &mut sorted,
-        )?;
+    /// after the value of [`Self::write_start`]
+    fn write_end(self, out: &mut impl Write) -> Result<()> {
+        match self {
+            Declare::Now => out.write_all(b"\n\n")?,
+            Declare::OnFirstUse(_) => out.write_all(b")\n\n")?,
+        }
+        Ok(())
     }
+}
 
-    Ok(sorted)
+/// `['A', 'B']`
+fn write_names(out: &mut impl Write, names: &[&str]) -> Result<()> {
+    out.write_all(b"[")?;
+    for (i, name) in names.iter().enumerate() {
+        if i > 0 {
+            out.write_all(b", ")?;
+        }
+        write!(out, "'{}'", name)?;
+    }
+    out.write_all(b"]")?;
+    Ok(())
 }
 
-fn visit_type(
+/// definitions of the `required` types, in dependency order, declared lazily
+/// when there are `declarations`. returns the names that were defined, in
+/// that order.
+fn generate_type_definitions(
+    out: &mut impl Write,
     type_registry: &TypeRegistry,
-    type_id: TypeId,
-    all_types: &HashSet<TypeId>,
-    visited: &mut HashSet<TypeId>,
-    visiting: &mut HashSet<TypeId>,
-    sorted: &mut Vec<TypeId>,
-) -> Result<()> {
-    if visited.contains(&type_id) {
-        return Ok(());
+    required: &[TypeIndex],
+    declarations: Option<&Declarations>,
+    threads: usize,
+) -> Result<Vec<String>> {
+    let sorted_types: Vec<&Type> = type_graph::emit_order(type_registry, required)
+        .into_iter()
+        .map(|index| type_registry.get_by_index(index))
+        .collect();
+
+    let rendered = render_each(&sorted_types, threads, |buffer, type_| {
+        let (Some(declarations), Some(name)) = (declarations, definition_name(type_)) else {
+            return generate_type_definition(buffer, type_registry, type_, Declare::Now);
+        };
+        let dependencies =
+            declarations.dependencies(type_.kind.referenced_type_ids(), Some(name))?;
+        let declare = Declare::OnFirstUse(&dependencies);
+        generate_type_definition(buffer, type_registry, type_, declare)
+    })?;
+
+    // dependency order. several types may define the same name (e.g. a
+    // struct and its typedef), the first one wins
+    let mut generated_names = Vec::new();
+    let mut seen = HashSet::new();
+    for (type_, buffer) in sorted_types.iter().zip(rendered) {
+        let Some(buffer) = buffer else {
+            continue;
+        };
+        if let Some(name) = definition_name(type_) {
+            if !seen.insert(name) {
+                continue;
+            }
+            generated_names.push(name.to_string());
+        }
+        out.write_all(&buffer)?;
     }
 
-    if visiting.contains(&type_id) {
-        // circular dependency - this is OK for pointers
-        return Ok(());
+    Ok(generated_names)
+}
+
+/// render each item into a buffer of its own, on up to `threads` workers
+/// (0 = all available cores). buffers are returned in item order, `None`
+/// where `render` wrote nothing.
+fn render_each<T: Sync>(
+    items: &[T],
+    threads: usize,
+    render: impl Fn(&mut Vec<u8>, &T) -> Result<bool> + Sync,
+) -> Result<Vec<Option<Vec<u8>>>> {
+    let workers = match threads {
+        0 => std::thread::available_parallelism().map_or(1, |n| n.get()),
+        n => n,
     }
+    .min(items.len() / MIN_ITEMS_PER_THREAD)
+    .max(1);
+    parallel_map_ordered(items, workers, |item| {
+        let mut buffer = Vec::new();
+        Ok(render(&mut buffer, item)?.then_some(buffer))
+    })
+}
 
-    let type_ = type_registry
-        .get_type(type_id)
-        .ok_or_else(|| anyhow!("Type not found: {:?}", type_id))?;
+fn write_header(out: &mut impl Write) -> Result<()> {
+    out.write_all(
+        b"// Auto-generated by dwarffi-js\n\
+         // Do not edit manually!\n\
+         // Backend: Koffi (https://koffi.dev)\n\
+         //\n\
+         // `npm install koffi` in your project to use the generated bindings\n",
+    )?;
+    Ok(())
+}
 
-    visiting.insert(type_id);
+fn write_imports(out: &mut impl Write) -> Result<()> {
+    out.write_all(b"const koffi = require('koffi')\n\n")?;
+    Ok(())
+}
 
-    // visit dependencies first
+/// the name a definition of `type_` declares, used for deduplication
+fn definition_name(type_: &Type) -> Option<&str> {
     match &type_.kind {
-        BaseTypeKind::Struct { fields, .. } => {
-            for field in fields {
-                // only visit if it's in our required set and not a pointer
-                let field_type = type_registry.get_type(field.type_id);
-                if all_types.contains(&field.type_id)
-                    && field_type.map(|t| t.pointer_depth == 0).unwrap_or(false)
-                {
-                    visit_type(
-                        type_registry,
-                        field.type_id,
-                        all_types,
-                        visited,
-                        visiting,
-                        sorted,
-                    )?;
-                }
-            }
-        }
-        BaseTypeKind::Union { variants, .. } => {
-            for variant in variants {
-                let variant_type = type_registry.get_type(variant.type_id);
-                if all_types.contains(&variant.type_id)
-                    && variant_type.map(|t| t.pointer_depth == 0).unwrap_or(false)
-                {
-                    visit_type(
-                        type_registry,
-                        variant.type_id,
-                        all_types,
-                        visited,
-                        visiting,
-                        sorted,
-                    )?;
-                }
-            }
-        }
-        BaseTypeKind::Array {
-            element_type_id, ..
-        } => {
-            if all_types.contains(element_type_id) {
-                visit_type(
-                    type_registry,
-                    *element_type_id,
-                    all_types,
-                    visited,
-                    visiting,
-                    sorted,
-                )?;
-            }
-        }
-        BaseTypeKind::Typedef {
-            aliased_type_id, ..
-        } => {
-            if all_types.contains(aliased_type_id) {
-                visit_type(
-                    type_registry,
-                    *aliased_type_id,
-                    all_types,
-                    visited,
-                    visiting,
-                    sorted,
-                )?;
-            }
-        }
-        _ => {}
+        BaseTypeKind::Struct { name, .. } => Some(name),
+        BaseTypeKind::Union { name, .. } => Some(name),
+        BaseTypeKind::Enum { name, .. } => Some(name),
+        BaseTypeKind::Typedef { name, .. } => Some(name),
+        _ => None,
     }
-
-    visiting.remove(&type_id);
-    visited.insert(type_id);
-    sorted.push(type_id);
-
-    Ok(())
 }
 
-/// generate a single type definition
+/// write a single type definition. returns whether anything was written
 fn generate_type_definition(
+    out: &mut impl Write,
     type_registry: &TypeRegistry,
     type_: &Type,
-    generated_names: &mut HashSet<String>,
-) -> Result<String> {
-    // get the type name for deduplication
-    let type_name = match &type_.kind {
-        BaseTypeKind::Struct { name, .. } => Some(name.clone()),
-        BaseTypeKind::Union { name, .. } => Some(name.clone()),
-        BaseTypeKind::Enum { name, .. } => Some(name.clone()),
-        BaseTypeKind::Typedef { name, .. } => Some(name.clone()),
-        _ => None,
-    };
-
-    // skip if already generated
-    if let Some(ref name) = type_name
-        && generated_names.contains(name)
-    {
-        return Ok(String::new());
-    }
-
-    let result = match &type_.kind {
+    declare: Declare,
+) -> Result<bool> {
+    let written = match &type_.kind {
         BaseTypeKind::Primitive { .. } => {
             // primitives don't need definitions in Koffi
-            Ok(String::new())
+            false
         }
         BaseTypeKind::Struct {
             name,
             fields,
+            alignment,
             is_opaque,
             ..
         } => {
             // skip anonymous structs - they'll be referenced by their typedef
             if name.starts_with("<") {
-                return Ok(String::new());
+                return Ok(false);
             }
-            generate_struct(type_registry, name, fields, *is_opaque)
+            generate_struct(
+                out,
+                type_registry,
+                name,
+                fields,
+                *alignment,
+                *is_opaque,
+                declare,
+            )?
         }
         BaseTypeKind::Union { name, variants, .. } => {
             // skip anonymous unions
             if name.starts_with("<") {
-                return Ok(String::new());
+                return Ok(false);
             }
-            generate_union(type_registry, name, variants)
+            generate_union(out, type_registry, name, variants, declare)?
         }
         BaseTypeKind::Enum { name, variants, .. } => {
             // skip anonymous enums
             if name.starts_with("<") {
-                return Ok(String::new());
+                return Ok(false);
             }
-            generate_enum(name, variants)
+            generate_enum(out, name, variants, declare)?
         }
         BaseTypeKind::Array { .. } => {
             // arrays are generated inline in struct fields
-            Ok(String::new())
+            false
         }
         BaseTypeKind::Typedef {
             name,
             aliased_type_id,
-        } => generate_typedef(type_registry, name, *aliased_type_id, generated_names),
+        } => generate_typedef(out, type_registry, name, *aliased_type_id, declare)?,
         BaseTypeKind::Function { .. } => {
             // function pointers are generated inline
-            Ok(String::new())
+            false
         }
     };
 
-    // mark as generated if successful
-    if let Some(name) = type_name
-        && result.is_ok()
-        && !result.as_ref().unwrap().is_empty()
-    {
-        generated_names.insert(name);
-    }
-
-    result
+    Ok(written)
 }
 
 fn generate_struct(
+    out: &mut impl Write,
     type_registry: &TypeRegistry,
     name: &str,
     fields: &[StructField],
+    alignment: usize,
     is_opaque: bool,
-) -> Result<String> {
-    let mut output = String::new();
-
+    declare: Declare,
+) -> Result<bool> {
     if is_opaque {
-        output.push_str(&format!("// {} (opaque - no definition available)\n", name));
-        output.push_str(&format!("const {} = koffi.opaque()\n\n", name));
-        return Ok(output);
+        writeln!(out, "// {} (opaque - no definition available)", name)?;
+        declare.write_start(out, name)?;
+        out.write_all(b"koffi.opaque()")?;
+        declare.write_end(out)?;
+        return Ok(true);
     }
 
-    output.push_str(&format!("const {} = koffi.struct('{}', {{\n", name, name));
+    // koffi lays out struct members at their natural offsets, packed ones
+    // need koffi.pack
+    let constructor = if is_packed(fields, alignment) {
+        "pack"
+    } else {
+        "struct"
+    };
+    declare.write_start(out, name)?;
+    writeln!(out, "koffi.{}('{}', {{", constructor, name)?;
 
     for field in fields {
-        let field_type = type_to_koffi_string(type_registry, field.type_id)?;
+        write!(out, "  {}: ", field.name)?;
+        write_koffi_type(out, type_registry, field.type_id)?;
 
         // add comment if field is an enum (to help developers)
         let field_type_info = type_registry.get_type(field.type_id);
@@ -473,124 +666,134 @@ fn generate_struct(
                 name: enum_name, ..
             } = &type_.kind
         {
-            output.push_str(&format!(
-                "  {}: {},  // {} enum\n",
-                field.name, field_type, enum_name
-            ));
+            writeln!(out, ",  // {} enum", enum_name)?;
             continue;
         }
 
-        output.push_str(&format!("  {}: {},\n", field.name, field_type));
+        out.write_all(b",\n")?;
     }
 
-    output.push_str("})\n\n");
+    out.write_all(b"})")?;
+    declare.write_end(out)?;
+
+    Ok(true)
+}
 
-    Ok(output)
+/// whether a struct leaves out the padding its fields naturally get. its
+/// alignment is 1 then, see [`BaseTypeKind::Struct`]
+fn is_packed(fields: &[StructField], alignment: usize) -> bool {
+    fields.iter().any(|field| field.alignment > alignment)
 }
 
 fn generate_union(
+    out: &mut impl Write,
     type_registry: &TypeRegistry,
     name: &str,
     variants: &[UnionField],
-) -> Result<String> {
-    let mut output = String::new();
-
-    output.push_str(&format!("const {} = koffi.union('{}', {{\n", name, name));
+    declare: Declare,
+) -> Result<bool> {
+    declare.write_start(out, name)?;
+    writeln!(out, "koffi.union('{}', {{", name)?;
 
     for variant in variants {
-        let variant_type = type_to_koffi_string(type_registry, variant.type_id)?;
-        output.push_str(&format!("  {}: {},\n", variant.name, variant_type));
+        write!(out, "  {}: ", variant.name)?;
+        write_koffi_type(out, type_registry, variant.type_id)?;
+        out.write_all(b",\n")?;
     }
 
-    output.push_str("})\n\n");
+    out.write_all(b"})")?;
+    declare.write_end(out)?;
 
-    Ok(output)
+    Ok(true)
 }
 
-fn generate_enum(name: &str, variants: &[EnumVariant]) -> Result<String> {
-    let mut output = String::new();
-
-    output.push_str(&format!("// Enum: {}\n", name));
-    output.push_str(&format!("const {} = {{\n", name));
+fn generate_enum(
+    out: &mut impl Write,
+    name: &str,
+    variants: &[EnumVariant],
+    declare: Declare,
+) -> Result<bool> {
+    // an arrow function returns an object literal in parentheses
+    let (open, close) = match declare {
+        Declare::Now => ("{", "}"),
+        Declare::OnFirstUse(_) => ("({", "})"),
+    };
+    writeln!(out, "// Enum: {}", name)?;
+    declare.write_start(out, name)?;
+    writeln!(out, "{}", open)?;
 
     for variant in variants {
-        output.push_str(&format!("  {}: {},\n", variant.name, variant.value));
+        writeln!(out, "  {}: {},", variant.name, variant.value)?;
     }
 
-    output.push_str("}\n\n");
+    out.write_all(close.as_bytes())?;
+    declare.write_end(out)?;
 
-    Ok(output)
+    Ok(true)
 }
 
 fn generate_typedef(
+    out: &mut impl Write,
     type_registry: &TypeRegistry,
     name: &str,
     aliased_type_id: TypeId,
-    generated_names: &mut HashSet<String>,
-) -> Result<String> {
+    declare: Declare,
+) -> Result<bool> {
     let aliased_type = type_registry
         .get_type(aliased_type_id)
         .ok_or_else(|| anyhow!("Aliased type not found"))?;
 
-    // skip typedefs that are just primitive aliases
-    if matches!(&aliased_type.kind, BaseTypeKind::Primitive { .. }) {
-        return Ok(String::new());
-    }
-
-    // if typedef is to an anonymous struct/union/enum, generate the full definition
+    // if typedef is to an anonymous struct/union/enum, generate the full
+    // definition under the typedef name. primitive aliases and typedefs of
+    // named types need no alias in Koffi
     match &aliased_type.kind {
         BaseTypeKind::Struct {
             name: struct_name,
             fields,
+            alignment,
             is_opaque,
             ..
-        } if struct_name.starts_with("<") => {
-            generate_struct(type_registry, name, fields, *is_opaque)
-        }
+        } if struct_name.starts_with("<") => generate_struct(
+            out,
+            type_registry,
+            name,
+            fields,
+            *alignment,
+            *is_opaque,
+            declare,
+        ),
         BaseTypeKind::Union {
             name: union_name,
             variants,
             ..
-        } if union_name.starts_with("<") => generate_union(type_registry, name, variants),
+        } if union_name.starts_with("<") => {
+            generate_union(out, type_registry, name, variants, declare)
+        }
         BaseTypeKind::Enum {
             name: enum_name,
             variants,
             ..
-        } if enum_name.starts_with("<") => generate_enum(name, variants),
-        _ => {
-            // check if the aliased type has a named definition
-            let aliased_name = match &aliased_type.kind {
-                BaseTypeKind::Struct { name, .. } => Some(name.as_str()),
-                BaseTypeKind::Union { name, .. } => Some(name.as_str()),
-                BaseTypeKind::Enum { name, .. } => Some(name.as_str()),
-                _ => None,
-            };
-
-            // if typedef aliases a named type that's already generated, just skip it
-            if let Some(aliased) = aliased_name
-                && generated_names.contains(aliased)
-                && aliased == name
-            {
-                return Ok(String::new());
-            }
-
-            // for Koffi, we don't need to create typedef aliases - just skip
-            Ok(String::new())
-        }
+        } if enum_name.starts_with("<") => generate_enum(out, name, variants, declare),
+        _ => Ok(false),
     }
 }
 
-/// convert a TypeId to a Koffi type string (e.g., "'int'", "'Point *'", "koffi.array('char', 64)")
-fn type_to_koffi_string(type_registry: &TypeRegistry, type_id: TypeId) -> Result<String> {
+/// write the Koffi type of a struct field or union variant (e.g. "'int'",
+/// "'Point *'", "koffi.array('char', 64)")
+fn write_koffi_type(
+    out: &mut impl Write,
+    type_registry: &TypeRegistry,
+    type_id: TypeId,
+) -> Result<()> {
     let type_ = type_registry
         .get_type(type_id)
         .ok_or_else(|| anyhow!("Type not found: {:?}", type_id))?;
 
-    // build the base type string
-    let mut type_str = match &type_.kind {
-        BaseTypeKind::Primitive { name, .. } => primitive_to_koffi(name)?,
-        BaseTypeKind::Struct { name, .. } => format!("'{}'", name),
-        BaseTypeKind::Union { name, .. } => format!("'{}'", name),
+    // the type name, written inside quotes below
+    let name = match &type_.kind {
+        BaseTypeKind::Primitive { name, .. } => unquote(primitive_to_koffi(name)?),
+        BaseTypeKind::Struct { name, .. } => name.as_str(),
+        BaseTypeKind::Union { name, .. } => name.as_str(),
         BaseTypeKind::Enum { backing_id, .. } => {
             // enums must use their underlying integer type in Koffi
             // Koffi doesn't recognize enum type names
@@ -599,8 +802,8 @@ fn type_to_koffi_string(type_registry: &TypeRegistry, type_id: TypeId) -> Result
                 .ok_or_else(|| anyhow!("Enum backing type not found"))?;
 
             match &backing_type.kind {
-                BaseTypeKind::Primitive { name, .. } => primitive_to_koffi(name)?,
-                _ => "'int'".to_string(), // default fallback
+                BaseTypeKind::Primitive { name, .. } => unquote(primitive_to_koffi(name)?),
+                _ => "int", // default fallback
             }
         }
         BaseTypeKind::Array {
@@ -608,8 +811,10 @@ fn type_to_koffi_string(type_registry: &TypeRegistry, type_id: TypeId) -> Result
             count,
             ..
         } => {
-            let elem_type = type_to_koffi_string(type_registry, *element_type_id)?;
-            return Ok(format!("koffi.array({}, {})", elem_type, count));
+            out.write_all(b"koffi.array(")?;
+            write_koffi_type(out, type_registry, *element_type_id)?;
+            write!(out, ", {})", count)?;
+            return Ok(());
         }
         BaseTypeKind::Typedef {
             name,
@@ -620,68 +825,46 @@ fn type_to_koffi_string(type_registry: &TypeRegistry, type_id: TypeId) -> Result
                 .get_type(*aliased_type_id)
                 .ok_or_else(|| anyhow!("Aliased type not found"))?;
 
-            // if typedef points to function pointer, keep the typedef name
-            if aliased.pointer_depth > 0 {
-                if let BaseTypeKind::Function { .. } = &aliased.kind {
-                    // function pointer typedef - use typedef name
-                    format!("'{}'", name)
-                } else {
-                    // pointer to something else - recursively resolve
-                    return type_to_koffi_string(type_registry, *aliased_type_id);
-                }
-            } else {
-                // not a pointer - check if it's an enum or other type
-                match &aliased.kind {
-                    BaseTypeKind::Enum { .. } => {
-                        // Typedef to enum - resolve to underlying int type
-                        return type_to_koffi_string(type_registry, *aliased_type_id);
-                    }
-                    BaseTypeKind::Struct { .. } | BaseTypeKind::Union { .. } => {
-                        // typedef to struct/union - use typedef name for convenience
-                        format!("'{}'", name)
-                    }
-                    _ => {
-                        // other typedefs - recursively resolve
-                        return type_to_koffi_string(type_registry, *aliased_type_id);
-                    }
+            match &aliased.kind {
+                // function pointer typedef - use typedef name
+                BaseTypeKind::Function { .. } if aliased.pointer_depth > 0 => name.as_str(),
+                // typedef to struct/union - use typedef name for convenience
+                BaseTypeKind::Struct { .. } | BaseTypeKind::Union { .. }
+                    if aliased.pointer_depth == 0 =>
+                {
+                    name.as_str()
                 }
+                // pointers to anything else, enums (resolve to underlying int
+                // type) and other typedefs - recursively resolve
+                _ => return write_koffi_type(out, type_registry, *aliased_type_id),
             }
         }
-        BaseTypeKind::Function { .. } => "'void *'".to_string(), // Function pointers as void*
+        BaseTypeKind::Function { .. } => "void *", // Function pointers as void*
     };
 
-    // insert pointer stars inside the string literal if type_str is quoted (e.g., 'void')
-    if type_str.starts_with("'") && type_str.ends_with("'") && type_.pointer_depth > 0 {
-        // Remove trailing quote
-        let mut s = type_str[..type_str.len() - 1].to_string();
-        for _ in 0..type_.pointer_depth {
-            s.push_str(" *");
-        }
-        s.push('\'');
-        type_str = s;
-    } else {
-        // fallback: append pointer stars outside
-        for _ in 0..type_.pointer_depth {
-            type_str.push_str(" *");
-        }
+    // pointer stars go inside the string literal, const (for documentation,
+    // doesn't affect ABI) only on pointers
+    out.write_all(b"'")?;
+    if type_.is_const && type_.pointer_depth > 0 {
+        out.write_all(b"const ")?;
     }
-
-    // add const if needed (for documentation, doesn't affect ABI)
-    if type_.is_const
-        && type_.pointer_depth > 0
-        && type_str.starts_with("'")
-        && type_str.ends_with("'")
-    {
-        // Insert const after opening quote
-        type_str = format!("'const {}", &type_str[1..]);
+    out.write_all(name.as_bytes())?;
+    for _ in 0..type_.pointer_depth {
+        out.write_all(b" *")?;
     }
+    out.write_all(b"'")?;
+
+    Ok(())
+}
 
-    Ok(type_str)
+/// `'int'` -> `int`
+fn unquote(koffi_type: &str) -> &str {
+    koffi_type.trim_matches('\'')
 }
 
 /// map C primitive type names to Koffi type strings. Note DWARF normalizes
 /// type names so these are a subset of what's possible in C code.
-fn primitive_to_koffi(c_name: &str) -> Result<String> {
+fn primitive_to_koffi(c_name: &str) -> Result<&'static str> {
     let koffi_type = match c_name {
         "void" => "'void'",
         "_Bool" => "'bool'",
@@ -722,17 +905,18 @@ fn primitive_to_koffi(c_name: &str) -> Result<String> {
         }
     };
 
-    Ok(koffi_type.to_string())
+    Ok(koffi_type)
 }
 
-/// generate koffi.proto() definitions for callback types
+/// generate koffi.proto() definitions for callback types, declared lazily
+/// when there are `declarations`
 fn generate_callback_protos(
+    out: &mut impl Write,
     type_registry: &TypeRegistry,
     callbacks: &[(String, TypeId)],
-) -> Result<String> {
-    let mut output = String::new();
-
-    output.push_str("// Callback function pointer types\n");
+    declarations: Option<&Declarations>,
+) -> Result<()> {
+    out.write_all(b"// Callback function pointer types\n")?;
 
     for (typedef_name, func_ptr_type_id) in callbacks {
         let func_ptr_type = type_registry
@@ -745,134 +929,166 @@ fn generate_callback_protos(
             ..
         } = &func_ptr_type.kind
         {
-            // build the callback signature
-            let mut sig = String::new();
+            let dependencies = match declarations {
+                Some(declarations) => declarations
+                    .dependencies(func_ptr_type.kind.referenced_type_ids(), Some(typedef_name))?,
+                None => Vec::new(),
+            };
+            let declare = match declarations {
+                Some(_) => Declare::OnFirstUse(&dependencies),
+                None => Declare::Now,
+            };
+            declare.write_start(out, typedef_name)?;
+            out.write_all(b"koffi.proto('")?;
 
             // return type
             if let Some(ret_id) = return_type_id {
-                let ret_str = type_to_koffi_c_string(type_registry, *ret_id)?;
-                sig.push_str(&ret_str);
+                write_koffi_c_type(out, type_registry, *ret_id)?;
             } else {
-                sig.push_str("void");
+                out.write_all(b"void")?;
             }
-            sig.push(' ');
 
             // callback name
-            sig.push_str(typedef_name);
-            sig.push('(');
+            write!(out, " {}(", typedef_name)?;
 
             // parameters
             if parameter_type_ids.is_empty() {
-                sig.push_str("void");
+                out.write_all(b"void")?;
             } else {
                 for (i, param_id) in parameter_type_ids.iter().enumerate() {
                     if i > 0 {
-                        sig.push_str(", ");
+                        out.write_all(b", ")?;
                     }
-                    let param_str = type_to_koffi_c_string(type_registry, *param_id)?;
-                    sig.push_str(&param_str);
+                    write_koffi_c_type(out, type_registry, *param_id)?;
                 }
             }
 
-            sig.push(')');
-
-            output.push_str(&format!(
-                "const {} = koffi.proto('{}')\n",
-                typedef_name, sig
-            ));
+            out.write_all(b")')")?;
+            match declare {
+                Declare::Now => out.write_all(b"\n")?,
+                Declare::OnFirstUse(_) => out.write_all(b")\n")?,
+            }
         }
     }
 
-    output.push('\n');
+    out.write_all(b"\n")?;
 
-    Ok(output)
+    Ok(())
 }
 
-/// generate function bindings using lib.func() with C signatures
+/// generate function bindings using lib.func() with C signatures, or with
+/// `declarations` getters of `module.exports` that call it on first use
 fn generate_function_bindings(
+    out: &mut impl Write,
     type_registry: &TypeRegistry,
     functions: &[FunctionSignature],
     library_path: &str,
-) -> Result<String> {
-    let mut output = String::new();
-
-    output.push_str("// Library path - UPDATE THIS to match your deployment\n");
-    output.push_str(&format!("const LIBRARY_PATH = '{}'\n\n", library_path));
-
-    output.push_str("// Load library\n");
-    output.push_str("const lib = koffi.load(LIBRARY_PATH)\n\n");
-
-    output.push_str("// Function bindings\n");
+    declarations: Option<&Declarations>,
+    threads: usize,
+) -> Result<()> {
+    out.write_all(b"// Library path - UPDATE THIS to match your deployment\n")?;
+    write!(out, "const LIBRARY_PATH = '{}'\n\n", library_path)?;
+
+    out.write_all(b"// Load library\n")?;
+    out.write_all(b"const lib = koffi.load(LIBRARY_PATH)\n\n")?;
+
+    if declarations.is_some() {
+        out.write_all(
+            b"// Function bindings, each created on first use\n\
+              function bind(name, dependencies, signature) {\n\
+              \x20 Object.defineProperty(module.exports, name, {\n\
+              \x20   configurable: true,\n\
+              \x20   enumerable: true,\n\
+              \x20   get() {\n\
+              \x20     for (const dependency of dependencies) types[dependency]\n\
+              \x20     const func = lib.func(signature)\n\
+              \x20     Object.defineProperty(module.exports, name, { value: func, enumerable: true })\n\
+              \x20     return func\n\
+              \x20   },\n\
+              \x20 })\n\
+              }\n\n",
+        )?;
+    } else {
+        out.write_all(b"// Function bindings\n")?;
+    }
 
-    for func in functions {
+    let rendered = render_each(functions, threads, |buffer, func| {
         if func.is_variadic {
             // Variadic functions not supported
-            output.push_str(&format!(
-                "// {}: variadic function not supported by Koffi\n",
+            writeln!(
+                buffer,
+                "// {}: variadic function not supported by Koffi",
                 func.name
-            ));
-            continue;
+            )?;
+            return Ok(true);
         }
 
         // generate Koffi-compatible C signature
         // (cannot use DWARF signature directly - enums/callbacks need special handling)
-        let koffi_signature = func_to_koffi_signature(type_registry, func)?;
-
-        output.push_str(&format!(
-            "const {} = lib.func('{}')\n",
-            func.name, koffi_signature
-        ));
+        match declarations {
+            Some(declarations) => {
+                let dependencies = declarations.dependencies(func.type_ids(), None)?;
+                write!(buffer, "bind('{}', ", func.name)?;
+                write_names(buffer, &dependencies)?;
+                buffer.write_all(b", '")?;
+            }
+            None => write!(buffer, "const {} = lib.func('", func.name)?,
+        }
+        write_koffi_signature(buffer, type_registry, func)?;
+        buffer.write_all(b"')\n")?;
+        Ok(true)
+    })?;
+    for buffer in rendered.into_iter().flatten() {
+        out.write_all(&buffer)?;
     }
 
-    output.push('\n');
+    out.write_all(b"\n")?;
 
-    Ok(output)
+    Ok(())
 }
 
-/// convert a function signature to Koffi-compatible C signature string
+/// write a function signature as a Koffi-compatible C signature
 /// differences from DWARF signature:
 /// - Enum types replaced with underlying integer types
 /// - Function pointer parameters get * suffix (e.g., Callback*)
-fn func_to_koffi_signature(
+fn write_koffi_signature(
+    out: &mut impl Write,
     type_registry: &TypeRegistry,
     func: &FunctionSignature,
-) -> Result<String> {
-    let mut sig = String::new();
-
+) -> Result<()> {
     // return type
-    let return_type_str = type_to_koffi_c_string(type_registry, func.return_type_id)?;
-    sig.push_str(&return_type_str);
-    sig.push(' ');
+    write_koffi_c_type(out, type_registry, func.return_type_id)?;
 
     // function name
-    sig.push_str(&func.name);
-    sig.push('(');
+    write!(out, " {}(", func.name)?;
 
     // parameters
     if func.parameters.is_empty() {
-        sig.push_str("void");
+        out.write_all(b"void")?;
     } else {
         for (i, param) in func.parameters.iter().enumerate() {
             if i > 0 {
-                sig.push_str(", ");
+                out.write_all(b", ")?;
             }
-            let param_type_str = type_to_koffi_c_string(type_registry, param.type_id)?;
-            sig.push_str(&param_type_str);
+            write_koffi_c_type(out, type_registry, param.type_id)?;
             if !param.name.is_empty() {
-                sig.push(' ');
-                sig.push_str(&param.name);
+                write!(out, " {}", param.name)?;
             }
         }
     }
 
-    sig.push(')');
+    out.write_all(b")")?;
 
-    Ok(sig)
+    Ok(())
 }
 
-/// convert a type to Koffi-compatible C type string for function signatures
-/// this is different from type_to_koffi_string() which is for struct fields
-fn type_to_koffi_c_string(type_registry: &TypeRegistry, type_id: TypeId) -> Result<String> {
+/// write a type as a Koffi-compatible C type for function signatures
+/// this is different from write_koffi_type() which is for struct fields
+fn write_koffi_c_type(
+    out: &mut impl Write,
+    type_registry: &TypeRegistry,
+    type_id: TypeId,
+) -> Result<()> {
     let type_ = type_registry
         .get_type(type_id)
         .ok_or_else(|| anyhow!("Type not found: {:?}", type_id))?;
@@ -892,24 +1108,25 @@ fn type_to_koffi_c_string(type_registry: &TypeRegistry, type_id: TypeId) -> Resu
             {
                 // this is a callback typedef (e.g., Callback, Comparator)
                 // Koffi requires "Callback*" syntax when used as parameter
-                return Ok(format!("{}*", name));
+                write!(out, "{}*", name)?;
+                return Ok(());
             }
         }
     }
 
-    let mut type_str = match &type_.kind {
+    let name = match &type_.kind {
         BaseTypeKind::Primitive { name, .. } => {
             // map DWARF type names to Koffi-compatible C type names
             // Koffi has specific expectations for type names in function signatures
             match name.as_str() {
-                "_Bool" => "bool".to_string(),
-                "signed char" => "char".to_string(),
-                "long double" => "double".to_string(),
-                _ => name.clone(),
+                "_Bool" => "bool",
+                "signed char" => "char",
+                "long double" => "double",
+                _ => name.as_str(),
             }
         }
-        BaseTypeKind::Struct { name, .. } => name.clone(),
-        BaseTypeKind::Union { name, .. } => name.clone(),
+        BaseTypeKind::Struct { name, .. } => name.as_str(),
+        BaseTypeKind::Union { name, .. } => name.as_str(),
         BaseTypeKind::Enum { backing_id, .. } => {
             // replace enum with underlying integer type
             let backing_type = type_registry
@@ -917,8 +1134,8 @@ fn type_to_koffi_c_string(type_registry: &TypeRegistry, type_id: TypeId) -> Resu
                 .ok_or_else(|| anyhow!("Enum backing type not found"))?;
 
             match &backing_type.kind {
-                BaseTypeKind::Primitive { name, .. } => name.clone(),
-                _ => "int".to_string(),
+                BaseTypeKind::Primitive { name, .. } => name.as_str(),
+                _ => "int",
             }
         }
         BaseTypeKind::Array {
@@ -927,7 +1144,7 @@ fn type_to_koffi_c_string(type_registry: &TypeRegistry, type_id: TypeId) -> Resu
             // arrays in function parameters decay to pointers
             // Koffi doesn't accept array syntax like "int[5]*"
             // use the element type - pointer will be added via pointer_depth
-            return type_to_koffi_c_string(type_registry, *element_type_id);
+            return write_koffi_c_type(out, type_registry, *element_type_id);
         }
         BaseTypeKind::Typedef {
             name,
@@ -938,115 +1155,396 @@ fn type_to_koffi_c_string(type_registry: &TypeRegistry, type_id: TypeId) -> Resu
                 .get_type(*aliased_type_id)
                 .ok_or_else(|| anyhow!("Aliased type not found"))?;
 
-            // if typedef points to enum, resolve to underlying int type
-            // BUT: if the current type has pointers, we need to add them after recursion
-            if let BaseTypeKind::Enum { .. } = &aliased.kind {
-                // recursively resolve to get the underlying int type
-                let mut base_str = type_to_koffi_c_string(type_registry, *aliased_type_id)?;
-
-                // add any pointer stars from the typedef itself
-                for _ in 0..type_.pointer_depth {
-                    base_str.push('*');
-                }
-
-                // add const if needed
-                if type_.is_const {
-                    base_str = format!("const {}", base_str);
-                }
-
-                return Ok(base_str);
-            }
-
-            // for typedef to struct/union, use the typedef name
-            // (don't recurse, or we'll get anonymous struct names like "<anonymous>")
             match &aliased.kind {
-                BaseTypeKind::Struct { .. } | BaseTypeKind::Union { .. } => {
-                    // use typedef name to avoid anonymous struct names
-                    name.clone()
-                }
+                // for typedef to struct/union, use the typedef name
+                // (don't recurse, or we'll get anonymous struct names like "<anonymous>")
+                BaseTypeKind::Struct { .. } | BaseTypeKind::Union { .. } => name.as_str(),
                 _ => {
-                    // for other types (primitives, etc), recurse
-                    let mut base_str = type_to_koffi_c_string(type_registry, *aliased_type_id)?;
-
-                    // add any pointer stars from the typedef itself
-                    for _ in 0..type_.pointer_depth {
-                        base_str.push('*');
-                    }
-
-                    // add const if needed
+                    // enums resolve to the underlying int type, other types
+                    // (primitives, etc) recurse. any pointer stars and const
+                    // of the typedef itself still apply
                     if type_.is_const {
-                        base_str = format!("const {}", base_str);
+                        out.write_all(b"const ")?;
                     }
-
-                    return Ok(base_str);
+                    write_koffi_c_type(out, type_registry, *aliased_type_id)?;
+                    for _ in 0..type_.pointer_depth {
+                        out.write_all(b"*")?;
+                    }
+                    return Ok(());
                 }
             }
         }
         BaseTypeKind::Function { .. } => {
             // bare function pointers (not typedef'd)
             // use void* as fallback
-            "void".to_string() // will add * via pointer_depth
+            "void" // will add * via pointer_depth
         }
     };
 
-    // add pointer stars
-    for _ in 0..type_.pointer_depth {
-        type_str.push('*');
-    }
-
     // add const qualifier if needed (before type)
     if type_.is_const {
-        type_str = format!("const {}", type_str);
+        out.write_all(b"const ")?;
+    }
+    out.write_all(name.as_bytes())?;
+    // add pointer stars
+    for _ in 0..type_.pointer_depth {
+        out.write_all(b"*")?;
     }
 
-    Ok(type_str)
+    Ok(())
 }
 
 fn generate_exports(
+    out: &mut impl Write,
     generate_types: bool,
     generate_functions: bool,
-    generated_names: &HashSet<String>,
+    generated_names: &[String],
     functions: &[FunctionSignature],
-) -> Result<String> {
-    let mut output = String::new();
-
-    output.push_str("// Exports\n");
-    output.push_str("module.exports = {\n");
+) -> Result<()> {
+    out.write_all(b"// Exports\n")?;
+    out.write_all(b"module.exports = {\n")?;
 
     if generate_functions {
         // export types under 'types' namespace and individual functions
         if generate_types {
-            output.push_str("  types: {\n");
+            out.write_all(b"  types: {\n")?;
 
             for name in generated_names {
-                output.push_str(&format!("    {},\n", name));
+                writeln!(out, "    {},", name)?;
             }
 
-            output.push_str("  },\n");
+            out.write_all(b"  },\n")?;
         }
 
         // export individual functions
         for func in functions {
             if !func.is_variadic {
-                output.push_str(&format!("  {},\n", func.name));
+                writeln!(out, "  {},", func.name)?;
             }
         }
     } else if generate_types {
         // export types directly
         for name in generated_names {
-            output.push_str(&format!("  {},\n", name));
+            writeln!(out, "  {},", name)?;
         }
     }
 
-    output.push_str("}\n");
+    out.write_all(b"}\n")?;
 
-    Ok(output)
+    Ok(())
 }
 
 #[cfg(test)]
 mod tests {
     use super::*;
 
+    fn char_type(pointer_depth: usize, is_const: bool) -> Type {
+        Type {
+            id: TypeId(0),
+            kind: BaseTypeKind::Primitive {
+                name: "char".to_string(),
+                size: 1,
+                alignment: 1,
+            },
+            pointer_depth,
+            is_const,
+            is_volatile: false,
+            dwarf_offset: None,
+        }
+    }
+
+    #[test]
+    fn test_write_koffi_types_into_one_buffer() {
+        let mut registry = TypeRegistry::new();
+        let string = registry.register_type(char_type(1, true));
+        let element = registry.register_type(char_type(0, false));
+        let array = registry.register_type(Type {
+            kind: BaseTypeKind::Array {
+                element_type_id: element,
+                count: 64,
+                size: 64,
+            },
+            ..char_type(0, false)
+        });
+
+        let mut out = Vec::new();
+        write_koffi_type(&mut out, &registry, string).unwrap();
+        out.push(b' ');
+        write_koffi_type(&mut out, &registry, array).unwrap();
+        out.push(b' ');
+        write_koffi_c_type(&mut out, &registry, string).unwrap();
+
+        assert_eq!(
+            String::from_utf8(out).unwrap(),
+            "'const char *' koffi.array('char', 64) const char*"
+        );
+    }
+
+    fn struct_type(name: &str, fields: &[(&str, TypeId)], pointer_depth: usize) -> Type {
+        Type {
+            kind: BaseTypeKind::Struct {
+                name: name.to_string(),
+                fields: fields
+                    .iter()
+                    .map(|&(name, type_id)| StructField {
+                        name: name.to_string(),
+                        type_id,
+                        offset: 0,
+                        size: 8,
+                        alignment: 8,
+                    })
+                    .collect(),
+                size: 8,
+                alignment: 8,
+                is_opaque: false,
+            },
+            pointer_depth,
+            ..char_type(0, false)
+        }
+    }
+
+    #[test]
+    fn test_lazy_bindings_declare_what_they_use() {
+        let mut registry = TypeRegistry::new();
+        let char_ = registry.register_type(char_type(0, false));
+        let inner_fields = [("c", char_)];
+        let inner = registry.register_type(struct_type("Inner", &inner_fields, 0));
+        let inner_pointer = registry.register_type(struct_type("Inner", &inner_fields, 1));
+        let outer_fields = [("inner", inner), ("next", inner_pointer)];
+        let outer_pointer = registry.register_type(struct_type("Outer", &outer_fields, 1));
+        let outer = registry.register_type(struct_type("Outer", &outer_fields, 0));
+        let anonymous = registry.register_type(struct_type("<anonymous>", &[("o", outer)], 0));
+        let wrapper = registry.register_type(Type {
+            kind: BaseTypeKind::Typedef {
+                name: "Wrapper".to_string(),
+                aliased_type_id: anonymous,
+            },
+            ..char_type(0, false)
+        });
+        let functions = [
+            FunctionSignature {
+                name: "wrap".to_string(),
+                return_type_id: outer_pointer,
+                parameters: vec![dwarffi::Parameter {
+                    name: "w".to_string(),
+                    type_id: wrapper,
+                }],
+                is_variadic: false,
+                is_exported: true,
+            },
+            FunctionSignature {
+                name: "first".to_string(),
+                return_type_id: char_,
+                parameters: Vec::new(),
+                is_variadic: false,
+                is_exported: true,
+            },
+        ];
+
+        let options = KoffiOptions {
+            threads: 1,
+            binding: Binding::Lazy,
+            views: false,
+        };
+        let mut out = Vec::new();
+        generate(
+            &mut out, &registry, &functions, true, true, "./lib.so", options,
+        )
+        .unwrap();
+        let module = String::from_utf8(out).unwrap();
+
+        assert!(module.contains("define('Inner', [], () => koffi.struct('Inner', {\n"));
+        assert!(module.contains("define('Outer', ['Inner'], () => koffi.struct('Outer', {\n"));
+        assert!(module.contains("define('Wrapper', ['Outer'], () => koffi.struct('Wrapper', {\n"));
+        assert!(module.contains("bind('wrap', ['Outer', 'Wrapper'], 'Outer* wrap(Wrapper w)')\n"));
+        assert!(module.contains("bind('first', [], 'char first(void)')\n"));
+        // nothing is declared or bound when the module loads
+        assert!(!module.contains("const Outer"));
+        assert!(!module.contains("const wrap"));
+        assert!(module.ends_with("module.exports.types = types\n"));
+    }
+
+    #[test]
+    fn test_views_of_packed_and_nested_structs() {
+        let mut registry = TypeRegistry::new();
+        let field = |name: &str, type_id, offset, size, alignment| StructField {
+            name: name.to_string(),
+            type_id,
+            offset,
+            size,
+            alignment,
+        };
+        let uint8 = registry.register_type(Type {
+            kind: BaseTypeKind::Primitive {
+                name: "uint8_t".to_string(),
+                size: 1,
+                alignment: 1,
+            },
+            ..char_type(0, false)
+        });
+        let int = registry.register_type(Type {
+            kind: BaseTypeKind::Primitive {
+                name: "int".to_string(),
+                size: 4,
+                alignment: 4,
+            },
+            ..char_type(0, false)
+        });
+        let counts = registry.register_type(Type {
+            kind: BaseTypeKind::Array {
+                element_type_id: int,
+                count: 2,
+                size: 8,
+            },
+            ..char_type(0, false)
+        });
+        let header = registry.register_type(Type {
+            kind: BaseTypeKind::Struct {
+                name: "Header".to_string(),
+                fields: vec![field("kind", uint8, 0, 1, 1), field("length", int, 1, 4, 4)],
+                size: 5,
+                alignment: 1,
+                is_opaque: false,
+            },
+            ..char_type(0, false)
+        });
+        let packet = registry.register_type(Type {
+            kind: BaseTypeKind::Struct {
+                name: "Packet".to_string(),
+                fields: vec![
+                    field("header", header, 0, 5, 1),
+                    // named like what every view has, and like its state
+                    field("bytes", uint8, 5, 1, 1),
+                    field("view", uint8, 6, 1, 1),
+                    field("counts", counts, 8, 8, 4),
+                ],
+                size: 16,
+                alignment: 4,
+                is_opaque: false,
+            },
+            pointer_depth: 1,
+            ..char_type(0, false)
+        });
+        let functions = [FunctionSignature {
+            name: "send".to_string(),
+            return_type_id: int,
+            parameters: vec![dwarffi::Parameter {
+                name: "packet".to_string(),
+                type_id: packet,
+            }],
+            is_variadic: false,
+            is_exported: true,
+        }];
+
+        let options = KoffiOptions {
+            threads: 1,
+            binding: Binding::Eager,
+            views: true,
+        };
+        let mut out = Vec::new();
+        generate(
+            &mut out, &registry, &functions, true, true, "./lib.so", options,
+        )
+        .unwrap();
+        let module = String::from_utf8(out).unwrap();
+
+        assert!(module.contains("const Header = koffi.pack('Header', {\n"));
+        assert!(module.contains("const Packet = koffi.struct('Packet', {\n"));
+        assert!(module.contains("class HeaderView extends StructView {\n  static size = 5\n"));
+        assert!(
+            module.contains("  get length() { return this[VIEW].getInt32(1, LITTLE_ENDIAN) }\n")
+        );
+        assert!(module.contains("  get header() { return new HeaderView(this[BYTES], 0) }\n"));
+        assert!(
+            module.contains(
+                "  get counts() { return viewElements(this, Int32Array, 'Int32', 8, 2) }\n"
+            )
+        );
+        assert!(
+            module.contains("  static offsets = { header: 0, bytes: 5, view: 6, counts: 8 }\n")
+        );
+        assert!(!module.contains("  get bytes() { return this[VIEW]"));
+        assert!(module.contains("  get view() { return this[VIEW].getUint8(6, LITTLE_ENDIAN) }\n"));
+        assert!(module.ends_with("module.exports.views = {\n  HeaderView,\n  PacketView,\n}\n"));
+    }
+
+    #[test]
+    fn test_shared_types_refuse_two_definitions_of_a_name() {
+        let mut registry = TypeRegistry::new();
+        let char_ = registry.register_type(char_type(0, false));
+        let string = registry.register_type(char_type(1, false));
+        let config = registry.register_type(struct_type("Config", &[("name", string)], 1));
+        let other_config = registry.register_type(struct_type("Config", &[("tag", char_)], 1));
+        let opaque_config = registry.register_type(Type {
+            kind: BaseTypeKind::Struct {
+                name: "Config".to_string(),
+                fields: Vec::new(),
+                size: 0,
+                alignment: 1,
+                is_opaque: true,
+            },
+            pointer_depth: 1,
+            ..char_type(0, false)
+        });
+        let function = |name: &str, type_id| FunctionSignature {
+            name: name.to_string(),
+            return_type_id: char_,
+            parameters: vec![dwarffi::Parameter {
+                name: "config".to_string(),
+                type_id,
+            }],
+            is_variadic: false,
+            is_exported: true,
+        };
+        let a = [function("load", config)];
+        let b = [function("save", other_config)];
+        let c = [function("free", opaque_config)];
+
+        let options = KoffiOptions {
+            threads: 1,
+            binding: Binding::Eager,
+            views: false,
+        };
+        let shared = |libraries: &[(&str, &[FunctionSignature])]| {
+            let mut out = Vec::new();
+            generate_shared_types(&mut out, &registry, libraries, options).map(|()| out)
+        };
+
+        let module = String::from_utf8(shared(&[("liba", &a), ("libc", &c)]).unwrap()).unwrap();
+        assert!(module.contains("const Config = koffi.struct('Config', {\n  name: "));
+        assert!(!module.contains("koffi.opaque()"));
+
+        let error = shared(&[("liba", &a), ("libb", &b)]).unwrap_err();
+        assert_eq!(
+            error.to_string(),
+            "libb defines Config unlike the other libraries, and koffi registers one type per name"
+        );
+    }
+
+    #[test]
+    fn test_render_each_keeps_item_order() {
+        let items: Vec<usize> = (0..1000).collect();
+        let render = |buffer: &mut Vec<u8>, item: &usize| {
+            write!(buffer, "{},", item)?;
+            Ok(!item.is_multiple_of(3))
+        };
+
+        let sequential = render_each(&items, 1, render).unwrap();
+        let parallel = render_each(&items, 8, render).unwrap();
+        assert_eq!(sequential, parallel);
+        assert_eq!(parallel[0], None);
+        assert_eq!(parallel[998].as_deref(), Some(b"998,".as_slice()));
+
+        let failed = render_each(&items, 8, |_, item| {
+            if *item == 500 {
+                Err(anyhow!("item {}", item))
+            } else {
+                Ok(true)
+            }
+        });
+        assert!(failed.is_err());
+    }
+
     #[test]
     fn test_primitive_to_koffi_void() {
         assert_eq!(primitive_to_koffi("void").unwrap(), "'void'");
@@ -0,0 +1,319 @@
+/// which types a set of functions needs defined, and in which order.
+///
+/// both passes walk dense [`TypeIndex`]es with an explicit stack and keep
+/// their flags in bitsets, so deep chains of nested types cannot overflow
+/// the stack and no type id is hashed on the way.
+use anyhow::{Result, anyhow};
+use dwarffi::{BaseTypeKind, FunctionSignature, TypeId, TypeIndex, TypeRegistry};
+
+/// one flag per type of a registry
+struct TypeSet {
+    words: Vec<u64>,
+}
+
+impl TypeSet {
+    fn new(registry: &TypeRegistry) -> Self {
+        Self {
+            words: vec![0; registry.len().div_ceil(64)],
+        }
+    }
+
+    fn contains(&self, index: TypeIndex) -> bool {
+        let i = index.0 as usize;
+        self.words[i / 64] & (1 << (i % 64)) != 0
+    }
+
+    /// set the flag of `index`. returns whether it was clear
+    fn insert(&mut self, index: TypeIndex) -> bool {
+        let i = index.0 as usize;
+        let word = &mut self.words[i / 64];
+        let was_clear = *word & (1 << (i % 64)) == 0;
+        *word |= 1 << (i % 64);
+        was_clear
+    }
+
+    fn remove(&mut self, index: TypeIndex) {
+        let i = index.0 as usize;
+        self.words[i / 64] &= !(1 << (i % 64));
+    }
+}
+
+/// the types reachable from the signatures of some functions
+pub struct Reachable {
+    /// every non-primitive type the functions refer to, directly or through
+    /// other types
+    pub required: Vec<TypeIndex>,
+    /// typedefs of function pointers found in return types, parameters and
+    /// (nested) struct fields and array elements, with the function pointer
+    /// type they name
+    pub callbacks: Vec<(String, TypeId)>,
+}
+
+fn index_of(type_registry: &TypeRegistry, type_id: TypeId) -> Result<TypeIndex> {
+    type_registry
+        .index_of(type_id)
+        .ok_or_else(|| anyhow!("Type not found: {:?}", type_id))
+}
+
+/// the types and callbacks `functions` use, in one walk over the type graph
+pub fn reachable(
+    type_registry: &TypeRegistry,
+    functions: &[FunctionSignature],
+) -> Result<Reachable> {
+    let mut required_set = TypeSet::new(type_registry);
+    // types already looked at for callbacks
+    let mut scanned = TypeSet::new(type_registry);
+    let mut required = Vec::new();
+    let mut callbacks = Vec::new();
+
+    // (type, whether to look for callbacks in it). pushed in reverse, so the
+    // functions are walked in order, return type first
+    let mut stack = Vec::new();
+    for func in functions.iter().rev() {
+        for param in func.parameters.iter().rev() {
+            stack.push((index_of(type_registry, param.type_id)?, true));
+        }
+        stack.push((index_of(type_registry, func.return_type_id)?, true));
+    }
+
+    while let Some((index, scan)) = stack.pop() {
+        let type_ = type_registry.get_by_index(index);
+
+        // callbacks are typedefs of function pointers, looked for through
+        // struct fields and array elements only
+        let scan = scan && scanned.insert(index);
+        if scan
+            && let BaseTypeKind::Typedef {
+                name,
+                aliased_type_id,
+            } = &type_.kind
+        {
+            let aliased = type_registry
+                .get_type(*aliased_type_id)
+                .ok_or_else(|| anyhow!("Aliased type not found"))?;
+            if aliased.pointer_depth > 0 && matches!(aliased.kind, BaseTypeKind::Function { .. }) {
+                callbacks.push((name.clone(), *aliased_type_id));
+            }
+        }
+        let scan_members = scan
+            && matches!(
+                type_.kind,
+                BaseTypeKind::Struct { .. } | BaseTypeKind::Array { .. }
+            );
+
+        // primitives don't need definitions
+        let expand =
+            !matches!(type_.kind, BaseTypeKind::Primitive { .. }) && required_set.insert(index);
+        if expand {
+            required.push(index);
+        }
+        if !expand && !scan_members {
+            continue;
+        }
+
+        let references = type_.kind.referenced_type_ids();
+        for &type_id in references.iter().rev() {
+            let child = index_of(type_registry, type_id)?;
+            // struct fields and array elements are exactly the references
+            // of those kinds
+            let child_scan = scan_members && !scanned.contains(child);
+            if child_scan || (expand && !required_set.contains(child)) {
+                stack.push((child, child_scan));
+            }
+        }
+    }
+
+    Ok(Reachable {
+        required,
+        callbacks,
+    })
+}
+
+/// `required` ordered so every type comes after the types its definition
+/// holds by value: struct and union members that are not pointers, array
+/// elements and typedef targets. roots are taken in id order, so the order
+/// does not depend on how `required` was found. pointers may form cycles
+/// and impose no order.
+pub fn emit_order(type_registry: &TypeRegistry, required: &[TypeIndex]) -> Vec<TypeIndex> {
+    let mut in_required = TypeSet::new(type_registry);
+    for &index in required {
+        in_required.insert(index);
+    }
+    let mut done = TypeSet::new(type_registry);
+    let mut on_path = TypeSet::new(type_registry);
+
+    let mut roots = required.to_vec();
+    roots.sort_unstable_by_key(|&index| type_registry.get_by_index(index).id);
+
+    let mut sorted = Vec::with_capacity(required.len());
+    // (type, its next member to look at)
+    let mut stack: Vec<(TypeIndex, usize)> = Vec::new();
+    for root in roots {
+        if done.contains(root) {
+            continue;
+        }
+        on_path.insert(root);
+        stack.push((root, 0));
+
+        while let Some(top) = stack.last_mut() {
+            let (index, member) = *top;
+            top.1 += 1;
+            match held_by_value(type_registry, index, member) {
+                Some(Some(child))
+                    if in_required.contains(child)
+                        && !done.contains(child)
+                        && on_path.insert(child) =>
+                {
+                    stack.push((child, 0));
+                }
+                Some(_) => {}
+                None => {
+                    stack.pop();
+                    on_path.remove(index);
+                    done.insert(index);
+                    sorted.push(index);
+                }
+            }
+        }
+    }
+
+    sorted
+}
+
+/// member `n` of the definition of `index`: `None` past the last member,
+/// `Some(None)` for a member that imposes no order
+fn held_by_value(
+    type_registry: &TypeRegistry,
+    index: TypeIndex,
+    n: usize,
+) -> Option<Option<TypeIndex>> {
+    let value = |type_id: TypeId| {
+        type_registry
+            .index_of(type_id)
+            .filter(|&index| type_registry.get_by_index(index).pointer_depth == 0)
+    };
+    match &type_registry.get_by_index(index).kind {
+        BaseTypeKind::Struct { fields, .. } => fields.get(n).map(|field| value(field.type_id)),
+        BaseTypeKind::Union { variants, .. } => {
+            variants.get(n).map(|variant| value(variant.type_id))
+        }
+        BaseTypeKind::Array {
+            element_type_id, ..
+        } => (n == 0).then(|| type_registry.index_of(*element_type_id)),
+        BaseTypeKind::Typedef {
+            aliased_type_id, ..
+        } => (n == 0).then(|| type_registry.index_of(*aliased_type_id)),
+        _ => None,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use dwarffi::{Parameter, StructField, Type};
+
+    fn register(registry: &mut TypeRegistry, kind: BaseTypeKind, pointer_depth: usize) -> TypeId {
+        registry.register_type(Type {
+            id: TypeId(0),
+            kind,
+            pointer_depth,
+            is_const: false,
+            is_volatile: false,
+            dwarf_offset: None,
+        })
+    }
+
+    fn returning(return_type_id: TypeId, parameters: &[TypeId]) -> FunctionSignature {
+        FunctionSignature {
+            name: "f".to_string(),
+            return_type_id,
+            parameters: parameters
+                .iter()
+                .map(|&type_id| Parameter {
+                    name: "p".to_string(),
+                    type_id,
+                })
+                .collect(),
+            is_variadic: false,
+            is_exported: true,
+        }
+    }
+
+    #[test]
+    fn test_deep_typedef_chain() {
+        let mut registry = TypeRegistry::new();
+        let int = register(
+            &mut registry,
+            BaseTypeKind::Primitive {
+                name: "int".to_string(),
+                size: 4,
+                alignment: 4,
+            },
+            0,
+        );
+        let mut chain = vec![int];
+        for depth in 0..100_000 {
+            let aliased_type_id = *chain.last().unwrap();
+            let typedef = BaseTypeKind::Typedef {
+                name: format!("T{}", depth),
+                aliased_type_id,
+            };
+            chain.push(register(&mut registry, typedef, 0));
+        }
+
+        let reachable = reachable(&registry, &[returning(*chain.last().unwrap(), &[])]).unwrap();
+        assert_eq!(reachable.required.len(), 100_000);
+
+        let order: Vec<TypeId> = emit_order(&registry, &reachable.required)
+            .into_iter()
+            .map(|index| registry.get_by_index(index).id)
+            .collect();
+        assert_eq!(order, chain[1..]);
+    }
+
+    #[test]
+    fn test_callbacks_in_struct_fields() {
+        let mut registry = TypeRegistry::new();
+        let function = BaseTypeKind::Function {
+            return_type_id: None,
+            parameter_type_ids: Vec::new(),
+            is_variadic: false,
+        };
+        let function_pointer = register(&mut registry, function, 1);
+        let callback = |name: &str| BaseTypeKind::Typedef {
+            name: name.to_string(),
+            aliased_type_id: function_pointer,
+        };
+        let on_done = register(&mut registry, callback("OnDone"), 0);
+        let on_error = register(&mut registry, callback("OnError"), 0);
+        let handlers = BaseTypeKind::Struct {
+            name: "Handlers".to_string(),
+            fields: vec![StructField {
+                name: "on_error".to_string(),
+                type_id: on_error,
+                offset: 0,
+                size: 8,
+                alignment: 8,
+            }],
+            size: 8,
+            alignment: 8,
+            is_opaque: false,
+        };
+        let handlers_pointer = register(&mut registry, handlers, 1);
+
+        let functions = [returning(on_done, &[handlers_pointer, on_done])];
+        let reachable = reachable(&registry, &functions).unwrap();
+        let names: Vec<&str> = reachable
+            .callbacks
+            .iter()
+            .map(|(name, _)| name.as_str())
+            .collect();
+        assert_eq!(names, ["OnDone", "OnError"]);
+        assert!(
+            reachable
+                .callbacks
+                .iter()
+                .all(|(_, id)| *id == function_pointer)
+        );
+    }
+}
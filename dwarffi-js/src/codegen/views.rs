@@ -0,0 +1,338 @@
+/// views of plain structs: javascript classes whose getters and setters read
+/// and write the fields in place, in an ArrayBuffer or a TypedArray.
+///
+/// koffi converts a struct argument field by field on every call. the bytes
+/// of a view are handed to a pointer parameter as they are, so a struct that
+/// is filled once and passed often costs nothing per call. a struct gets a
+/// view when every field is a number, a pointer, an array of numbers or a
+/// struct that has a view itself, and none of them is a bitfield. sizes,
+/// alignments and offsets are the ones of the debug info, packing included.
+///
+/// a view keeps its memory under symbols, where no field can hide it. the
+/// fields named like the members of every view, `bytes` and `constructor`,
+/// get no accessor, only an entry in the class's `offsets`.
+use super::type_graph;
+use anyhow::Result;
+use dwarffi::{BaseTypeKind, StructField, Type, TypeId, TypeIndex, TypeRegistry};
+use std::collections::HashSet;
+use std::io::Write;
+
+/// how a view reads a field
+enum Accessor<'a> {
+    /// a DataView getter and setter, e.g. `Int32`
+    Scalar(&'static str),
+    /// the view of a struct held by value
+    Struct(&'a str),
+    /// a typed array over the elements, of the DataView type of one
+    /// element and their count
+    Array(&'static str, usize),
+}
+
+/// members of every view, no field accessor may take their name
+const RESERVED: [&str; 2] = ["bytes", "constructor"];
+
+/// write a view class for every plain struct among the `required` types.
+/// returns the class names, in the order they were written
+pub fn generate(
+    out: &mut impl Write,
+    type_registry: &TypeRegistry,
+    required: &[TypeIndex],
+) -> Result<Vec<String>> {
+    // structs held by value come first, so a nested struct's view is known
+    // before the structs that hold it
+    let mut defined = HashSet::new();
+    let mut viewed = HashSet::new();
+    let mut classes = Vec::new();
+    for index in type_graph::emit_order(type_registry, required) {
+        let type_ = type_registry.get_by_index(index);
+        let Some((name, fields, size, alignment)) = struct_definition(type_registry, type_) else {
+            continue;
+        };
+        // several types may define the same name, the first one wins
+        if !defined.insert(name) || fields.is_empty() {
+            continue;
+        }
+        // bitfields share their bytes, the offsets do not say where they are
+        if fields
+            .windows(2)
+            .any(|pair| pair[1].offset < pair[0].offset + pair[0].size)
+        {
+            log::debug!("no view of {}, its fields overlap", name);
+            continue;
+        }
+        let Some(accessors) = fields
+            .iter()
+            .map(|field| accessor(type_registry, &viewed, field))
+            .collect::<Option<Vec<_>>>()
+        else {
+            log::debug!("no view of {}, not all of its fields are plain data", name);
+            continue;
+        };
+
+        if classes.is_empty() {
+            write_struct_view(out)?;
+        }
+        write_class(out, name, fields, &accessors, size, alignment)?;
+        viewed.insert(name);
+        classes.push(format!("{}View", name));
+    }
+    Ok(classes)
+}
+
+/// `module.exports.views`, when there are any
+pub fn write_export(out: &mut impl Write, classes: &[String]) -> Result<()> {
+    if classes.is_empty() {
+        return Ok(());
+    }
+    out.write_all(b"module.exports.views = {\n")?;
+    for class in classes {
+        writeln!(out, "  {},", class)?;
+    }
+    out.write_all(b"}\n")?;
+    Ok(())
+}
+
+fn write_struct_view(out: &mut impl Write) -> Result<()> {
+    out.write_all(
+        b"// Views: the fields of a plain struct, read and written in place. pass\n\
+          // `view.bytes` to a pointer parameter and koffi hands the memory to the\n\
+          // function as it is, without converting the struct\n\
+          const LITTLE_ENDIAN = new Uint8Array(new Uint16Array([1]).buffer)[0] === 1\n\
+          const BYTES = Symbol('bytes')\n\
+          const VIEW = Symbol('view')\n\
+          \n\
+          class StructView {\n\
+          \x20 constructor(buffer = new ArrayBuffer(new.target.size), offset = 0) {\n\
+          \x20   const bytes = ArrayBuffer.isView(buffer) ? buffer : new Uint8Array(buffer)\n\
+          \x20   this[BYTES] = new Uint8Array(bytes.buffer, bytes.byteOffset + offset, new.target.size)\n\
+          \x20   this[VIEW] = new DataView(bytes.buffer, bytes.byteOffset + offset, new.target.size)\n\
+          \x20 }\n\
+          \n\
+          \x20 get bytes() { return this[BYTES] }\n\
+          }\n\
+          \n\
+          // `count` elements at `offset` of a view, in a typed array over its memory.\n\
+          // typed arrays only start at multiples of their element size: elsewhere\n\
+          // the elements are read and written one by one through the DataView\n\
+          function viewElements(view, Type, kind, offset, count) {\n\
+          \x20 const bytes = view[BYTES]\n\
+          \x20 if ((bytes.byteOffset + offset) % Type.BYTES_PER_ELEMENT === 0) {\n\
+          \x20   return new Type(bytes.buffer, bytes.byteOffset + offset, count)\n\
+          \x20 }\n\
+          \x20 const data = view[VIEW]\n\
+          \x20 const at = (key) => {\n\
+          \x20   const i = typeof key === 'string' ? Number(key) : NaN\n\
+          \x20   return i >= 0 && i < count && String(i) === key ? offset + i * Type.BYTES_PER_ELEMENT : -1\n\
+          \x20 }\n\
+          \x20 const elements = {\n\
+          \x20   length: count,\n\
+          \x20   *[Symbol.iterator]() {\n\
+          \x20     for (let i = 0; i < count; i++) yield this[i]\n\
+          \x20   },\n\
+          \x20 }\n\
+          \x20 return new Proxy(elements, {\n\
+          \x20   get: (target, key, receiver) =>\n\
+          \x20     at(key) < 0 ? Reflect.get(target, key, receiver) : data[`get${kind}`](at(key), LITTLE_ENDIAN),\n\
+          \x20   set: (target, key, value, receiver) =>\n\
+          \x20     at(key) < 0\n\
+          \x20       ? Reflect.set(target, key, value, receiver)\n\
+          \x20       : (data[`set${kind}`](at(key), value, LITTLE_ENDIAN), true),\n\
+          \x20 })\n\
+          }\n\n",
+    )?;
+    Ok(())
+}
+
+fn write_class(
+    out: &mut impl Write,
+    name: &str,
+    fields: &[StructField],
+    accessors: &[Accessor],
+    size: usize,
+    alignment: usize,
+) -> Result<()> {
+    writeln!(out, "class {}View extends StructView {{", name)?;
+    writeln!(out, "  static size = {}", size)?;
+    writeln!(out, "  static alignment = {}", alignment)?;
+    out.write_all(b"  static offsets = {")?;
+    for (i, field) in fields.iter().enumerate() {
+        let separator = if i > 0 { ", " } else { " " };
+        write!(out, "{}{}: {}", separator, field.name, field.offset)?;
+    }
+    out.write_all(b" }\n\n")?;
+
+    for (field, accessor) in fields.iter().zip(accessors) {
+        if RESERVED.contains(&field.name.as_str()) {
+            log::debug!("no accessor of {}.{}, a view has its own", name, field.name);
+            continue;
+        }
+        let (name, offset) = (&field.name, field.offset);
+        match accessor {
+            Accessor::Scalar(kind) => {
+                writeln!(
+                    out,
+                    "  get {}() {{ return this[VIEW].get{}({}, LITTLE_ENDIAN) }}",
+                    name, kind, offset
+                )?;
+                writeln!(
+                    out,
+                    "  set {}(value) {{ this[VIEW].set{}({}, value, LITTLE_ENDIAN) }}",
+                    name, kind, offset
+                )?;
+            }
+            Accessor::Struct(view) => writeln!(
+                out,
+                "  get {}() {{ return new {}View(this[BYTES], {}) }}",
+                name, view, offset
+            )?,
+            Accessor::Array(kind, count) => writeln!(
+                out,
+                "  get {}() {{ return viewElements(this, {}Array, '{}', {}, {}) }}",
+                name, kind, kind, offset, count
+            )?,
+        }
+    }
+    out.write_all(b"}\n\n")?;
+    Ok(())
+}
+
+/// the name, fields, size and alignment of the struct a definition of
+/// `type_` declares: a named struct, or a typedef of an anonymous one
+fn struct_definition<'a>(
+    type_registry: &'a TypeRegistry,
+    type_: &'a Type,
+) -> Option<(&'a str, &'a [StructField], usize, usize)> {
+    let (name, struct_type) = match &type_.kind {
+        BaseTypeKind::Struct { name, .. } if !name.starts_with("<") => (name, type_),
+        BaseTypeKind::Typedef {
+            name,
+            aliased_type_id,
+        } => {
+            let aliased = type_registry.get_type(*aliased_type_id)?;
+            match &aliased.kind {
+                BaseTypeKind::Struct {
+                    name: struct_name, ..
+                } if struct_name.starts_with("<") => (name, aliased),
+                _ => return None,
+            }
+        }
+        _ => return None,
+    };
+    match &struct_type.kind {
+        BaseTypeKind::Struct {
+            fields,
+            size,
+            alignment,
+            is_opaque: false,
+            ..
+        } => Some((name, fields, *size, *alignment)),
+        _ => None,
+    }
+}
+
+/// how to read `field`, `None` when it is not plain data or is a struct
+/// without a view
+fn accessor<'a>(
+    type_registry: &'a TypeRegistry,
+    viewed: &HashSet<&str>,
+    field: &StructField,
+) -> Option<Accessor<'a>> {
+    if field.name.is_empty() {
+        return None;
+    }
+    let (type_, typedef_name) = resolve(type_registry, field.type_id)?;
+    if type_.pointer_depth > 0 {
+        return pointer_scalar(field.size).map(Accessor::Scalar);
+    }
+    match &type_.kind {
+        BaseTypeKind::Struct { name, .. } => {
+            // an anonymous struct is defined under its typedef's name
+            let name = match typedef_name {
+                Some(typedef_name) if name.starts_with("<") => typedef_name,
+                _ => name.as_str(),
+            };
+            viewed.contains(name).then_some(Accessor::Struct(name))
+        }
+        BaseTypeKind::Array {
+            element_type_id,
+            count,
+            ..
+        } => {
+            let (element, _) = resolve(type_registry, *element_type_id)?;
+            let kind = if element.pointer_depth > 0 {
+                pointer_scalar(field.size / (*count).max(1))?
+            } else {
+                scalar(type_registry, element)?.0
+            };
+            Some(Accessor::Array(kind, *count))
+        }
+        _ => {
+            let (kind, size) = scalar(type_registry, type_)?;
+            (size == field.size).then_some(Accessor::Scalar(kind))
+        }
+    }
+}
+
+/// `type_id` with its typedefs followed, and the name of the last one. a
+/// pointer is not followed
+fn resolve(type_registry: &TypeRegistry, mut type_id: TypeId) -> Option<(&Type, Option<&str>)> {
+    let mut typedef_name = None;
+    loop {
+        let type_ = type_registry.get_type(type_id)?;
+        match &type_.kind {
+            BaseTypeKind::Typedef {
+                name,
+                aliased_type_id,
+            } if type_.pointer_depth == 0 => {
+                typedef_name = Some(name.as_str());
+                type_id = *aliased_type_id;
+            }
+            _ => return Some((type_, typedef_name)),
+        }
+    }
+}
+
+/// the DataView accessor of a primitive or enum and its size
+fn scalar(type_registry: &TypeRegistry, type_: &Type) -> Option<(&'static str, usize)> {
+    let (name, size) = match &type_.kind {
+        BaseTypeKind::Primitive { name, size, .. } => (name, *size),
+        BaseTypeKind::Enum { backing_id, .. } => {
+            let (backing, _) = resolve(type_registry, *backing_id)?;
+            match &backing.kind {
+                BaseTypeKind::Primitive { name, size, .. } => (name, *size),
+                _ => return None,
+            }
+        }
+        _ => return None,
+    };
+
+    let float = matches!(name.as_str(), "float" | "double");
+    let unsigned = name == "_Bool"
+        || name == "size_t"
+        || name.starts_with("unsigned")
+        || name.starts_with("uint");
+    let kind = match (float, unsigned, size) {
+        (true, _, 4) => "Float32",
+        (true, _, 8) => "Float64",
+        (false, false, 1) => "Int8",
+        (false, true, 1) => "Uint8",
+        (false, false, 2) => "Int16",
+        (false, true, 2) => "Uint16",
+        (false, false, 4) => "Int32",
+        (false, true, 4) => "Uint32",
+        (false, false, 8) => "BigInt64",
+        (false, true, 8) => "BigUint64",
+        // long double, void
+        _ => return None,
+    };
+    Some((kind, size))
+}
+
+/// pointers are read as addresses
+fn pointer_scalar(size: usize) -> Option<&'static str> {
+    match size {
+        8 => Some("BigUint64"),
+        4 => Some("Uint32"),
+        _ => None,
+    }
+}
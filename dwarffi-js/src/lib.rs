@@ -0,0 +1,7 @@
+//! code generation and the query server behind the `dwarffi-js` binary. a
+//! library of its own so the benchmarks and tests can drive them without
+//! going through the CLI.
+
+pub mod codegen;
+#[cfg(unix)]
+pub mod serve;
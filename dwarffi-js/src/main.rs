@@ -1,10 +1,12 @@
-use anyhow::Result;
+use anyhow::{Context, Result, anyhow, bail};
 use clap::Parser;
 use log::{debug, info, warn};
-use std::path::PathBuf;
+use std::collections::HashSet;
+use std::io::{BufWriter, Write};
+use std::path::{Path, PathBuf};
+use std::time::{Duration, Instant};
 
-mod codegen;
-use codegen::{FfiBackend, JsCodegen};
+use dwarffi_js::codegen::{Binding, FfiBackend, JsCodegen};
 
 /// dwarffi-js - extract C FFI signatures and generate JavaScript bindings
 #[derive(Parser)]
@@ -12,8 +14,11 @@ use codegen::{FfiBackend, JsCodegen};
 #[command(version)]
 #[command(about = "extract function signatures from C libraries using DWARF debug info", long_about = None)]
 struct Cli {
-    /// path to the library file (.dylib, .so, .o, or dSYM)
-    library: PathBuf,
+    /// path to the library file (.dylib, .so, .o, or dSYM). several
+    /// libraries are analyzed together, sharing their types
+    #[cfg_attr(unix, arg(required_unless_present = "serve"))]
+    #[cfg_attr(not(unix), arg(required = true))]
+    libraries: Vec<PathBuf>,
 
     /// show all functions (including internal/hidden ones)
     #[arg(long)]
@@ -39,6 +44,16 @@ struct Cli {
     #[arg(long)]
     functions: bool,
 
+    /// declare each type with koffi and bind each function when it is first
+    /// used instead of when the module is loaded
+    #[arg(long, requires = "js")]
+    lazy: bool,
+
+    /// also generate a view class of each plain struct that reads and writes
+    /// its fields in place, in an ArrayBuffer
+    #[arg(long, requires = "js")]
+    views: bool,
+
     /// library path to use in generated bindings (e.g., ./libtestlib.dylib)
     #[arg(long)]
     library_path: Option<String>,
@@ -46,6 +61,110 @@ struct Cli {
     /// output JSON representation of types and functions
     #[arg(short = 'j', long)]
     json: bool,
+
+    /// output the same representation as --json, encoded with bincode
+    #[arg(long, conflicts_with_all = ["js", "json"])]
+    bincode: bool,
+
+    /// worker threads for DWARF analysis and code generation (0 = all
+    /// available cores)
+    #[arg(long, default_value_t = 0)]
+    threads: usize,
+
+    /// walk every unit, even when address ranges or name accelerator tables
+    /// show that it defines no exported function
+    #[arg(long)]
+    full_scan: bool,
+
+    /// reuse analysis results stored in this directory, keyed by the
+    /// library's build id
+    #[arg(long)]
+    cache_dir: Option<PathBuf>,
+
+    /// print C signatures as each compilation unit is analyzed, sorted per
+    /// unit instead of across the whole library
+    #[arg(long, conflicts_with_all = ["js", "json", "bincode"])]
+    stream: bool,
+
+    /// keep at most this many megabytes of types in memory, writing the
+    /// others and every signature to temporary files. for C signatures,
+    /// --json and --bincode of a single library
+    #[arg(long, value_name = "MB", conflicts_with_all = ["js", "stream", "cache_dir"])]
+    memory_budget: Option<usize>,
+
+    /// where --memory-budget puts its temporary files (default: the system's
+    /// temporary directory)
+    #[arg(long, value_name = "DIR", requires = "memory_budget")]
+    spill_dir: Option<PathBuf>,
+
+    /// only keep functions matching this name or glob (e.g. 'mylib_*'),
+    /// may be repeated
+    #[arg(long, value_name = "GLOB")]
+    include: Vec<String>,
+
+    /// drop functions matching this name or glob, may be repeated
+    #[arg(long, value_name = "GLOB")]
+    exclude: Vec<String>,
+
+    /// only keep the functions named in this file, one per line
+    #[arg(long, value_name = "FILE")]
+    functions_from: Option<PathBuf>,
+
+    /// write a shared types.js and one <library>.js module of function
+    /// bindings per library into this directory
+    #[arg(long, value_name = "DIR", requires = "js")]
+    out_dir: Option<PathBuf>,
+
+    /// keep analyses in memory and answer queries about any library on this
+    /// unix socket, one JSON request per line. the libraries given are
+    /// analyzed up front
+    #[cfg(unix)]
+    #[arg(
+        long,
+        value_name = "SOCKET",
+        conflicts_with_all = ["js", "json", "bincode", "stream", "memory_budget", "out_dir"]
+    )]
+    serve: Option<PathBuf>,
+
+    /// print where the analysis spent its time and how much work it did to
+    /// stderr, as text or as JSON
+    #[arg(
+        long,
+        value_enum,
+        value_name = "FORMAT",
+        num_args = 0..=1,
+        require_equals = true,
+        default_missing_value = "text",
+        conflicts_with = "stream"
+    )]
+    stats: Option<StatsFormat>,
+}
+
+impl Cli {
+    /// the format of the analysis as data, when that is the output
+    fn export_format(&self) -> Option<dwarffi::ExportFormat> {
+        if self.json {
+            Some(dwarffi::ExportFormat::Json)
+        } else if self.bincode {
+            Some(dwarffi::ExportFormat::Bincode)
+        } else {
+            None
+        }
+    }
+
+    fn binding(&self) -> Binding {
+        if self.lazy {
+            Binding::Lazy
+        } else {
+            Binding::Eager
+        }
+    }
+}
+
+#[derive(Clone, Copy, clap::ValueEnum)]
+enum StatsFormat {
+    Text,
+    Json,
 }
 
 fn main() -> Result<()> {
@@ -55,7 +174,9 @@ fn main() -> Result<()> {
 
     let exported_only = !cli.all;
 
-    info!("library: {}", cli.library.display());
+    for library in &cli.libraries {
+        info!("library: {}", library.display());
+    }
     info!(
         "mode: {}",
         if exported_only {
@@ -65,50 +186,100 @@ fn main() -> Result<()> {
         }
     );
 
+    let mut filter = dwarffi::FunctionFilter::new();
+    for pattern in &cli.include {
+        filter.include(pattern.as_str());
+    }
+    for pattern in &cli.exclude {
+        filter.exclude(pattern.as_str());
+    }
+    if let Some(list) = &cli.functions_from {
+        let list = std::fs::read_to_string(list)
+            .with_context(|| format!("failed to read function list: {}", list.display()))?;
+        filter.include_list(&list);
+    }
+
+    let options = dwarffi::AnalysisOptions {
+        exported_only,
+        threads: cli.threads,
+        use_name_index: !cli.full_scan,
+        // C signatures only name their types, bindings need the members
+        type_members: cli.js || cli.json || cli.bincode,
+        filter,
+        ..dwarffi::AnalysisOptions::default()
+    };
+    #[cfg(unix)]
+    if let Some(socket) = &cli.serve {
+        return serve(&cli, options, socket);
+    }
+    if cli.libraries.len() > 1 || cli.out_dir.is_some() {
+        return analyze_batch(&cli, &options);
+    }
+
     // load the library
-    debug!("load library file: {}", cli.library.display());
-    let analyzer = dwarffi::DwarfAnalyzer::from_file(&cli.library)?;
+    let library = &cli.libraries[0];
+    debug!("load library file: {}", library.display());
+    let analyzer = dwarffi::DwarfAnalyzer::from_file(library)?;
 
-    let result = analyzer.extract_analysis(exported_only)?;
+    if cli.stream {
+        return stream_signatures(&analyzer, &options);
+    }
+    if let Some(megabytes) = cli.memory_budget {
+        return analyze_spilled(&cli, &analyzer, &options, megabytes);
+    }
+
+    let result = match &cli.cache_dir {
+        Some(dir) => {
+            analyzer.extract_analysis_cached(&options, &dwarffi::AnalysisCache::new(dir))?
+        }
+        None => analyzer.extract_analysis_with(&options)?,
+    };
 
     if result.signatures.is_empty() {
         warn!(
             "no functions found in the library. maybe you compiled without debug info, or stripped the binary?"
         );
-        return Ok(());
+        return print_stats(cli.stats, &result.stats, None);
     }
 
     // sort signatures by name for consistent output
     let mut sorted_sigs = result.signatures;
     sorted_sigs.sort_by(|a, b| a.name.cmp(&b.name));
 
-    if cli.json {
-        unimplemented!("JSON output not yet implemented");
+    let mut codegen = None;
+    if let Some(format) = cli.export_format() {
+        let out = BufWriter::new(std::io::stdout().lock());
+        let libraries = [(library.as_path(), sorted_sigs.as_slice())];
+        dwarffi::write_export(out, format, libraries, &result.type_registry)?;
     } else if cli.js {
         // determine what to generate
         let generate_types = true; // types always needed
         let generate_functions = cli.functions;
+        // Always use Koffi
+        let js = JsCodegen::new(FfiBackend::default(), cli.threads)
+            .with_binding(cli.binding())
+            .with_views(cli.views);
 
         // library path for function bindings
         let library_path = cli.library_path.unwrap_or_else(|| {
             // default: use the input library filename
-            cli.library
-                .file_name()
-                .and_then(|n| n.to_str())
-                .map(|s| format!("./{}", s))
-                .unwrap_or_else(|| "./library.dylib".to_string())
+            default_library_path(library)
         });
 
-        // generate JavaScript bindings using Koffi
-        let js_code = JsCodegen::generate_module(
+        // generate JavaScript bindings using Koffi, straight to stdout
+        let mut out = BufWriter::new(std::io::stdout().lock());
+        let start = Instant::now();
+        js.generate_module(
+            &mut out,
             &result.type_registry,
             &sorted_sigs,
             generate_types,
             generate_functions,
             &library_path,
-            FfiBackend::default(), // Always use Koffi
         )?;
-        println!("{}", js_code);
+        writeln!(out)?;
+        out.flush()?;
+        codegen = Some(start.elapsed());
     } else {
         // standard C signature output
         for sig in &sorted_sigs {
@@ -116,6 +287,257 @@ fn main() -> Result<()> {
         }
     }
 
+    print_stats(cli.stats, &result.stats, codegen)
+}
+
+/// print `stats`, and the time spent generating bindings, to stderr
+fn print_stats(
+    format: Option<StatsFormat>,
+    stats: &dwarffi::AnalysisStats,
+    codegen: Option<Duration>,
+) -> Result<()> {
+    let ms = |duration: Duration| duration.as_secs_f64() * 1e3;
+    match format {
+        None => {}
+        Some(StatsFormat::Text) => {
+            let mut err = std::io::stderr().lock();
+            for (name, duration) in stats.phases() {
+                writeln!(err, "{:<20}{:>12.3} ms", name, ms(duration))?;
+            }
+            if let Some(codegen) = codegen {
+                writeln!(err, "{:<20}{:>12.3} ms", "codegen", ms(codegen))?;
+            }
+            for (name, count) in stats.counters() {
+                writeln!(err, "{:<20}{:>12}", name, count)?;
+            }
+        }
+        Some(StatsFormat::Json) => {
+            let mut phases: serde_json::Map<String, serde_json::Value> = stats
+                .phases()
+                .into_iter()
+                .map(|(name, duration)| (name.to_string(), ms(duration).into()))
+                .collect();
+            if let Some(codegen) = codegen {
+                phases.insert("codegen".to_string(), ms(codegen).into());
+            }
+            let counters: serde_json::Map<String, serde_json::Value> = stats
+                .counters()
+                .into_iter()
+                .map(|(name, count)| (name.to_string(), count.into()))
+                .collect();
+            let json = serde_json::json!({ "phases_ms": phases, "counters": counters });
+            eprintln!("{}", json);
+        }
+    }
+    Ok(())
+}
+
+/// the path generated bindings load `library` from when none is given
+fn default_library_path(library: &Path) -> String {
+    library
+        .file_name()
+        .and_then(|n| n.to_str())
+        .map(|s| format!("./{}", s))
+        .unwrap_or_else(|| "./library.dylib".to_string())
+}
+
+/// analyze several libraries into one type registry. with --out-dir each
+/// library gets a bindings module and the types they use go into one shared
+/// module; otherwise the C signatures of each library are printed.
+fn analyze_batch(cli: &Cli, options: &dwarffi::AnalysisOptions) -> Result<()> {
+    if cli.stream {
+        bail!("--stream takes a single library");
+    }
+    if cli.memory_budget.is_some() {
+        bail!("--memory-budget takes a single library");
+    }
+    if cli.library_path.is_some() && cli.libraries.len() > 1 {
+        bail!("--library-path takes a single library, each module loads its own file");
+    }
+    if cli.js && cli.out_dir.is_none() {
+        bail!("--js with several libraries needs --out-dir");
+    }
+    if cli.cache_dir.is_some() {
+        warn!("--cache-dir is not used when analyzing several libraries");
+    }
+
+    let mut batch = dwarffi::DwarfAnalyzer::analyze_batch(&cli.libraries, options)?;
+    for library in &mut batch.libraries {
+        library.signatures.sort_by(|a, b| a.name.cmp(&b.name));
+    }
+
+    if let Some(format) = cli.export_format() {
+        let out = BufWriter::new(std::io::stdout().lock());
+        let libraries = batch
+            .libraries
+            .iter()
+            .map(|library| (library.path.as_path(), library.signatures.as_slice()));
+        dwarffi::write_export(out, format, libraries, &batch.type_registry)?;
+        return print_stats(cli.stats, &batch.stats, None);
+    }
+
+    let Some(out_dir) = &cli.out_dir else {
+        for library in &batch.libraries {
+            println!("// {}", library.path.display());
+            for sig in &library.signatures {
+                println!("{};", sig.to_string(&batch.type_registry));
+            }
+        }
+        return print_stats(cli.stats, &batch.stats, None);
+    };
+
+    std::fs::create_dir_all(out_dir)
+        .with_context(|| format!("failed to create output dir: {}", out_dir.display()))?;
+
+    let names: Vec<String> = batch
+        .libraries
+        .iter()
+        .map(|library| library.path.display().to_string())
+        .collect();
+    let libraries: Vec<(&str, &[dwarffi::FunctionSignature])> = names
+        .iter()
+        .zip(&batch.libraries)
+        .map(|(name, library)| (name.as_str(), library.signatures.as_slice()))
+        .collect();
+    let start = Instant::now();
+    let codegen = JsCodegen::new(FfiBackend::default(), cli.threads)
+        .with_binding(cli.binding())
+        .with_views(cli.views);
+    write_module(&out_dir.join("types.js"), |out| {
+        codegen.generate_types_module(out, &batch.type_registry, &libraries)
+    })?;
+
+    let mut module_names = HashSet::new();
+    for library in &batch.libraries {
+        let module_name = library
+            .path
+            .file_stem()
+            .and_then(|stem| stem.to_str())
+            .ok_or_else(|| anyhow!("no module name for {}", library.path.display()))?;
+        if module_name == "types" || !module_names.insert(module_name) {
+            bail!("two libraries would both be written to {}.js", module_name);
+        }
+
+        let library_path = cli
+            .library_path
+            .clone()
+            .unwrap_or_else(|| default_library_path(&library.path));
+        write_module(&out_dir.join(format!("{}.js", module_name)), |out| {
+            codegen.generate_library_module(
+                out,
+                &batch.type_registry,
+                &library.signatures,
+                &library_path,
+                "./types.js",
+            )
+        })?;
+    }
+    print_stats(cli.stats, &batch.stats, Some(start.elapsed()))
+}
+
+/// create `path` and let `generate` write a module into it
+fn write_module(
+    path: &Path,
+    generate: impl FnOnce(&mut BufWriter<std::fs::File>) -> Result<()>,
+) -> Result<()> {
+    info!("write {}", path.display());
+    let file = std::fs::File::create(path)
+        .with_context(|| format!("failed to create {}", path.display()))?;
+    let mut out = BufWriter::new(file);
+    generate(&mut out)
+        .and_then(|()| Ok(out.flush()?))
+        .inspect_err(|_| {
+            // don't leave half a module behind
+            let _ = std::fs::remove_file(path);
+        })
+        .with_context(|| format!("failed to write {}", path.display()))
+}
+
+/// analyze within a memory budget and write the result from the spill
+/// files, one signature at a time
+fn analyze_spilled(
+    cli: &Cli,
+    analyzer: &dwarffi::DwarfAnalyzer,
+    options: &dwarffi::AnalysisOptions,
+    megabytes: usize,
+) -> Result<()> {
+    let dir = cli.spill_dir.clone().unwrap_or_else(std::env::temp_dir);
+    let budget = dwarffi::MemoryBudget::new(megabytes << 20, dir);
+    let mut result = analyzer.extract_analysis_spilled(options, &budget)?;
+    if result.signatures.is_empty() {
+        warn!(
+            "no functions found in the library. maybe you compiled without debug info, or stripped the binary?"
+        );
+        return print_stats(cli.stats, &result.stats, None);
+    }
+    result.signatures.sort_by_name();
+
+    if let Some(format) = cli.export_format() {
+        let out = BufWriter::new(std::io::stdout().lock());
+        dwarffi::write_spilled_export(out, format, &cli.libraries[0], &result)?;
+    } else {
+        let mut out = BufWriter::new(std::io::stdout().lock());
+        for sig in result.signatures.iter() {
+            let sig = sig?;
+            let registry = result.type_registry.snapshot(sig.type_ids())?;
+            writeln!(out, "{};", sig.to_string(&registry))?;
+        }
+        out.flush()?;
+    }
+    print_stats(cli.stats, &result.stats, None)
+}
+
+/// answer queries on `socket` until the process is stopped
+#[cfg(unix)]
+fn serve(cli: &Cli, options: dwarffi::AnalysisOptions, socket: &Path) -> Result<()> {
+    use std::os::unix::fs::FileTypeExt;
+
+    // queries may ask for bindings, which need the members
+    let options = dwarffi::AnalysisOptions {
+        type_members: true,
+        ..options
+    };
+    let mut service = dwarffi::AnalysisService::new(options);
+    if let Some(dir) = &cli.cache_dir {
+        service = service.with_cache(dwarffi::AnalysisCache::new(dir));
+    }
+    for library in &cli.libraries {
+        service.library(library)?;
+    }
+
+    // the socket of an earlier run that was stopped
+    if std::fs::symlink_metadata(socket).is_ok_and(|metadata| metadata.file_type().is_socket()) {
+        std::fs::remove_file(socket)?;
+    }
+    let listener = std::os::unix::net::UnixListener::bind(socket)
+        .with_context(|| format!("failed to listen on {}", socket.display()))?;
+    info!("serving on {}", socket.display());
+    dwarffi_js::serve::serve(&listener, &service, cli.threads)
+}
+
+/// print each unit's signatures as soon as it is analyzed
+fn stream_signatures(
+    analyzer: &dwarffi::DwarfAnalyzer,
+    options: &dwarffi::AnalysisOptions,
+) -> Result<()> {
+    let mut stdout = std::io::stdout().lock();
+    let mut found = 0;
+
+    analyzer.analyze_streaming(options, |mut unit| {
+        unit.signatures.sort_by(|a, b| a.name.cmp(&b.name));
+        let registry = unit.registry()?;
+        for sig in &unit.signatures {
+            writeln!(stdout, "{};", sig.to_string(&registry))?;
+        }
+        found += unit.signatures.len();
+        Ok(())
+    })?;
+
+    if found == 0 {
+        warn!(
+            "no functions found in the library. maybe you compiled without debug info, or stripped the binary?"
+        );
+    }
     Ok(())
 }
 
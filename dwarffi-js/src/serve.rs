@@ -0,0 +1,179 @@
+//! `--serve`: answer queries about libraries over a local socket, from
+//! analyses an [`AnalysisService`] keeps in memory.
+//!
+//! a client writes one JSON request per line and reads one JSON response per
+//! line, on as many connections as it likes. every request names the
+//! library it is about and a `query`:
+//!
+//! - `functions`: the names of its functions
+//! - `signature`, with a `name`: the C signature of that function, and the
+//!   function as in an export
+//! - `types`, with a `name`: every type the function refers to, in id order
+//! - `js`: a koffi module, with the optional `functions` (bind functions
+//!   too), `library_path`, `lazy` and `views` of the command line flags
+//!
+//! a response has `"ok": true` and the answer, or `"ok": false` and an
+//! `error`.
+
+use crate::codegen::{Binding, FfiBackend, JsCodegen};
+use anyhow::{Result, anyhow};
+use dwarffi::{AnalysisService, Type};
+use serde::Deserialize;
+use serde_json::{Value, json};
+use std::io::{BufRead, BufReader, Write};
+use std::os::unix::net::UnixListener;
+use std::path::PathBuf;
+
+#[derive(Debug, Deserialize)]
+#[serde(tag = "query", rename_all = "snake_case")]
+enum Request {
+    Functions {
+        library: PathBuf,
+    },
+    Signature {
+        library: PathBuf,
+        name: String,
+    },
+    Types {
+        library: PathBuf,
+        name: String,
+    },
+    Js {
+        library: PathBuf,
+        #[serde(default)]
+        functions: bool,
+        library_path: Option<String>,
+        #[serde(default)]
+        lazy: bool,
+        #[serde(default)]
+        views: bool,
+    },
+}
+
+/// accept connections on `listener` until it fails, each on a thread of
+/// its own. `threads` is the code generation worker count
+pub fn serve(listener: &UnixListener, service: &AnalysisService, threads: usize) -> Result<()> {
+    std::thread::scope(|scope| {
+        for stream in listener.incoming() {
+            let stream = stream?;
+            scope.spawn(move || {
+                let result = stream.try_clone().map_err(Into::into).and_then(|input| {
+                    handle_connection(BufReader::new(input), &stream, service, threads)
+                });
+                if let Err(e) = result {
+                    log::warn!("client went away: {:#}", e);
+                }
+            });
+        }
+        Ok(())
+    })
+}
+
+/// answer every request of `input` on `output`, until `input` ends
+pub fn handle_connection(
+    input: impl BufRead,
+    mut output: impl Write,
+    service: &AnalysisService,
+    threads: usize,
+) -> Result<()> {
+    for line in input.lines() {
+        let line = line?;
+        if line.trim().is_empty() {
+            continue;
+        }
+        let response = serde_json::from_str::<Request>(&line)
+            .map_err(Into::into)
+            .and_then(|request| answer(request, service, threads))
+            .unwrap_or_else(|e| json!({ "ok": false, "error": format!("{:#}", e) }));
+        serde_json::to_writer(&mut output, &response)?;
+        output.write_all(b"\n")?;
+        output.flush()?;
+    }
+    Ok(())
+}
+
+fn answer(request: Request, service: &AnalysisService, threads: usize) -> Result<Value> {
+    log::debug!("query: {:?}", request);
+    let missing = |name: &str| anyhow!("no function named {}", name);
+    match request {
+        Request::Functions { library } => {
+            let library = service.library(&library)?;
+            let names: Vec<&str> = library
+                .signatures
+                .iter()
+                .map(|sig| sig.name.as_str())
+                .collect();
+            Ok(json!({ "ok": true, "functions": names }))
+        }
+        Request::Signature { library, name } => {
+            let library = service.library(&library)?;
+            let sig = library.signature(&name).ok_or_else(|| missing(&name))?;
+            Ok(json!({
+                "ok": true,
+                "c": sig.to_string(&library.type_registry),
+                "function": sig,
+            }))
+        }
+        Request::Types { library, name } => {
+            let library = service.library(&library)?;
+            let types = library.type_closure(&name).ok_or_else(|| missing(&name))?;
+            let types: Vec<&Type> = types.all_types().collect();
+            Ok(json!({ "ok": true, "types": types }))
+        }
+        Request::Js {
+            library,
+            functions,
+            library_path,
+            lazy,
+            views,
+        } => {
+            let library = service.library(&library)?;
+            let binding = if lazy { Binding::Lazy } else { Binding::Eager };
+            let js = JsCodegen::new(FfiBackend::default(), threads)
+                .with_binding(binding)
+                .with_views(views);
+            let library_path = library_path.unwrap_or_else(|| library.path.display().to_string());
+            let mut module = Vec::new();
+            js.generate_module(
+                &mut module,
+                &library.type_registry,
+                &library.signatures,
+                true,
+                functions,
+                &library_path,
+            )?;
+            Ok(json!({ "ok": true, "module": String::from_utf8(module)? }))
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use dwarffi::AnalysisOptions;
+
+    #[test]
+    fn test_errors_are_answered() {
+        let service = AnalysisService::new(AnalysisOptions::default());
+        let input = b"{\"query\":\"nothing\"}\n\n{\"query\":\"functions\",\"library\":\"/no/such/lib.so\"}\n";
+        let mut output = Vec::new();
+        handle_connection(&input[..], &mut output, &service, 1).unwrap();
+
+        let responses: Vec<Value> = output
+            .split(|&byte| byte == b'\n')
+            .filter(|line| !line.is_empty())
+            .map(|line| serde_json::from_slice(line).unwrap())
+            .collect();
+        assert_eq!(responses.len(), 2);
+        for response in &responses {
+            assert_eq!(response["ok"], false);
+        }
+        assert!(
+            responses[1]["error"]
+                .as_str()
+                .unwrap()
+                .contains("/no/such/lib.so")
+        );
+        assert!(service.loaded().is_empty());
+    }
+}
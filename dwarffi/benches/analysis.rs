@@ -0,0 +1,131 @@
+//! analysis throughput on synthetic libraries built with DWARF 4 and 5.
+//!
+//! `cargo bench -p dwarffi --bench analysis`. see `fixture` for the sizes.
+
+mod fixture;
+
+use dwarffi::{AnalysisOptions, DwarfAnalyzer, TypeRegistry};
+use fixture::{Fixture, best_of, per_second};
+use object::{Object, ObjectSection};
+use std::borrow::Cow;
+use std::path::Path;
+use std::time::{Duration, Instant};
+
+fn main() {
+    let dir = Path::new(env!("CARGO_TARGET_TMPDIR")).join("bench-fixtures");
+    let runs = fixture::runs();
+
+    let mut registries = Vec::new();
+    for dwarf_version in [4, 5] {
+        let fixture = Fixture::from_env(dwarf_version);
+        let (debug_info, _) = fixture.build(&dir);
+        let dies = count_dies(&debug_info);
+        let analyzer = DwarfAnalyzer::from_file(&debug_info).expect("failed to open fixture");
+        println!("{}: {} DIEs", fixture.name(), dies);
+
+        let mut registry = TypeRegistry::new();
+        for threads in [1, 0] {
+            let options = AnalysisOptions {
+                threads,
+                ..AnalysisOptions::default()
+            };
+            let (elapsed, result) = best_of(runs, || {
+                analyzer
+                    .extract_analysis_with(&options)
+                    .expect("analysis failed")
+            });
+            println!(
+                "  analyze, {}: {:>9.2?}  {} DIEs/s  {} types/s  ({} functions, {} types)",
+                if threads == 0 {
+                    "all threads"
+                } else {
+                    "1 thread"
+                },
+                elapsed,
+                per_second(dies, elapsed),
+                per_second(result.type_registry.len(), elapsed),
+                result.signatures.len(),
+                result.type_registry.len(),
+            );
+            registry = result.type_registry;
+        }
+
+        // every unit hashes the shape of the header types before it can
+        // reuse them, which has to stay cheaper than resolving them again
+        for share_declarations in [true, false] {
+            let options = AnalysisOptions {
+                threads: 1,
+                share_declarations,
+                ..AnalysisOptions::default()
+            };
+            let (elapsed, result) = best_of(runs, || {
+                analyzer
+                    .extract_analysis_with(&options)
+                    .expect("analysis failed")
+            });
+            println!(
+                "  declarations {}: {:>9.2?}  resolution {:>9.2?}  ({} of {} lookups hit)",
+                if share_declarations {
+                    "shared"
+                } else {
+                    "per unit"
+                },
+                elapsed,
+                result.stats.type_resolution,
+                result.stats.decl_hits,
+                result.stats.decl_lookups,
+            );
+        }
+        registries.push(registry);
+    }
+
+    // the two builds describe the same types, so most of the merge is
+    // deduplication
+    let mut best = Duration::MAX;
+    let mut merged = TypeRegistry::new();
+    for _ in 0..runs.max(1) {
+        let (mut into, from) = (registries[0].clone(), registries[1].clone());
+        let start = Instant::now();
+        into.merge(from);
+        best = best.min(start.elapsed());
+        merged = into;
+    }
+    let merged_types = registries[0].len() + registries[1].len();
+    println!(
+        "merge dwarf4 + dwarf5: {:>9.2?}  {} types/s  ({} types -> {})",
+        best,
+        per_second(merged_types, best),
+        merged_types,
+        merged.len(),
+    );
+}
+
+/// number of DIEs in all units of the object at `path`
+fn count_dies(path: &Path) -> usize {
+    let data = std::fs::read(path).expect("failed to read fixture");
+    let file = object::File::parse(&*data).expect("fixture is not an object file");
+    let endian = if file.is_little_endian() {
+        gimli::RunTimeEndian::Little
+    } else {
+        gimli::RunTimeEndian::Big
+    };
+    let sections = gimli::DwarfSections::load(|id| -> Result<Cow<[u8]>, gimli::Error> {
+        Ok(file
+            .section_by_name(id.name())
+            .and_then(|section| section.uncompressed_data().ok())
+            .unwrap_or(Cow::Borrowed(&[])))
+    })
+    .expect("failed to load DWARF sections");
+    let dwarf = sections.borrow(|section| gimli::EndianSlice::new(section, endian));
+
+    let mut dies = 0;
+    let mut headers = dwarf.units();
+    while let Some(header) = headers.next().expect("bad unit header") {
+        let unit = dwarf.unit(header).expect("bad unit");
+        let mut entries = unit.entries();
+        while entries.next_dfs().expect("bad DIE").is_some() {
+            dies += 1;
+        }
+    }
+    dies
+}
@@ -0,0 +1,192 @@
+//! synthetic C libraries for the benchmarks.
+//!
+//! a fixture is `units` compilation units that all include one header with a
+//! chain of `depth` nested structs, an enum, a union and a callback typedef,
+//! and export `functions` functions each. every unit also defines a struct
+//! of its own, so there are types shared between units and types that are
+//! not. sizes can be overridden with `DWARFFI_BENCH_UNITS`,
+//! `DWARFFI_BENCH_FUNCTIONS` and `DWARFFI_BENCH_DEPTH`.
+//!
+//! only `int`, `unsigned int`, `char`, `float` and `double` are used, the
+//! types koffi can name on every platform.
+
+use std::fmt::Write as _;
+use std::path::{Path, PathBuf};
+use std::process::Command;
+
+#[derive(Debug, Clone, Copy)]
+pub struct Fixture {
+    pub units: usize,
+    pub functions: usize,
+    pub depth: usize,
+    pub dwarf_version: u8,
+}
+
+impl Fixture {
+    /// the default fixture for `dwarf_version`, with sizes from the
+    /// environment
+    pub fn from_env(dwarf_version: u8) -> Self {
+        Self {
+            units: env_usize("DWARFFI_BENCH_UNITS", 32),
+            functions: env_usize("DWARFFI_BENCH_FUNCTIONS", 64),
+            depth: env_usize("DWARFFI_BENCH_DEPTH", 12).max(1),
+            dwarf_version,
+        }
+    }
+
+    pub fn name(&self) -> String {
+        format!(
+            "u{}-f{}-d{}-dwarf{}",
+            self.units, self.functions, self.depth, self.dwarf_version
+        )
+    }
+
+    /// compile the fixture under `dir`, once. returns the path to read the
+    /// DWARF from and the path a program would load.
+    ///
+    /// # Panics
+    /// panics when the C compiler fails
+    pub fn build(&self, dir: &Path) -> (PathBuf, PathBuf) {
+        let dir = dir.join(self.name());
+        let library = dir.join(if cfg!(target_os = "macos") {
+            "libbench.dylib"
+        } else {
+            "libbench.so"
+        });
+        let debug_info = if cfg!(target_os = "macos") {
+            dir.join("libbench.dylib.dSYM/Contents/Resources/DWARF/libbench.dylib")
+        } else {
+            library.clone()
+        };
+        if debug_info.is_file() {
+            return (debug_info, library);
+        }
+
+        std::fs::create_dir_all(&dir).expect("failed to create fixture dir");
+        std::fs::write(dir.join("bench.h"), self.header()).expect("failed to write header");
+
+        let dwarf = format!("-gdwarf-{}", self.dwarf_version);
+        let mut objects = Vec::new();
+        for unit in 0..self.units {
+            let source = dir.join(format!("unit{}.c", unit));
+            std::fs::write(&source, self.unit(unit)).expect("failed to write source");
+            let object = source.with_extension("o");
+            run(Command::new("cc")
+                .args(["-O2", "-g", &dwarf, "-fPIC", "-fvisibility=hidden", "-c"])
+                .arg(&source)
+                .arg("-o")
+                .arg(&object));
+            objects.push(object);
+        }
+
+        let shared = if cfg!(target_os = "macos") {
+            "-dynamiclib"
+        } else {
+            "-shared"
+        };
+        run(Command::new("cc")
+            .args([shared, "-g"])
+            .args(&objects)
+            .arg("-o")
+            .arg(&library));
+        if cfg!(target_os = "macos") {
+            run(Command::new("dsymutil").arg(&library));
+        }
+
+        (debug_info, library)
+    }
+
+    fn header(&self) -> String {
+        let mut header = String::from("#ifndef BENCH_H\n#define BENCH_H\n\n");
+        header.push_str(
+            "typedef struct Level0 {\n  int value;\n  double weight;\n  char tag[16];\n} Level0;\n\n",
+        );
+        for level in 1..self.depth {
+            let _ = write!(
+                header,
+                "typedef struct Level{level} {{\n  Level{inner} inner;\n  Level{inner} *next;\n  \
+                 unsigned int flags;\n  float scale[4];\n}} Level{level};\n\n",
+                level = level,
+                inner = level - 1,
+            );
+        }
+        let top = self.depth - 1;
+        let _ = write!(
+            header,
+            "typedef enum Mode {{ MODE_FAST, MODE_SAFE, MODE_DEBUG }} Mode;\n\n\
+             typedef union Value {{\n  int i;\n  float f;\n  Level0 *level;\n}} Value;\n\n\
+             typedef int (*Visitor)(Level{top} *node, void *userdata);\n\n\
+             #endif\n",
+            top = top,
+        );
+        header
+    }
+
+    fn unit(&self, unit: usize) -> String {
+        let top = self.depth - 1;
+        let mut source = String::from("#include \"bench.h\"\n\n");
+        let _ = write!(
+            source,
+            "typedef struct Unit{unit}State {{\n  Level{top} root;\n  Mode mode;\n  Value value;\n  \
+             Visitor visit;\n  int counts[8];\n}} Unit{unit}State;\n\n",
+        );
+        for function in 0..self.functions {
+            let level = function % self.depth;
+            let _ = write!(
+                source,
+                "__attribute__((visibility(\"default\")))\n\
+                 int unit{unit}_fn{function}(Unit{unit}State *state, Level{level} *level, \
+                 Visitor visit, int n) {{\n  \
+                 return state->counts[n & 7] + (int)sizeof(*level) + \
+                 (visit ? visit(&state->root, level) : n + {function});\n}}\n\n",
+            );
+        }
+        source
+    }
+}
+
+fn env_usize(name: &str, default: usize) -> usize {
+    match std::env::var(name) {
+        Ok(value) => value
+            .parse()
+            .unwrap_or_else(|_| panic!("{} must be a number, not {:?}", name, value)),
+        Err(_) => default,
+    }
+}
+
+fn run(command: &mut Command) {
+    let status = command
+        .status()
+        .unwrap_or_else(|e| panic!("failed to run {:?}: {}", command, e));
+    assert!(status.success(), "{:?} failed", command);
+}
+
+/// best of `runs` timings of `f`, with the result of the last run
+pub fn best_of<T>(runs: usize, mut f: impl FnMut() -> T) -> (std::time::Duration, T) {
+    let mut best = std::time::Duration::MAX;
+    let mut result = None;
+    for _ in 0..runs.max(1) {
+        let start = std::time::Instant::now();
+        let value = f();
+        best = best.min(start.elapsed());
+        result = Some(value);
+    }
+    (best, result.expect("at least one run"))
+}
+
+/// how many times each measurement is repeated, from `DWARFFI_BENCH_RUNS`
+pub fn runs() -> usize {
+    env_usize("DWARFFI_BENCH_RUNS", 5)
+}
+
+/// `count` per second over `elapsed`, e.g. "1.23M"
+pub fn per_second(count: usize, elapsed: std::time::Duration) -> String {
+    let rate = count as f64 / elapsed.as_secs_f64();
+    if rate >= 1e6 {
+        format!("{:.2}M", rate / 1e6)
+    } else if rate >= 1e3 {
+        format!("{:.2}k", rate / 1e3)
+    } else {
+        format!("{:.2}", rate)
+    }
+}
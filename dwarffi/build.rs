@@ -17,6 +17,8 @@ use std::process::Command;
 fn main() {
     // rerun build if the test C library source files change.
     println!("cargo:rerun-if-changed=../test_c/testlib.c");
+    println!("cargo:rerun-if-changed=../test_c/testlib_geometry.c");
+    println!("cargo:rerun-if-changed=../test_c/testlib_internal.c");
     println!("cargo:rerun-if-changed=../test_c/testlib.h");
     println!("cargo:rerun-if-changed=../test_c/makefile");
 
@@ -0,0 +1,330 @@
+//! on-disk cache of analysis results.
+//!
+//! an entry is keyed by the binary's build id, the analysis mode and the
+//! crate version, so a rebuilt library or a new dwarffi release never reads a
+//! stale entry. entries are bincode: a small header that is checked first,
+//! then the signatures and the types in id order.
+//!
+//! when a binary misses, its compilation units are looked up one by one, by
+//! a fingerprint of their contents. a rebuild that changed one source file
+//! only analyzes that file's unit again.
+
+use crate::dwarf_analyzer::{AnalysisOptions, AnalysisResult};
+use crate::filter::FunctionFilter;
+use crate::stable_hash::StableHasher;
+use crate::stats::AnalysisStats;
+use crate::symbol_reader::ExportedSymbols;
+use crate::type_registry::{SharedTypeRegistry, Type, TypeRegistry};
+use crate::types::FunctionSignature;
+use anyhow::{Context, Result, anyhow};
+use serde::{Deserialize, Serialize};
+use std::fmt::Write as _;
+use std::hash::Hasher;
+use std::io::{BufWriter, Write};
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+/// first bytes of every entry, bumped when the layout changes
+const MAGIC: &[u8; 8] = b"DWFFI\0C3";
+
+/// first bytes of every compilation unit entry
+const UNIT_MAGIC: &[u8; 8] = b"DWFFI\0U2";
+
+/// what an analysis result depends on
+#[derive(Debug, Clone, PartialEq, Eq, Serialize, Deserialize)]
+pub struct CacheKey {
+    build_id: Vec<u8>,
+    exported_only: bool,
+    type_members: bool,
+    filter: FunctionFilter,
+    tool_version: String,
+}
+
+impl CacheKey {
+    /// key of an analysis of the binary `build_id` with `options`. worker
+    /// counts and lookup strategy do not change the result and are ignored.
+    pub fn new(build_id: Vec<u8>, options: &AnalysisOptions) -> Self {
+        Self {
+            build_id,
+            exported_only: options.exported_only,
+            type_members: options.type_members,
+            filter: options.filter.clone(),
+            tool_version: env!("CARGO_PKG_VERSION").to_string(),
+        }
+    }
+
+    fn file_name(&self) -> String {
+        let mut name = String::with_capacity(self.build_id.len() * 2 + 12);
+        for byte in &self.build_id {
+            let _ = write!(name, "{:02x}", byte);
+        }
+        name.push_str(if self.exported_only {
+            "-exported"
+        } else {
+            "-all"
+        });
+        if !self.type_members {
+            name.push_str("-names");
+        }
+        if !self.filter.is_empty() {
+            let _ = write!(name, "-{:016x}", self.filter.stable_hash());
+        }
+        name.push_str(".bin");
+        name
+    }
+}
+
+/// directory of cached analysis results
+pub struct AnalysisCache {
+    dir: PathBuf,
+}
+
+impl AnalysisCache {
+    pub fn new(dir: impl Into<PathBuf>) -> Self {
+        Self { dir: dir.into() }
+    }
+
+    /// where the entry for `key` lives
+    pub fn entry_path(&self, key: &CacheKey) -> PathBuf {
+        self.dir.join(key.file_name())
+    }
+
+    /// the cached result for `key`. a missing, stale or unreadable entry is a
+    /// miss, never an error: the caller just analyzes again.
+    pub fn load(&self, key: &CacheKey) -> Option<AnalysisResult> {
+        let path = self.entry_path(key);
+        let data = match std::fs::read(&path) {
+            Ok(data) => data,
+            Err(e) => {
+                log::debug!("no cache entry at {}: {}", path.display(), e);
+                return None;
+            }
+        };
+
+        match Self::decode(&data, key) {
+            Ok(result) => {
+                log::info!("loaded analysis from cache: {}", path.display());
+                Some(result)
+            }
+            Err(e) => {
+                log::warn!("ignore cache entry {}: {}", path.display(), e);
+                None
+            }
+        }
+    }
+
+    fn decode(data: &[u8], key: &CacheKey) -> Result<AnalysisResult> {
+        let mut data = data
+            .strip_prefix(MAGIC.as_slice())
+            .ok_or_else(|| anyhow!("not a dwarffi cache entry"))?;
+
+        let stored: CacheKey = bincode::deserialize_from(&mut data)?;
+        if stored != *key {
+            return Err(anyhow!("entry belongs to {:?}", stored));
+        }
+
+        let signatures: Vec<FunctionSignature> = bincode::deserialize_from(&mut data)?;
+        let types: Vec<Type> = bincode::deserialize_from(&mut data)?;
+        Ok(AnalysisResult {
+            signatures,
+            type_registry: TypeRegistry::from_sorted_types(types),
+            stats: AnalysisStats::default(),
+        })
+    }
+
+    /// write `result` under `key`. the entry is written to a temporary file
+    /// and renamed into place, so concurrent runs never see half an entry.
+    pub fn store(&self, key: &CacheKey, result: &AnalysisResult) -> Result<()> {
+        std::fs::create_dir_all(&self.dir)
+            .with_context(|| format!("failed to create cache dir: {}", self.dir.display()))?;
+
+        let path = self.entry_path(key);
+        let tmp_path = path.with_extension(format!("tmp.{}", std::process::id()));
+        Self::write_entry(&tmp_path, key, result)
+            .and_then(|()| std::fs::rename(&tmp_path, &path).map_err(Into::into))
+            .inspect_err(|_| {
+                let _ = std::fs::remove_file(&tmp_path);
+            })
+            .with_context(|| format!("failed to write cache entry: {}", path.display()))?;
+
+        log::debug!("stored analysis in cache: {}", path.display());
+        Ok(())
+    }
+
+    fn write_entry(path: &Path, key: &CacheKey, result: &AnalysisResult) -> Result<()> {
+        let mut out = BufWriter::new(std::fs::File::create(path)?);
+        out.write_all(MAGIC)?;
+        bincode::serialize_into(&mut out, key)?;
+        bincode::serialize_into(&mut out, &result.signatures)?;
+        bincode::serialize_into(&mut out, &result.type_registry.sorted_types())?;
+        out.flush()?;
+        Ok(())
+    }
+
+    /// the per unit entries of an analysis with `options`. units only hit
+    /// when they were analyzed with the same options, and found their
+    /// exported functions the same way. which of them are exported is part
+    /// of each unit's fingerprint, so a new export elsewhere still hits.
+    pub(crate) fn units(
+        &self,
+        options: &AnalysisOptions,
+        exported_symbols: Option<&ExportedSymbols>,
+    ) -> UnitCache {
+        let mut hasher = StableHasher::new();
+        hasher.write_str(env!("CARGO_PKG_VERSION"));
+        hasher.write_u64(u64::from(options.type_members));
+        hasher.write_u64(options.filter.stable_hash());
+        hasher.write_u64(
+            exported_symbols.map_or(0, |symbols| 1 + u64::from(symbols.has_addresses())),
+        );
+        UnitCache {
+            dir: self.dir.join("units"),
+            salt: hasher.finish(),
+        }
+    }
+}
+
+/// cached signatures and types of single compilation units, keyed by the
+/// unit's [`crate::die_index::DieIndex::fingerprint`]
+pub(crate) struct UnitCache {
+    dir: PathBuf,
+    /// hash of everything besides the unit that its result depends on
+    salt: u64,
+}
+
+impl UnitCache {
+    fn entry_path(&self, fingerprint: u64) -> PathBuf {
+        let mut hasher = StableHasher::new();
+        hasher.write_u64(self.salt);
+        hasher.write_u64(fingerprint);
+        self.dir.join(format!("{:016x}.bin", hasher.finish()))
+    }
+
+    /// the signatures of the unit with `fingerprint`, with the types they
+    /// use added to `type_registry`, and the number of those types. any
+    /// failure is a miss.
+    pub fn load(
+        &self,
+        fingerprint: u64,
+        type_registry: &SharedTypeRegistry,
+    ) -> Option<(Vec<FunctionSignature>, usize)> {
+        let path = self.entry_path(fingerprint);
+        let data = std::fs::read(&path).ok()?;
+        match self.decode(&data, fingerprint) {
+            Ok((signatures, types)) => {
+                let type_count = types.len();
+                for mut type_ in types {
+                    // offsets are from the build that stored the entry
+                    type_.dwarf_offset = None;
+                    type_registry.insert_registered(type_);
+                }
+                Some((signatures, type_count))
+            }
+            Err(e) => {
+                log::warn!("ignore cache entry {}: {}", path.display(), e);
+                None
+            }
+        }
+    }
+
+    fn decode(&self, data: &[u8], fingerprint: u64) -> Result<(Vec<FunctionSignature>, Vec<Type>)> {
+        let mut data = data
+            .strip_prefix(UNIT_MAGIC.as_slice())
+            .ok_or_else(|| anyhow!("not a dwarffi unit cache entry"))?;
+
+        let stored: (u64, u64) = bincode::deserialize_from(&mut data)?;
+        if stored != (self.salt, fingerprint) {
+            return Err(anyhow!("entry belongs to another unit"));
+        }
+        let signatures = bincode::deserialize_from(&mut data)?;
+        let types = bincode::deserialize_from(&mut data)?;
+        Ok((signatures, types))
+    }
+
+    /// store the signatures of the unit with `fingerprint` and every type
+    /// they refer to
+    pub fn store(
+        &self,
+        fingerprint: u64,
+        signatures: &[FunctionSignature],
+        type_registry: &SharedTypeRegistry,
+    ) -> Result<()> {
+        std::fs::create_dir_all(&self.dir)
+            .with_context(|| format!("failed to create cache dir: {}", self.dir.display()))?;
+
+        let types = type_registry.snapshot(signatures.iter().flat_map(FunctionSignature::type_ids))?;
+        let path = self.entry_path(fingerprint);
+        // units are stored from several threads at once
+        static NEXT_TMP: AtomicUsize = AtomicUsize::new(0);
+        let tmp_path = path.with_extension(format!(
+            "tmp.{}.{}",
+            std::process::id(),
+            NEXT_TMP.fetch_add(1, Ordering::Relaxed)
+        ));
+        let write = || -> Result<()> {
+            let mut out = BufWriter::new(std::fs::File::create(&tmp_path)?);
+            out.write_all(UNIT_MAGIC)?;
+            bincode::serialize_into(&mut out, &(self.salt, fingerprint))?;
+            bincode::serialize_into(&mut out, signatures)?;
+            bincode::serialize_into(&mut out, &types.sorted_types())?;
+            out.flush()?;
+            Ok(std::fs::rename(&tmp_path, &path)?)
+        };
+        write()
+            .inspect_err(|_| {
+                let _ = std::fs::remove_file(&tmp_path);
+            })
+            .with_context(|| format!("failed to write cache entry: {}", path.display()))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_file_name_depends_on_id_and_mode() {
+        let key = |exported_only, type_members| {
+            let options = AnalysisOptions {
+                exported_only,
+                type_members,
+                ..AnalysisOptions::default()
+            };
+            CacheKey::new(vec![0xab, 0x01], &options)
+        };
+
+        assert_eq!(key(true, true).file_name(), "ab01-exported.bin");
+        assert_eq!(key(false, true).file_name(), "ab01-all.bin");
+        assert_eq!(key(true, false).file_name(), "ab01-exported-names.bin");
+
+        let mut filter = FunctionFilter::new();
+        filter.include("point_*");
+        let filtered = CacheKey::new(
+            vec![0xab, 0x01],
+            &AnalysisOptions {
+                filter,
+                ..AnalysisOptions::default()
+            },
+        );
+        assert!(filtered.file_name().starts_with("ab01-exported-"));
+        assert_ne!(filtered.file_name(), key(true, true).file_name());
+    }
+
+    #[test]
+    fn test_decode_rejects_other_keys() {
+        let options = AnalysisOptions::default();
+        let key = CacheKey::new(vec![1, 2, 3], &options);
+        let other = CacheKey::new(
+            vec![1, 2, 3],
+            &AnalysisOptions {
+                exported_only: false,
+                ..options
+            },
+        );
+        let mut data = MAGIC.to_vec();
+        bincode::serialize_into(&mut data, &other).unwrap();
+
+        assert!(AnalysisCache::decode(&data, &key).is_err());
+        assert!(AnalysisCache::decode(b"garbage", &key).is_err());
+    }
+}
@@ -0,0 +1,240 @@
+//! flat index over every DIE of a compilation unit.
+//!
+//! the unit is decoded once, in DFS order. types are then looked up by offset
+//! with a binary search and children are walked by skipping over subtrees,
+//! instead of seeking a new cursor (and re-decoding abbreviations) for every
+//! reference.
+
+use crate::stable_hash::StableHasher;
+use anyhow::{Result, anyhow};
+use gimli::{
+    AttributeValue, DebuggingInformationEntry, Dwarf, Reader, ReaderOffset, Unit, UnitOffset,
+};
+use std::hash::Hasher;
+
+struct IndexedEntry<'unit, R: Reader> {
+    entry: DebuggingInformationEntry<'unit, 'unit, R>,
+    /// position one past the last descendant of this entry
+    subtree_end: usize,
+}
+
+pub struct DieIndex<'unit, R: Reader> {
+    entries: Vec<IndexedEntry<'unit, R>>,
+}
+
+impl<'unit, R: Reader> DieIndex<'unit, R> {
+    /// decode every entry of `unit` in a single DFS pass
+    pub fn build(unit: &'unit Unit<R>) -> Result<Self> {
+        let mut entries: Vec<IndexedEntry<'unit, R>> = Vec::new();
+        // entries whose subtree is still open, with their depth
+        let mut open: Vec<(usize, isize)> = Vec::new();
+        let mut depth = 0;
+
+        let mut cursor = unit.entries();
+        while let Some((delta, entry)) = cursor.next_dfs()? {
+            depth += delta;
+            let position = entries.len();
+
+            while open
+                .last()
+                .is_some_and(|&(_, open_depth)| open_depth >= depth)
+            {
+                let (closed, _) = open.pop().expect("checked above");
+                entries[closed].subtree_end = position;
+            }
+
+            entries.push(IndexedEntry {
+                entry: entry.clone(),
+                subtree_end: position + 1,
+            });
+            open.push((position, depth));
+        }
+
+        let end = entries.len();
+        for (closed, _) in open {
+            entries[closed].subtree_end = end;
+        }
+
+        log::trace!("indexed {} entries", entries.len());
+        Ok(Self { entries })
+    }
+
+    fn position(&self, offset: UnitOffset<R::Offset>) -> Result<usize> {
+        self.entries
+            .binary_search_by_key(&offset, |indexed| indexed.entry.offset())
+            .map_err(|_| anyhow!("no entry at offset"))
+    }
+
+    /// the entry at `offset`
+    pub fn entry(
+        &self,
+        offset: UnitOffset<R::Offset>,
+    ) -> Result<&DebuggingInformationEntry<'unit, 'unit, R>> {
+        Ok(&self.entries[self.position(offset)?].entry)
+    }
+
+    /// direct children of the entry at `offset`
+    pub fn children(&self, offset: UnitOffset<R::Offset>) -> Result<Children<'_, 'unit, R>> {
+        let position = self.position(offset)?;
+        Ok(Children {
+            entries: &self.entries,
+            next: position + 1,
+            end: self.entries[position].subtree_end,
+        })
+    }
+
+    /// number of entries in the unit
+    pub fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    /// every entry of the unit, in DFS order
+    pub fn iter(&self) -> impl Iterator<Item = &DebuggingInformationEntry<'unit, 'unit, R>> {
+        self.entries.iter().map(|indexed| &indexed.entry)
+    }
+
+    /// hash of what the unit says, independent of where it sits in the
+    /// binary: strings are hashed by content, not by their offset in a
+    /// shared string section, and addresses and section offsets (which move
+    /// whenever another unit changes) are left out. two units with the same
+    /// fingerprint produce the same signatures and types.
+    ///
+    /// values are hashed with a number of their own per kind and the raw
+    /// value of their constant, so fingerprints stay the same across
+    /// versions of gimli and toolchains.
+    pub fn fingerprint(&self, dwarf: &Dwarf<R>, unit: &Unit<R>) -> Result<u64> {
+        let mut hasher = StableHasher::new();
+        hasher.write_u64(u64::from(unit.header.version()));
+        hasher.write_u64(u64::from(unit.header.address_size()));
+
+        for (position, indexed) in self.entries.iter().enumerate() {
+            let entry = &indexed.entry;
+            hasher.write_u64(u64::from(entry.tag().0));
+            // the shape of the tree
+            hasher.write_u64((indexed.subtree_end - position) as u64);
+
+            let mut attrs = entry.attrs();
+            while let Some(attr) = attrs.next()? {
+                let value = attr.value();
+                match value {
+                    AttributeValue::Addr(_)
+                    | AttributeValue::DebugAddrIndex(_)
+                    | AttributeValue::DebugAddrBase(_)
+                    | AttributeValue::DebugLineRef(_)
+                    | AttributeValue::DebugLocListsBase(_)
+                    | AttributeValue::DebugLocListsIndex(_)
+                    | AttributeValue::DebugRngListsBase(_)
+                    | AttributeValue::DebugRngListsIndex(_)
+                    | AttributeValue::DebugStrOffsetsBase(_)
+                    | AttributeValue::DebugMacinfoRef(_)
+                    | AttributeValue::DebugMacroRef(_)
+                    | AttributeValue::LocationListsRef(_)
+                    | AttributeValue::RangeListsRef(_) => continue,
+                    _ => {}
+                }
+
+                hasher.write_u64(u64::from(attr.name().0));
+                hash_value(&mut hasher, dwarf, unit, value)?;
+            }
+        }
+
+        Ok(hasher.finish())
+    }
+}
+
+/// hash an attribute value: its kind, then its content
+pub(crate) fn hash_value<R: Reader>(
+    hasher: &mut StableHasher,
+    dwarf: &Dwarf<R>,
+    unit: &Unit<R>,
+    value: AttributeValue<R>,
+) -> Result<()> {
+    use AttributeValue as V;
+
+    let (kind, data) = match value {
+        V::String(_)
+        | V::DebugStrRef(_)
+        | V::DebugStrRefSup(_)
+        | V::DebugStrOffsetsIndex(_)
+        | V::DebugLineStrRef(_) => {
+            // where a string is stored does not matter
+            let string = dwarf.attr_string(unit, value)?;
+            let string = string.to_slice()?;
+            hasher.write_u64(1);
+            hasher.write_u64(string.len() as u64);
+            hasher.write(&string);
+            return Ok(());
+        }
+        V::Block(data) | V::Exprloc(gimli::Expression(data)) => {
+            let data = data.to_slice()?;
+            hasher.write_u64(2);
+            hasher.write_u64(data.len() as u64);
+            hasher.write(&data);
+            return Ok(());
+        }
+        V::Addr(address) => (3, address),
+        V::Data1(data) => (4, u64::from(data)),
+        V::Data2(data) => (5, u64::from(data)),
+        V::Data4(data) => (6, u64::from(data)),
+        V::Data8(data) => (7, data),
+        V::Sdata(data) => (8, data as u64),
+        V::Udata(data) => (9, data),
+        V::Flag(flag) => (10, u64::from(flag)),
+        V::SecOffset(offset) => (11, offset.into_u64()),
+        V::DebugAddrBase(base) => (12, base.0.into_u64()),
+        V::DebugAddrIndex(index) => (13, index.0.into_u64()),
+        V::UnitRef(offset) => (14, offset.0.into_u64()),
+        V::DebugInfoRef(offset) => (15, offset.0.into_u64()),
+        V::DebugInfoRefSup(offset) => (16, offset.0.into_u64()),
+        V::DebugLineRef(offset) => (17, offset.0.into_u64()),
+        V::LocationListsRef(offset) => (18, offset.0.into_u64()),
+        V::DebugLocListsBase(base) => (19, base.0.into_u64()),
+        V::DebugLocListsIndex(index) => (20, index.0.into_u64()),
+        V::DebugMacinfoRef(offset) => (21, offset.0.into_u64()),
+        V::DebugMacroRef(offset) => (22, offset.0.into_u64()),
+        V::RangeListsRef(offset) => (23, offset.0.into_u64()),
+        V::DebugRngListsBase(base) => (24, base.0.into_u64()),
+        V::DebugRngListsIndex(index) => (25, index.0.into_u64()),
+        V::DebugTypesRef(signature) => (26, signature.0),
+        V::DebugStrOffsetsBase(base) => (27, base.0.into_u64()),
+        V::Encoding(constant) => (28, u64::from(constant.0)),
+        V::DecimalSign(constant) => (29, u64::from(constant.0)),
+        V::Endianity(constant) => (30, u64::from(constant.0)),
+        V::Accessibility(constant) => (31, u64::from(constant.0)),
+        V::Visibility(constant) => (32, u64::from(constant.0)),
+        V::Virtuality(constant) => (33, u64::from(constant.0)),
+        V::Language(constant) => (34, u64::from(constant.0)),
+        V::AddressClass(constant) => (35, constant.0),
+        V::IdentifierCase(constant) => (36, u64::from(constant.0)),
+        V::CallingConvention(constant) => (37, u64::from(constant.0)),
+        V::Inline(constant) => (38, u64::from(constant.0)),
+        V::Ordering(constant) => (39, u64::from(constant.0)),
+        V::FileIndex(index) => (40, index),
+        V::DwoId(id) => (41, id.0),
+    };
+    hasher.write_u64(kind);
+    hasher.write_u64(data);
+    Ok(())
+}
+
+/// iterator over the direct children of an indexed entry
+pub struct Children<'a, 'unit, R: Reader> {
+    entries: &'a [IndexedEntry<'unit, R>],
+    next: usize,
+    end: usize,
+}
+
+impl<'a, 'unit, R: Reader> Iterator for Children<'a, 'unit, R> {
+    type Item = &'a DebuggingInformationEntry<'unit, 'unit, R>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.next >= self.end {
+            return None;
+        }
+
+        let indexed = &self.entries[self.next];
+        // skip grandchildren
+        self.next = indexed.subtree_end;
+        Some(&indexed.entry)
+    }
+}
@@ -1,30 +1,239 @@
+use crate::cache::{AnalysisCache, CacheKey, UnitCache};
+use crate::die_index::DieIndex;
+use crate::filter::FunctionFilter;
+use crate::name_index::{NameIndex, UnitTargets};
+use crate::parallel::parallel_map_ordered;
 use crate::reader;
-use crate::symbol_reader::SymbolReader;
-use crate::type_registry::TypeRegistry;
-use crate::type_resolver::TypeResolver;
+use crate::spill::{MemoryBudget, SignatureSpool};
+use crate::split_dwarf::{self, SplitSources};
+use crate::stable_hash::StableHasher;
+use crate::stats::{AnalysisStats, UnitCounters};
+use crate::symbol_reader::{ExportedSymbols, SymbolReader};
+use crate::type_registry::{SharedTypeRegistry, TypeRegistry};
+use crate::type_resolver::{DeclCache, TypeResolver};
+use crate::type_units::TypeUnits;
 use crate::types::{FunctionSignature, Parameter};
-use anyhow::Result;
-use gimli::{AttributeValue, Dwarf, Reader};
+use crate::unit_ranges::UnitRanges;
+use anyhow::{Context, Result};
+use gimli::{AttributeValue, Dwarf};
+use std::borrow::Cow;
 use std::collections::HashSet;
+use std::hash::Hasher;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::mpsc;
+use std::time::Instant;
 
 pub struct DwarfAnalyzer {
-    data: Vec<u8>,
+    data: reader::FileData,
+    /// where the binary was loaded from, used to find its separate debug
+    /// file and split DWARF package
+    path: Option<PathBuf>,
 }
 
 pub struct AnalysisResult {
     pub signatures: Vec<FunctionSignature>,
     pub type_registry: TypeRegistry,
+    /// timings and counters of the run that produced this result
+    pub stats: AnalysisStats,
+}
+
+/// one binary of a [`DwarfAnalyzer::analyze_batch`] run
+pub struct LibraryAnalysis {
+    pub path: PathBuf,
+    pub signatures: Vec<FunctionSignature>,
+}
+
+/// signatures of several binaries, and the registry of all their types
+pub struct BatchAnalysis {
+    /// in the order the binaries were given
+    pub libraries: Vec<LibraryAnalysis>,
+    pub type_registry: TypeRegistry,
+    /// totals over all libraries. per unit phases are summed over the
+    /// libraries too, phases that run once per library are summed wall times
+    pub stats: AnalysisStats,
+}
+
+/// signatures of one compilation unit, passed to the callback of
+/// [`DwarfAnalyzer::analyze_streaming`]
+pub struct UnitAnalysis<'a> {
+    /// position of the unit in .debug_info
+    pub unit: usize,
+    pub signatures: Vec<FunctionSignature>,
+    /// every type registered so far, including all types the signatures
+    /// refer to. units still running keep adding to it.
+    pub type_registry: &'a SharedTypeRegistry,
+}
+
+impl UnitAnalysis<'_> {
+    /// a registry holding just the types this unit's signatures refer to,
+    /// e.g. for rendering them before the analysis has finished
+    pub fn registry(&self) -> Result<TypeRegistry> {
+        self.type_registry
+            .snapshot(self.signatures.iter().flat_map(FunctionSignature::type_ids))
+    }
+}
+
+/// an analysis within a memory budget, see
+/// [`DwarfAnalyzer::extract_analysis_spilled`]
+pub struct SpilledAnalysis {
+    /// in unit order
+    pub signatures: SignatureSpool,
+    /// every type the signatures refer to, those used least recently on disk
+    pub type_registry: SharedTypeRegistry,
+    pub stats: AnalysisStats,
+}
+
+/// options for [`DwarfAnalyzer::extract_analysis_with`]
+#[derive(Debug, Clone)]
+pub struct AnalysisOptions {
+    /// only keep functions that are exported from the binary
+    pub exported_only: bool,
+    /// number of worker threads for compilation units. 0 uses all available
+    /// cores, 1 analyzes every unit on the calling thread.
+    pub threads: usize,
+    /// with `exported_only`, use the units' address ranges and
+    /// `.debug_names`/`.debug_pubnames` (when the binary has them) to visit
+    /// only units and DIEs of exported functions
+    pub use_name_index: bool,
+    /// resolve struct, union and enum members. output that only names types,
+    /// like C signatures, can turn this off so type bodies (and the types only
+    /// their members use) are never decoded
+    pub type_members: bool,
+    /// reuse the types an earlier unit resolved from the same definitions,
+    /// like those of a header both include. the output is the same either
+    /// way, turning it off only measures what it saves
+    pub share_declarations: bool,
+    /// only analyze functions whose name passes this filter. it is applied
+    /// before any of their types are resolved
+    pub filter: FunctionFilter,
+}
+
+impl Default for AnalysisOptions {
+    fn default() -> Self {
+        Self {
+            exported_only: true,
+            threads: 0,
+            use_name_index: true,
+            type_members: true,
+            share_declarations: true,
+            filter: FunctionFilter::default(),
+        }
+    }
+}
+
+/// state shared by every compilation unit of one analysis
+struct UnitContext<'a, 'data> {
+    dwarf: &'a Dwarf<reader::DwarfReader<'data>>,
+    exported_symbols: Option<&'a ExportedSymbols<'a>>,
+    filter: &'a FunctionFilter,
+    type_registry: &'a SharedTypeRegistry,
+    decl_cache: &'a DeclCache,
+    // the offset type is spelled out, a projection would make the context
+    // invariant in 'data
+    type_units: &'a TypeUnits<reader::DwarfReader<'data>, usize>,
+    split: SplitSources<'a, 'data>,
+    type_members: bool,
+    share_declarations: bool,
+    /// per unit results from earlier runs
+    unit_cache: Option<UnitCache>,
+    counters: &'a UnitCounters,
+}
+
+/// one compilation unit to analyze, and which of its DIEs matter
+struct UnitWork<'a, 'data> {
+    /// position of the unit in .debug_info, for logging
+    position: usize,
+    header: gimli::UnitHeader<reader::DwarfReader<'data>>,
+    targets: UnitTargets<'a, usize>,
+}
+
+impl AnalysisOptions {
+    /// threads to use in total, resolving 0 to the available cores
+    fn thread_count(&self) -> usize {
+        match self.threads {
+            0 => std::thread::available_parallelism().map_or(1, |n| n.get()),
+            n => n,
+        }
+    }
+
+    fn worker_count(&self, unit_count: usize) -> usize {
+        self.thread_count().min(unit_count).max(1)
+    }
 }
 
 impl DwarfAnalyzer {
+    /// analyze an in-memory copy of a binary
     pub fn new(data: Vec<u8>) -> Self {
-        Self { data }
+        Self {
+            data: reader::FileData::Owned(data),
+            path: None,
+        }
+    }
+
+    /// analyze a binary that is already memory-mapped. sections are read
+    /// directly from the mapping, no copy of the file is made.
+    pub fn from_mmap(mmap: memmap2::Mmap) -> Self {
+        Self {
+            data: reader::FileData::Mapped(mmap),
+            path: None,
+        }
     }
 
-    /// load the dynamic library from file path
-    pub fn from_file(path: &std::path::Path) -> Result<Self> {
+    /// load the dynamic library from file path. the file is memory-mapped and
+    /// kept mapped for the lifetime of the analyzer.
+    pub fn from_file(path: &Path) -> Result<Self> {
         let data = reader::load_file(path)?;
-        Ok(Self::new(data))
+        Ok(Self {
+            data,
+            path: Some(path.to_path_buf()),
+        })
+    }
+
+    /// the DWARF of a stripped binary, from the first separate debug file
+    /// that belongs to this build. None when the binary has its own DWARF.
+    fn load_debug_file(&self) -> Result<Option<reader::FileData>> {
+        if reader::has_debug_info(&self.data)? {
+            return Ok(None);
+        }
+
+        let build_id = reader::binary_id(&self.data)?;
+        for candidate in reader::debug_file_candidates(self.path.as_deref(), &self.data)? {
+            if !candidate.is_file() {
+                continue;
+            }
+            let data = reader::load_file(&candidate)?;
+            // a debug file left over from another build describes other code
+            if build_id.is_some() && reader::binary_id(&data)? != build_id {
+                log::warn!(
+                    "ignore debug file of another build: {}",
+                    candidate.display()
+                );
+                continue;
+            }
+            if reader::has_debug_info(&data)? {
+                log::info!("read debug info from {}", candidate.display());
+                return Ok(Some(data));
+            }
+        }
+
+        log::debug!("no separate debug file found");
+        Ok(None)
+    }
+
+    /// the `<binary>.dwp` package holding the split units, if there is one.
+    /// it is only mapped here, units are decoded when a skeleton needs them.
+    fn load_package(&self) -> Result<Option<reader::FileData>> {
+        let Some(path) = &self.path else {
+            return Ok(None);
+        };
+        let package_path = split_dwarf::package_path(path);
+        if !package_path.is_file() {
+            return Ok(None);
+        }
+
+        log::info!("read split units from {}", package_path.display());
+        reader::load_file(&package_path).map(Some)
     }
 
     /// get all exported function symbols (STT_FUNC)
@@ -35,75 +244,719 @@ impl DwarfAnalyzer {
         Ok(symbols)
     }
 
+    /// exported function symbols, borrowed from the binary
+    fn exported_symbols(&self, filter: &FunctionFilter) -> Result<ExportedSymbols<'_>> {
+        log::debug!("read exported symbols from binary");
+        SymbolReader::new(&self.data)?.exported_symbols(filter)
+    }
+
     /// extract function signatures and type registry from DWARF debug info
     pub fn extract_analysis(&self, exported_only: bool) -> Result<AnalysisResult> {
-        let section_loader = reader::object_section_loader(&self.data)?;
-        let dwarf = Dwarf::load(section_loader)?;
+        self.extract_analysis_with(&AnalysisOptions {
+            exported_only,
+            ..AnalysisOptions::default()
+        })
+    }
+
+    /// key of this binary's results in an [`AnalysisCache`]. None when the
+    /// binary has no build id, so nothing can tell its rebuilds apart.
+    pub fn cache_key(&self, options: &AnalysisOptions) -> Result<Option<CacheKey>> {
+        let key = reader::binary_id(&self.data)?.map(|build_id| CacheKey::new(build_id, options));
+        if key.is_none() {
+            log::debug!("binary has no build id, skip whole binary cache");
+        }
+        Ok(key)
+    }
+
+    /// like [`Self::extract_analysis_with`], but reuse the result from `cache`
+    /// when this exact binary was analyzed before, and store it otherwise.
+    /// on a miss only the compilation units that changed since they were
+    /// last cached are analyzed again.
+    pub fn extract_analysis_cached(
+        &self,
+        options: &AnalysisOptions,
+        cache: &AnalysisCache,
+    ) -> Result<AnalysisResult> {
+        let start = Instant::now();
+        let Some(key) = self.cache_key(options)? else {
+            return self.collect_analysis(options, Some(cache));
+        };
+        if let Some(mut result) = cache.load(&key) {
+            result.stats.cache_hit = true;
+            result.stats.functions = result.signatures.len();
+            result.stats.registry_types = result.type_registry.len();
+            result.stats.total = start.elapsed();
+            return Ok(result);
+        }
+
+        let result = self.collect_analysis(options, Some(cache))?;
+        // a cache that can't be written only costs the next run time
+        if let Err(e) = cache.store(&key, &result) {
+            log::warn!("{:#}", e);
+        }
+        Ok(result)
+    }
+
+    /// extract function signatures and type registry, analyzing compilation
+    /// units on `options.threads` workers. results are reduced in unit order,
+    /// so the output does not depend on the thread count.
+    pub fn extract_analysis_with(&self, options: &AnalysisOptions) -> Result<AnalysisResult> {
+        self.collect_analysis(options, None)
+    }
+
+    fn collect_analysis(
+        &self,
+        options: &AnalysisOptions,
+        cache: Option<&AnalysisCache>,
+    ) -> Result<AnalysisResult> {
+        let start = Instant::now();
+        let type_registry = SharedTypeRegistry::new();
+        let decl_cache = DeclCache::new();
+        let counters = UnitCounters::default();
+        let mut signatures = Vec::new();
+        let mut stats = self.analyze_into(
+            options,
+            &type_registry,
+            &decl_cache,
+            cache,
+            &counters,
+            |unit| {
+                signatures.extend(unit.signatures);
+                Ok(())
+            },
+        )?;
+
+        let merge_start = Instant::now();
+        let type_registry = type_registry.into_registry()?;
+        stats.merge = merge_start.elapsed();
+        counters.add_to(&mut stats);
+        stats.registry_types = type_registry.len();
+        stats.types_deduplicated = stats.types_registered.saturating_sub(stats.registry_types);
+        stats.total = start.elapsed();
+
+        Ok(AnalysisResult {
+            signatures,
+            type_registry,
+            stats,
+        })
+    }
+
+    /// analyze like [`Self::extract_analysis_with`], keeping about
+    /// `budget.bytes` of types in memory. the other types and all signatures
+    /// are written to spill files in `budget.dir` as they are found, which
+    /// live as long as the result. a quarter of the budget goes to the
+    /// declarations shared between units, the rest to the registry.
+    pub fn extract_analysis_spilled(
+        &self,
+        options: &AnalysisOptions,
+        budget: &MemoryBudget,
+    ) -> Result<SpilledAnalysis> {
+        let start = Instant::now();
+        let type_registry = SharedTypeRegistry::with_budget(&MemoryBudget {
+            bytes: budget.bytes - budget.bytes / 4,
+            ..budget.clone()
+        })?;
+        let decl_cache = DeclCache::with_limit(budget.bytes / 4);
+        let counters = UnitCounters::default();
+        let mut signatures = SignatureSpool::create(budget)?;
+        let mut stats = self.analyze_into(
+            options,
+            &type_registry,
+            &decl_cache,
+            None,
+            &counters,
+            |unit| {
+                unit.signatures
+                    .iter()
+                    .try_for_each(|sig| signatures.push(sig))
+            },
+        )?;
+
+        counters.add_to(&mut stats);
+        stats.registry_types = type_registry.len();
+        stats.types_deduplicated = stats.types_registered.saturating_sub(stats.registry_types);
+        stats.types_spilled = type_registry.spilled();
+        stats.total = start.elapsed();
+        log::info!(
+            "{} of {} types spilled to disk",
+            stats.types_spilled,
+            stats.registry_types
+        );
+
+        Ok(SpilledAnalysis {
+            signatures,
+            type_registry,
+            stats,
+        })
+    }
+
+    /// analyze like [`Self::extract_analysis_with`], but hand the signatures
+    /// of each compilation unit to `on_unit` as soon as that unit and all
+    /// units before it are done. `on_unit` runs on the calling thread, in
+    /// unit order. an error from it stops the analysis and is returned.
+    ///
+    /// returns the registry of every type the signatures refer to.
+    pub fn analyze_streaming(
+        &self,
+        options: &AnalysisOptions,
+        on_unit: impl FnMut(UnitAnalysis<'_>) -> Result<()>,
+    ) -> Result<TypeRegistry> {
+        let type_registry = SharedTypeRegistry::new();
+        let decl_cache = DeclCache::new();
+        let counters = UnitCounters::default();
+        self.analyze_into(
+            options,
+            &type_registry,
+            &decl_cache,
+            None,
+            &counters,
+            on_unit,
+        )?;
+        type_registry.into_registry()
+    }
+
+    /// analyze every binary in `paths` into one registry. types from headers
+    /// the libraries share are resolved once and get the same id everywhere.
+    /// libraries run in parallel, `options.threads` is split between them.
+    pub fn analyze_batch(paths: &[PathBuf], options: &AnalysisOptions) -> Result<BatchAnalysis> {
+        let start = Instant::now();
+        let type_registry = SharedTypeRegistry::new();
+        let decl_cache = DeclCache::new();
+        let counters = UnitCounters::default();
+
+        let total_threads = options.thread_count();
+        let workers = total_threads.min(paths.len()).max(1);
+        let library_options = AnalysisOptions {
+            threads: (total_threads / workers).max(1),
+            ..options.clone()
+        };
+        log::info!(
+            "analyzing {} libraries, {} at a time on {} threads each",
+            paths.len(),
+            workers,
+            library_options.threads
+        );
+
+        let analyze = |path: &PathBuf| -> Result<(LibraryAnalysis, AnalysisStats)> {
+            let mut signatures = Vec::new();
+            let stats = DwarfAnalyzer::from_file(path)
+                .and_then(|analyzer| {
+                    analyzer.analyze_into(
+                        &library_options,
+                        &type_registry,
+                        &decl_cache,
+                        None,
+                        &counters,
+                        |unit| {
+                            signatures.extend(unit.signatures);
+                            Ok(())
+                        },
+                    )
+                })
+                .with_context(|| format!("failed to analyze {}", path.display()))?;
+            let library = LibraryAnalysis {
+                path: path.clone(),
+                signatures,
+            };
+            Ok((library, stats))
+        };
+
+        let done = parallel_map_ordered(paths, workers, analyze)?;
+
+        let mut stats = AnalysisStats::default();
+        let mut libraries = Vec::with_capacity(done.len());
+        for (library, library_stats) in done {
+            stats += &library_stats;
+            libraries.push(library);
+        }
+
+        let merge_start = Instant::now();
+        let type_registry = type_registry.into_registry()?;
+        stats.merge = merge_start.elapsed();
+        counters.add_to(&mut stats);
+        stats.registry_types = type_registry.len();
+        stats.types_deduplicated = stats.types_registered.saturating_sub(stats.registry_types);
+        stats.total = start.elapsed();
+        log::info!(
+            "analyzed {} libraries, {} types after dedup",
+            libraries.len(),
+            type_registry.len()
+        );
+        Ok(BatchAnalysis {
+            libraries,
+            type_registry,
+            stats,
+        })
+    }
+
+    /// analyze this binary, registering its types into `type_registry`.
+    /// `decl_cache` must only ever be used with that same registry. units
+    /// found in `cache` are not analyzed again.
+    ///
+    /// returns the stats of the phases that run once. per unit work is added
+    /// to `counters`.
+    fn analyze_into(
+        &self,
+        options: &AnalysisOptions,
+        type_registry: &SharedTypeRegistry,
+        decl_cache: &DeclCache,
+        cache: Option<&AnalysisCache>,
+        counters: &UnitCounters,
+        mut on_unit: impl FnMut(UnitAnalysis<'_>) -> Result<()>,
+    ) -> Result<AnalysisStats> {
+        let mut stats = AnalysisStats::default();
+        let mut phase = Instant::now();
+        let mut lap = || std::mem::replace(&mut phase, Instant::now()).elapsed();
+
+        // stripped binaries keep their DWARF in a separate file
+        let debug_file = self.load_debug_file()?;
+        let package_data = self.load_package()?;
+        stats.load = lap();
+
+        let threads = options.thread_count();
+        let sections =
+            reader::DebugSections::load(debug_file.as_deref().unwrap_or(&self.data), threads)?;
+        let dwarf = sections.dwarf();
         log::debug!("DWARF data load success");
 
+        let package_sections = package_data
+            .as_deref()
+            .map(|data| reader::PackageSections::load(data, threads))
+            .transpose()?;
+        let package = package_sections
+            .as_ref()
+            .map(reader::PackageSections::package)
+            .transpose()?;
+        stats.sections = lap();
+
         // export only?
-        let exported_symbols = if exported_only {
-            Some(self.get_exported_symbols()?)
+        let exported_symbols = if options.exported_only {
+            Some(self.exported_symbols(&options.filter)?)
         } else {
             None
         };
+        stats.symbols = lap();
 
-        let mut all_signatures = Vec::new();
-        let mut combined_registry = TypeRegistry::new();
+        let mut headers = Vec::new();
         let mut unit_iter = dwarf.units();
-        let mut unit_count = 0;
-
         while let Some(header) = unit_iter.next()? {
-            unit_count += 1;
-            log::debug!("processing compilation unit {}", unit_count);
+            headers.push(header);
+        }
+        // types moved into type units are decoded when a compilation unit
+        // refers to them, never on their own
+        let type_units = TypeUnits::read(&dwarf, &headers)?;
+        headers.retain(|header| !TypeUnits::is_type_unit(header));
 
-            let unit = dwarf.unit(header)?;
-            let mut type_resolver = TypeResolver::new(&dwarf, &unit);
+        // with an export list, the address ranges of the units say which of
+        // them hold exported code. for units without ranges, the accelerator
+        // tables say which units and DIEs can define an exported function
+        let unit_ranges = match &exported_symbols {
+            Some(symbols) if options.use_name_index && symbols.has_addresses() => {
+                Some(UnitRanges::build(&dwarf, &headers, symbols))
+            }
+            _ => None,
+        };
+        let has_exports = |offset| {
+            unit_ranges
+                .as_ref()
+                .and_then(|unit_ranges| unit_ranges.has_exports(offset))
+        };
+        let unmapped = |header: &gimli::UnitHeader<_>| {
+            header
+                .offset()
+                .as_debug_info_offset()
+                .is_none_or(|offset| has_exports(offset).is_none())
+        };
+        let name_index = match &exported_symbols {
+            Some(symbols) if options.use_name_index && headers.iter().any(unmapped) => {
+                NameIndex::build(
+                    sections.debug_names(),
+                    sections.debug_pubnames(),
+                    &dwarf.debug_str,
+                    |name| symbols.contains_function(name),
+                )
+            }
+            _ => None,
+        };
 
-            // Extract function signatures with TypeId-based parameters
-            let unit_sigs = self.extract_functions_from_unit(
-                &dwarf,
-                &unit,
-                &exported_symbols,
-                &mut type_resolver,
-            )?;
+        let mut work = Vec::with_capacity(headers.len());
+        for (position, header) in headers.iter().enumerate() {
+            let offset = header.offset().as_debug_info_offset();
+            let targets = match (offset.and_then(has_exports), &name_index, offset) {
+                // functions are matched by address, look at all of them
+                (Some(true), _, _) => UnitTargets::Scan,
+                (Some(false), _, _) => UnitTargets::Only(&[]),
+                (None, Some(name_index), Some(offset)) => name_index.targets(offset),
+                _ => UnitTargets::Scan,
+            };
+            if matches!(targets, UnitTargets::Only([])) {
+                log::trace!(
+                    "skip compilation unit {}, no exported functions",
+                    position + 1
+                );
+                continue;
+            }
+            work.push(UnitWork {
+                position,
+                header: *header,
+                targets,
+            });
+        }
+        stats.index = lap();
+        stats.units = headers.len();
+        stats.units_skipped = headers.len() - work.len();
 
-            log::debug!("found {} functions in unit {}", unit_sigs.len(), unit_count);
-            all_signatures.extend(unit_sigs);
+        let threads = options.worker_count(work.len());
+        log::debug!(
+            "analyzing {} of {} compilation units on {} threads",
+            work.len(),
+            headers.len(),
+            threads
+        );
 
-            // Merge type registry from this unit
-            let unit_registry = type_resolver.into_registry();
-            combined_registry.merge(unit_registry);
+        // every resolver registers into the same registry, duplicates are
+        // dropped on insert
+        let context = UnitContext {
+            dwarf: &dwarf,
+            exported_symbols: exported_symbols.as_ref(),
+            filter: &options.filter,
+            type_registry,
+            decl_cache,
+            type_units: &type_units,
+            split: SplitSources {
+                package: package.as_ref(),
+                binary_dir: self.path.as_deref().and_then(Path::parent),
+            },
+            type_members: options.type_members,
+            share_declarations: options.share_declarations,
+            unit_cache: cache.map(|cache| cache.units(options, exported_symbols.as_ref())),
+            counters,
+        };
+
+        let mut signature_count = 0;
+        let mut emit = |unit_work: &UnitWork, unit_sigs: Result<Vec<FunctionSignature>>| {
+            let signatures = unit_sigs?;
+            signature_count += signatures.len();
+            on_unit(UnitAnalysis {
+                unit: unit_work.position,
+                signatures,
+                type_registry: context.type_registry,
+            })
+        };
+        if threads <= 1 {
+            for unit_work in &work {
+                emit(unit_work, self.analyze_unit(&context, unit_work))?;
+            }
+        } else {
+            self.analyze_units_parallel(&context, &work, threads, emit)?;
         }
 
+        log::debug!("{} types shared between units", context.decl_cache.len());
         log::info!(
-            "processed {} compilation units, found {} functions, extracted {} types",
-            unit_count,
-            all_signatures.len(),
-            combined_registry.len()
+            "processed {} compilation units ({} skipped), found {} functions, {} types registered",
+            work.len(),
+            headers.len() - work.len(),
+            signature_count,
+            type_registry.len()
         );
 
-        Ok(AnalysisResult {
-            signatures: all_signatures,
-            type_registry: combined_registry,
+        stats.functions = signature_count;
+        stats.type_units = type_units.decoded();
+        Ok(stats)
+    }
+
+    /// hand out unit indices to `threads` scoped workers. finished units come
+    /// back over a channel and are passed to `emit` in unit order, holding
+    /// back any that finish early. the first error stops the workers.
+    fn analyze_units_parallel<'data>(
+        &self,
+        context: &UnitContext<'_, 'data>,
+        work: &[UnitWork<'_, 'data>],
+        threads: usize,
+        mut emit: impl FnMut(&UnitWork<'_, 'data>, Result<Vec<FunctionSignature>>) -> Result<()>,
+    ) -> Result<()> {
+        let next_unit = AtomicUsize::new(0);
+        let mut pending: Vec<Option<Result<Vec<FunctionSignature>>>> =
+            std::iter::repeat_with(|| None).take(work.len()).collect();
+
+        std::thread::scope(|scope| {
+            let (sender, receiver) = mpsc::channel();
+            let workers: Vec<_> = (0..threads)
+                .map(|_| {
+                    let sender = sender.clone();
+                    let next_unit = &next_unit;
+                    scope.spawn(move || {
+                        loop {
+                            let index = next_unit.fetch_add(1, Ordering::Relaxed);
+                            let Some(unit_work) = work.get(index) else {
+                                break;
+                            };
+                            let unit_result = self.analyze_unit(context, unit_work);
+                            if sender.send((index, unit_result)).is_err() {
+                                break;
+                            }
+                        }
+                    })
+                })
+                .collect();
+            drop(sender);
+
+            let mut next_emit = 0;
+            let mut outcome = Ok(());
+            // ends early when a worker panics and its unit never arrives
+            while next_emit < work.len()
+                && let Ok((index, unit_result)) = receiver.recv()
+            {
+                pending[index] = Some(unit_result);
+                while let Some(unit_result) = pending.get_mut(next_emit).and_then(Option::take) {
+                    outcome = emit(&work[next_emit], unit_result);
+                    next_emit += 1;
+                    if outcome.is_err() {
+                        break;
+                    }
+                }
+                if outcome.is_err() {
+                    // workers stop claiming units, and a send to the dropped
+                    // receiver stops the ones still running
+                    next_unit.store(work.len(), Ordering::Relaxed);
+                    break;
+                }
+            }
+            drop(receiver);
+
+            for worker in workers {
+                worker
+                    .join()
+                    .unwrap_or_else(|panic| std::panic::resume_unwind(panic));
+            }
+            outcome
         })
     }
 
-    fn extract_functions_from_unit(
+    /// analyze a single compilation unit with its own type resolver
+    fn analyze_unit<'data>(
+        &self,
+        context: &UnitContext<'_, 'data>,
+        unit_work: &UnitWork<'_, 'data>,
+    ) -> Result<Vec<FunctionSignature>> {
+        let position = unit_work.position + 1;
+        log::debug!("processing compilation unit {}", position);
+
+        let dwarf = context.dwarf;
+        let unit = dwarf.unit(unit_work.header)?;
+        match unit.dwo_id {
+            Some(dwo_id) => self.analyze_split_unit(context, &unit, dwo_id, unit_work),
+            None => {
+                let type_units = Some(context.type_units);
+                self.analyze_unit_entries(context, dwarf, &unit, type_units, unit_work)
+            }
+        }
+    }
+
+    /// a skeleton unit only points at its split unit. analyze the split unit
+    /// instead, from the package or from its own `.dwo`.
+    fn analyze_split_unit<'data>(
+        &self,
+        context: &UnitContext<'_, 'data>,
+        skeleton: &gimli::Unit<reader::DwarfReader<'data>>,
+        dwo_id: gimli::DwoId,
+        unit_work: &UnitWork<'_, 'data>,
+    ) -> Result<Vec<FunctionSignature>> {
+        let dwarf = context.dwarf;
+
+        if let Some(package) = context.split.package
+            && let Some(mut split) = package.find_cu(dwo_id, dwarf)?
+        {
+            log::debug!("split unit {:#018x} found in package", dwo_id.0);
+            split_dwarf::adopt_parent(&mut split, dwarf);
+            let unit = split_dwarf::split_unit(&split, skeleton)?;
+            return self.analyze_unit_entries(context, &split, &unit, None, unit_work);
+        }
+
+        // a missing .dwo loses this unit's functions, not the whole analysis
+        let Some(path) = split_dwarf::dwo_path(dwarf, skeleton, context.split.binary_dir)? else {
+            log::warn!("skeleton unit {:#018x} names no split unit", dwo_id.0);
+            return Ok(Vec::new());
+        };
+        let data = match reader::load_file(&path) {
+            Ok(data) => data,
+            Err(e) => {
+                log::warn!("skip split unit {:#018x}: {:#}", dwo_id.0, e);
+                return Ok(Vec::new());
+            }
+        };
+
+        let sections = reader::DebugSections::load_dwo(&data)?;
+        let mut split = sections.dwarf();
+        split_dwarf::adopt_parent(&mut split, dwarf);
+        let unit = split_dwarf::split_unit(&split, skeleton)?;
+        self.analyze_unit_entries(context, &split, &unit, None, unit_work)
+    }
+
+    /// extract the signatures of a unit whose entries are all at hand.
+    /// references by signature are resolved through `type_units`, which
+    /// split units go without
+    fn analyze_unit_entries<'data>(
+        &self,
+        context: &UnitContext<'_, '_>,
+        dwarf: &Dwarf<reader::DwarfReader<'data>>,
+        unit: &gimli::Unit<reader::DwarfReader<'data>>,
+        type_units: Option<&TypeUnits<reader::DwarfReader<'data>>>,
+        unit_work: &UnitWork,
+    ) -> Result<Vec<FunctionSignature>> {
+        // decode the unit once, everything below looks entries up in the index
+        let walk_start = Instant::now();
+        let die_index = DieIndex::build(unit)?;
+        let fingerprint = context
+            .unit_cache
+            .as_ref()
+            .map(|_| self.unit_fingerprint(dwarf, unit, &die_index, context))
+            .transpose()?;
+        context
+            .counters
+            .add_walk(die_index.len(), walk_start.elapsed());
+
+        if let (Some(unit_cache), Some(fingerprint)) = (&context.unit_cache, fingerprint)
+            && let Some((signatures, types)) = unit_cache.load(fingerprint, context.type_registry)
+        {
+            context.counters.add_cached(types);
+            log::debug!(
+                "reuse {} cached functions of unit {}",
+                signatures.len(),
+                unit_work.position + 1
+            );
+            return Ok(signatures);
+        }
+
+        let resolve_start = Instant::now();
+        let mut type_resolver = TypeResolver::new(
+            dwarf,
+            unit,
+            &die_index,
+            context.type_registry,
+            context.decl_cache,
+        );
+        if !context.type_members {
+            type_resolver = type_resolver.without_members();
+        }
+        if !context.share_declarations {
+            type_resolver = type_resolver.without_shared_decls();
+        }
+        if let Some(type_units) = type_units {
+            type_resolver = type_resolver.with_type_units(type_units);
+        }
+
+        // Extract function signatures with TypeId-based parameters
+        let unit_sigs = self.extract_functions_from_unit(
+            dwarf,
+            unit,
+            &die_index,
+            unit_work.targets,
+            context,
+            &mut type_resolver,
+        )?;
+        context
+            .counters
+            .add_resolution(&type_resolver.stats(), resolve_start.elapsed());
+
+        log::debug!(
+            "found {} functions in unit {}",
+            unit_sigs.len(),
+            unit_work.position + 1
+        );
+        if let (Some(unit_cache), Some(fingerprint)) = (&context.unit_cache, fingerprint) {
+            // a cache that can't be written only costs the next run time
+            if let Err(e) = unit_cache.store(fingerprint, &unit_sigs, context.type_registry) {
+                log::warn!("{:#}", e);
+            }
+        }
+        Ok(unit_sigs)
+    }
+
+    /// the unit's [`DieIndex::fingerprint`], plus which of its functions are
+    /// exported: the symbols the address of each one resolves to, or for a
+    /// function matched by name, whether that name is exported. addresses are
+    /// not part of the fingerprint, so a rebuild that moves code still hits,
+    /// and the rest of the export list does not matter
+    fn unit_fingerprint<'data>(
         &self,
-        dwarf: &Dwarf<reader::DwarfReader>,
-        unit: &gimli::Unit<reader::DwarfReader>,
-        exported_symbols: &Option<HashSet<String>>,
-        type_resolver: &mut TypeResolver<reader::DwarfReader>,
+        dwarf: &Dwarf<reader::DwarfReader<'data>>,
+        unit: &gimli::Unit<reader::DwarfReader<'data>>,
+        index: &DieIndex<reader::DwarfReader<'data>>,
+        context: &UnitContext<'_, 'data>,
+    ) -> Result<u64> {
+        let fingerprint = index.fingerprint(dwarf, unit)?;
+        let Some(symbols) = context.exported_symbols else {
+            return Ok(fingerprint);
+        };
+
+        // the same matching as in extract_functions_from_unit
+        let mut hasher = StableHasher::new();
+        hasher.write_u64(fingerprint);
+        for entry in index.iter() {
+            if entry.tag() != gimli::DW_TAG_subprogram
+                || Self::attr_flag_is_true(entry.attr(gimli::DW_AT_declaration).ok().flatten())
+            {
+                continue;
+            }
+            hasher.write_u64(entry.offset().0 as u64);
+            match Self::entry_address(dwarf, unit, entry)? {
+                Some(address) if symbols.has_addresses() => symbols
+                    .functions_at(address)
+                    .for_each(|name| hasher.write_str(name)),
+                _ => {
+                    let exported = self
+                        .get_function_name(dwarf, unit, index, entry)
+                        .is_some_and(|name| symbols.contains_function(&name));
+                    hasher.write_u64(u64::from(exported));
+                }
+            }
+        }
+        Ok(hasher.finish())
+    }
+
+    /// the `DW_AT_low_pc` of an entry
+    fn entry_address<'data>(
+        dwarf: &Dwarf<reader::DwarfReader<'data>>,
+        unit: &gimli::Unit<reader::DwarfReader<'data>>,
+        entry: &gimli::DebuggingInformationEntry<reader::DwarfReader<'data>>,
+    ) -> Result<Option<u64>> {
+        match entry.attr_value(gimli::DW_AT_low_pc)? {
+            Some(value) => Ok(dwarf.attr_address(unit, value)?),
+            None => Ok(None),
+        }
+    }
+
+    fn extract_functions_from_unit<'data>(
+        &self,
+        dwarf: &Dwarf<reader::DwarfReader<'data>>,
+        unit: &gimli::Unit<reader::DwarfReader<'data>>,
+        index: &DieIndex<reader::DwarfReader<'data>>,
+        targets: UnitTargets<'_, usize>,
+        context: &UnitContext<'_, 'data>,
+        type_resolver: &mut TypeResolver<reader::DwarfReader<'data>>,
     ) -> Result<Vec<FunctionSignature>> {
+        let exported_symbols = context.exported_symbols;
         let mut signatures = Vec::new();
         let mut function_count = 0;
-        let mut entries = unit.entries();
 
         // DWARF entries are tree-like. functions are grouped with their return
-        // types, parameters, etc. dfs will pull out children i.e. parameters,
-        // return types together.
-        while let Some((_, entry)) = entries.next_dfs()? {
+        // types, parameters, etc. the index keeps them in dfs order, so
+        // children i.e. parameters follow their function. with a name index
+        // only the listed entries are visited, still in offset order.
+        let candidates: Box<dyn Iterator<Item = _>> = match targets {
+            UnitTargets::Scan => Box::new(index.iter()),
+            UnitTargets::Only(offsets) => Box::new(offsets.iter().filter_map(|offset| {
+                index
+                    .entry(*offset)
+                    .inspect_err(|_| {
+                        log::warn!("name index points at missing entry {:#010x}", offset.0)
+                    })
+                    .ok()
+            })),
+        };
+
+        for entry in candidates {
             // function definitions marked with DW_TAG_subprogram
             if entry.tag() != gimli::DW_TAG_subprogram {
                 continue;
@@ -117,37 +970,44 @@ impl DwarfAnalyzer {
 
             function_count += 1;
 
-            // skip no-name functions
-            let name = match self.get_function_name(dwarf, unit, entry) {
-                Some(n) => {
-                    log::trace!("found function: {}", n);
-                    n
-                }
-                None => {
-                    log::trace!("skip unnamed function");
-                    continue;
-                }
-            };
+            let name = self.get_function_name(dwarf, unit, index, entry);
+            if let Some(name) = &name {
+                log::trace!("found function: {}", name);
+            }
 
-            // check against exported symbols
-            let is_exported = exported_symbols
-                .as_ref()
-                .map(|symbols| {
-                    // macOS prepends an underscore to symbol name
-                    symbols.contains(&name) || symbols.contains(&format!("_{}", name))
-                })
-                .unwrap_or(true);
+            // an exported function is found through its address, under the
+            // name of every symbol at that address. only a function without
+            // an address is matched by name
+            let mut names: Vec<Cow<'_, str>> = match exported_symbols {
+                None => name.into_iter().collect(),
+                Some(symbols) => match Self::entry_address(dwarf, unit, entry)? {
+                    Some(address) if symbols.has_addresses() => {
+                        symbols.functions_at(address).map(Cow::Borrowed).collect()
+                    }
+                    _ => name
+                        .filter(|name| symbols.contains_function(name))
+                        .into_iter()
+                        .collect(),
+                },
+            };
+            if names.is_empty() {
+                log::trace!(
+                    "skip unnamed or non-exported function at {:#010x}",
+                    entry.offset().0
+                );
+                continue;
+            }
 
-            // skip if not exported
-            if exported_symbols.is_some() && !is_exported {
-                log::trace!("skip non-exported function: {}", name);
+            names.retain(|name| context.filter.matches(name));
+            if names.is_empty() {
+                log::trace!("skip filtered function at {:#010x}", entry.offset().0);
                 continue;
             }
 
             // extract the return type TypeId
             let return_type_id = if let Some(type_attr) = entry.attr(gimli::DW_AT_type)? {
-                if let AttributeValue::UnitRef(offset) = type_attr.value() {
-                    type_resolver.build_type_registry_entry(offset)?
+                if let Some(type_id) = type_resolver.referenced_type(type_attr.value())? {
+                    type_id
                 } else {
                     type_resolver.get_void_type_id()?
                 }
@@ -155,19 +1015,26 @@ impl DwarfAnalyzer {
                 type_resolver.get_void_type_id()?
             };
 
-            log::debug!("{:>12} {:#010x}: {}()", "function", entry.offset().0, name);
+            log::debug!(
+                "{:>12} {:#010x}: {}()",
+                "function",
+                entry.offset().0,
+                names.join("(), ")
+            );
 
             // extract the parameters
             let (parameters, is_variadic) =
-                self.extract_parameters(dwarf, unit, entry, type_resolver)?;
-
-            signatures.push(FunctionSignature {
-                name: name.clone(),
-                return_type_id,
-                parameters,
-                is_variadic,
-                is_exported,
-            });
+                self.extract_parameters(dwarf, unit, index, entry, type_resolver)?;
+
+            for name in names {
+                signatures.push(FunctionSignature {
+                    name: name.into_owned(),
+                    return_type_id,
+                    parameters: parameters.clone(),
+                    is_variadic,
+                    is_exported: true,
+                });
+            }
         }
 
         log::debug!(
@@ -184,12 +1051,13 @@ impl DwarfAnalyzer {
     // partially stripped this cannot detect those cases, it is the
     // responsibility of the programmer to compile the library with full,
     // unstripped debug information!
-    fn get_function_name(
+    fn get_function_name<'data>(
         &self,
-        dwarf: &Dwarf<reader::DwarfReader>,
-        unit: &gimli::Unit<reader::DwarfReader>,
-        entry: &gimli::DebuggingInformationEntry<reader::DwarfReader>,
-    ) -> Option<String> {
+        dwarf: &Dwarf<reader::DwarfReader<'data>>,
+        unit: &gimli::Unit<reader::DwarfReader<'data>>,
+        index: &DieIndex<reader::DwarfReader<'data>>,
+        entry: &gimli::DebuggingInformationEntry<reader::DwarfReader<'data>>,
+    ) -> Option<Cow<'data, str>> {
         // skip artificial
         if Self::attr_flag_is_true(entry.attr(gimli::DW_AT_artificial).ok().flatten()) {
             log::trace!("skip artificial subprogram @{:#010x}", entry.offset().0);
@@ -205,6 +1073,7 @@ impl DwarfAnalyzer {
         if let Some(name) = Self::resolve_name_reference(
             dwarf,
             unit,
+            index,
             entry.attr(gimli::DW_AT_specification).ok().flatten(),
         ) {
             log::trace!(
@@ -219,6 +1088,7 @@ impl DwarfAnalyzer {
         if let Some(name) = Self::resolve_name_reference(
             dwarf,
             unit,
+            index,
             entry.attr(gimli::DW_AT_abstract_origin).ok().flatten(),
         ) {
             log::trace!(
@@ -238,11 +1108,11 @@ impl DwarfAnalyzer {
     }
 
     /// helper to grab the name from an entry
-    fn read_entry_name(
-        dwarf: &Dwarf<reader::DwarfReader>,
-        unit: &gimli::Unit<reader::DwarfReader>,
-        entry: &gimli::DebuggingInformationEntry<reader::DwarfReader>,
-    ) -> Option<String> {
+    fn read_entry_name<'data>(
+        dwarf: &Dwarf<reader::DwarfReader<'data>>,
+        unit: &gimli::Unit<reader::DwarfReader<'data>>,
+        entry: &gimli::DebuggingInformationEntry<reader::DwarfReader<'data>>,
+    ) -> Option<Cow<'data, str>> {
         // linkage names
         if let Ok(Some(attr)) = entry.attr(gimli::DW_AT_linkage_name)
             && let Some(name) = Self::read_attr_string(dwarf, unit, &attr)
@@ -263,11 +1133,12 @@ impl DwarfAnalyzer {
     /// sometimes compilers emit smaller DIEs that reference other DIEs, which
     /// contain the name. this will resolve a name from such entries by
     /// following the reference.
-    fn resolve_name_reference(
-        dwarf: &Dwarf<reader::DwarfReader>,
-        unit: &gimli::Unit<reader::DwarfReader>,
-        attr: Option<gimli::Attribute<reader::DwarfReader>>,
-    ) -> Option<String> {
+    fn resolve_name_reference<'data>(
+        dwarf: &Dwarf<reader::DwarfReader<'data>>,
+        unit: &gimli::Unit<reader::DwarfReader<'data>>,
+        index: &DieIndex<reader::DwarfReader<'data>>,
+        attr: Option<gimli::Attribute<reader::DwarfReader<'data>>>,
+    ) -> Option<Cow<'data, str>> {
         let attr = attr?;
 
         let name_entry_offset = match attr.value() {
@@ -275,14 +1146,15 @@ impl DwarfAnalyzer {
             _ => return None,
         };
 
-        let mut entries = unit.entries_at_offset(name_entry_offset).ok()?;
-        let (_, referenced) = (entries.next_dfs().ok()?)?;
+        let referenced = index.entry(name_entry_offset).ok()?;
 
         Self::read_entry_name(dwarf, unit, referenced)
     }
 
     /// check if an attribute is a flag and is true
-    fn attr_flag_is_true(attr: Option<gimli::Attribute<reader::DwarfReader>>) -> bool {
+    fn attr_flag_is_true<'data>(
+        attr: Option<gimli::Attribute<reader::DwarfReader<'data>>>,
+    ) -> bool {
         let Some(attr) = attr else {
             return false;
         };
@@ -299,31 +1171,20 @@ impl DwarfAnalyzer {
         }
     }
 
-    /// read a string attribute from an entry
-    fn read_attr_string(
-        dwarf: &Dwarf<reader::DwarfReader>,
-        unit: &gimli::Unit<reader::DwarfReader>,
-        attr: &gimli::Attribute<reader::DwarfReader>,
-    ) -> Option<String> {
+    /// read a string attribute from an entry. the string is borrowed from
+    /// the section data unless it is not valid UTF-8
+    fn read_attr_string<'data>(
+        dwarf: &Dwarf<reader::DwarfReader<'data>>,
+        unit: &gimli::Unit<reader::DwarfReader<'data>>,
+        attr: &gimli::Attribute<reader::DwarfReader<'data>>,
+    ) -> Option<Cow<'data, str>> {
         match attr.value() {
             // DWARF 5 may inline strings
-            AttributeValue::String(s) => match s.to_string_lossy() {
-                Ok(cow) => Some(cow.to_string()),
-                Err(e) => {
-                    log::warn!("failed to decode inline string: {:?}", e);
-                    None
-                }
-            },
+            AttributeValue::String(s) => Some(s.to_string_lossy()),
             // older versions do a string reference to .debug_str section
             _ => {
                 let r = dwarf.attr_string(unit, attr.value()).ok()?;
-                match r.to_string_lossy() {
-                    Ok(cow) => Some(cow.to_string()),
-                    Err(e) => {
-                        log::warn!("failed to decode string reference: {:?}", e);
-                        None
-                    }
-                }
+                Some(r.to_string_lossy())
             }
         }
     }
@@ -338,25 +1199,19 @@ impl DwarfAnalyzer {
     ///
     /// We also carry the stateful type resolver with us and update it, since we
     /// may encounter types that are not yet analyzed in the parameters.
-    fn extract_parameters(
+    fn extract_parameters<'data>(
         &self,
-        dwarf: &Dwarf<reader::DwarfReader>,
-        unit: &gimli::Unit<reader::DwarfReader>,
-        func_entry: &gimli::DebuggingInformationEntry<reader::DwarfReader>,
-        type_resolver: &mut TypeResolver<reader::DwarfReader>,
+        dwarf: &Dwarf<reader::DwarfReader<'data>>,
+        unit: &gimli::Unit<reader::DwarfReader<'data>>,
+        index: &DieIndex<reader::DwarfReader<'data>>,
+        func_entry: &gimli::DebuggingInformationEntry<reader::DwarfReader<'data>>,
+        type_resolver: &mut TypeResolver<reader::DwarfReader<'data>>,
     ) -> Result<(Vec<Parameter>, bool)> {
         let mut parameters = Vec::new();
         let mut is_variadic = false;
 
-        let offset = func_entry.offset();
-        let mut tree = unit.entries_tree(Some(offset))?;
-        let func_node = tree.root()?;
-
         // parameters are direct children
-        let mut children = func_node.children();
-        while let Some(child) = children.next()? {
-            let child_entry = child.entry();
-
+        for child_entry in index.children(func_entry.offset())? {
             match child_entry.tag() {
                 // formal are named params with types
                 gimli::DW_TAG_formal_parameter => {
@@ -368,16 +1223,17 @@ impl DwarfAnalyzer {
                         .unwrap_or_default();
 
                     // Get parameter type TypeId
-                    let param_type_id =
-                        if let Ok(Some(type_attr)) = child_entry.attr(gimli::DW_AT_type) {
-                            if let AttributeValue::UnitRef(offset) = type_attr.value() {
-                                type_resolver.build_type_registry_entry(offset)?
-                            } else {
-                                type_resolver.get_void_type_id()?
-                            }
+                    let param_type_id = if let Ok(Some(type_attr)) =
+                        child_entry.attr(gimli::DW_AT_type)
+                    {
+                        if let Some(type_id) = type_resolver.referenced_type(type_attr.value())? {
+                            type_id
                         } else {
                             type_resolver.get_void_type_id()?
-                        };
+                        }
+                    } else {
+                        type_resolver.get_void_type_id()?
+                    };
 
                     log::debug!(
                         "{:>12} {:#010x}: {}",
@@ -387,7 +1243,7 @@ impl DwarfAnalyzer {
                     );
 
                     parameters.push(Parameter {
-                        name: param_name,
+                        name: param_name.into_owned(),
                         type_id: param_type_id,
                     });
                 }
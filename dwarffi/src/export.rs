@@ -0,0 +1,315 @@
+//! the analysis as data, for generators that don't live in this workspace.
+//!
+//! an export lists the functions of each library, with their parameter and
+//! return types referenced by [`TypeId`], and every type they refer to once,
+//! in id order.
+//! the same document is written as JSON or as bincode. both are serialized
+//! straight from the analysis into the writer, nothing is copied first.
+//!
+//! ids are full 64 bit integers; readers whose JSON numbers are doubles have
+//! to parse them as big integers. [`EXPORT_VERSION`] is bumped whenever the
+//! schema changes.
+
+use crate::dwarf_analyzer::SpilledAnalysis;
+use crate::type_registry::{Type, TypeId, TypeRegistry};
+use crate::types::FunctionSignature;
+use anyhow::{Result, anyhow};
+use serde::{Deserialize, Serialize};
+use std::borrow::Cow;
+use std::io::{Read, Write};
+use std::path::Path;
+
+/// version of the export schema
+pub const EXPORT_VERSION: u32 = 2;
+
+/// `format` of every export
+const FORMAT: &str = "dwarffi";
+
+/// first bytes of a bincode export
+const MAGIC: &[u8; 8] = b"DWFFI\0X1";
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ExportFormat {
+    Json,
+    /// bincode 1 with its default options: little endian, fixed size
+    /// integers, u64 lengths. preceded by 8 magic bytes
+    Bincode,
+}
+
+/// an export, as read back by [`read_export`]
+#[derive(Debug, Clone, Deserialize)]
+pub struct AnalysisExport {
+    pub format: String,
+    pub version: u32,
+    pub libraries: Vec<ExportedLibrary>,
+    /// every type any function refers to, directly or through other types,
+    /// in id order
+    pub types: Vec<Type>,
+}
+
+impl AnalysisExport {
+    /// the libraries, and a registry of the exported types
+    pub fn into_parts(self) -> (Vec<ExportedLibrary>, TypeRegistry) {
+        (self.libraries, TypeRegistry::from_sorted_types(self.types))
+    }
+}
+
+#[derive(Debug, Clone, Deserialize)]
+pub struct ExportedLibrary {
+    pub path: String,
+    pub functions: Vec<FunctionSignature>,
+}
+
+/// serialized form of [`AnalysisExport`], borrowing from the analysis
+#[derive(Serialize)]
+struct ExportRef<'a> {
+    format: &'static str,
+    version: u32,
+    libraries: Vec<LibraryRef<'a>>,
+    types: Vec<&'a Type>,
+}
+
+#[derive(Serialize)]
+struct LibraryRef<'a> {
+    path: Cow<'a, str>,
+    functions: &'a [FunctionSignature],
+}
+
+/// write the functions of `libraries` and the types of `type_registry` they
+/// refer to, directly or through other types, to `out` as one export document
+pub fn write_export<'a>(
+    mut out: impl Write,
+    format: ExportFormat,
+    libraries: impl IntoIterator<Item = (&'a Path, &'a [FunctionSignature])>,
+    type_registry: &'a TypeRegistry,
+) -> Result<()> {
+    let libraries: Vec<_> = libraries
+        .into_iter()
+        .map(|(path, functions)| LibraryRef {
+            path: path.to_string_lossy(),
+            functions,
+        })
+        .collect();
+    let roots = libraries
+        .iter()
+        .flat_map(|library| library.functions)
+        .flat_map(FunctionSignature::type_ids);
+    let types = type_registry
+        .reachable_ids(roots)
+        .into_iter()
+        .filter_map(|id| type_registry.get_type(id))
+        .collect();
+    let export = ExportRef {
+        format: FORMAT,
+        version: EXPORT_VERSION,
+        libraries,
+        types,
+    };
+
+    match format {
+        ExportFormat::Json => serde_json::to_writer(&mut out, &export)?,
+        ExportFormat::Bincode => {
+            out.write_all(MAGIC)?;
+            bincode::serialize_into(&mut out, &export)?;
+        }
+    }
+    out.flush()?;
+    Ok(())
+}
+
+/// write a [`SpilledAnalysis`] of the library at `path` as an export. the
+/// document is the one [`write_export`] writes, put together record by
+/// record so no more than one signature or type is read back at a time.
+/// both are read twice, the first time to find the types to write
+pub fn write_spilled_export(
+    mut out: impl Write,
+    format: ExportFormat,
+    path: &Path,
+    analysis: &SpilledAnalysis,
+) -> Result<()> {
+    let path = path.to_string_lossy();
+    let mut roots = Vec::new();
+    for signature in analysis.signatures.iter() {
+        roots.extend(signature?.type_ids());
+    }
+    let ids = analysis.type_registry.reachable_ids(roots)?;
+    let with_type = |id: TypeId, f: &mut dyn FnMut(&Type) -> Result<()>| {
+        analysis
+            .type_registry
+            .with_type(id, f)?
+            .unwrap_or_else(|| Err(anyhow!("type {:016x} went missing", id.0)))
+    };
+
+    match format {
+        ExportFormat::Json => {
+            write!(
+                out,
+                r#"{{"format":"{}","version":{},"#,
+                FORMAT, EXPORT_VERSION
+            )?;
+            out.write_all(br#""libraries":[{"path":"#)?;
+            serde_json::to_writer(&mut out, &path)?;
+            out.write_all(br#","functions":["#)?;
+            for (i, signature) in analysis.signatures.iter().enumerate() {
+                if i > 0 {
+                    out.write_all(b",")?;
+                }
+                serde_json::to_writer(&mut out, &signature?)?;
+            }
+            out.write_all(br#"]}],"types":["#)?;
+            for (i, id) in ids.into_iter().enumerate() {
+                if i > 0 {
+                    out.write_all(b",")?;
+                }
+                with_type(id, &mut |type_| Ok(serde_json::to_writer(&mut out, type_)?))?;
+            }
+            out.write_all(b"]}")?;
+        }
+        ExportFormat::Bincode => {
+            // bincode writes a struct as its fields, a sequence as its
+            // length and then its elements
+            out.write_all(MAGIC)?;
+            bincode::serialize_into(&mut out, FORMAT)?;
+            bincode::serialize_into(&mut out, &EXPORT_VERSION)?;
+            bincode::serialize_into(&mut out, &1u64)?;
+            bincode::serialize_into(&mut out, &path)?;
+            bincode::serialize_into(&mut out, &(analysis.signatures.len() as u64))?;
+            for signature in analysis.signatures.iter() {
+                bincode::serialize_into(&mut out, &signature?)?;
+            }
+            bincode::serialize_into(&mut out, &(ids.len() as u64))?;
+            for id in ids {
+                with_type(id, &mut |type_| {
+                    Ok(bincode::serialize_into(&mut out, type_)?)
+                })?;
+            }
+        }
+    }
+    out.flush()?;
+    Ok(())
+}
+
+/// read an export written by [`write_export`] with the same version
+pub fn read_export(mut input: impl Read, format: ExportFormat) -> Result<AnalysisExport> {
+    let export: AnalysisExport = match format {
+        ExportFormat::Json => serde_json::from_reader(input)?,
+        ExportFormat::Bincode => {
+            let mut magic = [0; MAGIC.len()];
+            input.read_exact(&mut magic)?;
+            if magic != *MAGIC {
+                return Err(anyhow!("not a dwarffi export"));
+            }
+            bincode::deserialize_from(input)?
+        }
+    };
+    if export.format != FORMAT || export.version != EXPORT_VERSION {
+        return Err(anyhow!(
+            "unsupported export: {} version {}",
+            export.format,
+            export.version
+        ));
+    }
+    Ok(export)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::type_registry::BaseTypeKind;
+    use crate::types::Parameter;
+
+    fn analysis() -> (TypeRegistry, Vec<FunctionSignature>) {
+        let mut registry = TypeRegistry::new();
+        let int = registry.register_type(Type {
+            id: TypeId(0),
+            kind: BaseTypeKind::Primitive {
+                name: "int".to_string(),
+                size: 4,
+                alignment: 4,
+            },
+            pointer_depth: 0,
+            is_const: false,
+            is_volatile: false,
+            dwarf_offset: Some(0x2a),
+        });
+        let signatures = vec![FunctionSignature {
+            name: "add".to_string(),
+            return_type_id: int,
+            parameters: vec![Parameter {
+                name: "a".to_string(),
+                type_id: int,
+            }],
+            is_variadic: false,
+            is_exported: true,
+        }];
+        (registry, signatures)
+    }
+
+    #[test]
+    fn test_round_trip() {
+        let (registry, signatures) = analysis();
+        for format in [ExportFormat::Json, ExportFormat::Bincode] {
+            let mut data = Vec::new();
+            let libraries = [(Path::new("libadd.so"), signatures.as_slice())];
+            write_export(&mut data, format, libraries, &registry).unwrap();
+
+            let export = read_export(data.as_slice(), format).unwrap();
+            assert_eq!(export.libraries.len(), 1);
+            assert_eq!(export.libraries[0].path, "libadd.so");
+            assert_eq!(export.libraries[0].functions[0].name, "add");
+            let types: Vec<&Type> = registry.all_types().collect();
+            assert_eq!(export.types.iter().collect::<Vec<_>>(), types);
+        }
+    }
+
+    #[test]
+    /// types no function refers to, like those of another library of a
+    /// batch, are left out
+    fn test_only_referenced_types() {
+        let (mut registry, signatures) = analysis();
+        registry.register_type(Type {
+            id: TypeId(0),
+            kind: BaseTypeKind::Primitive {
+                name: "double".to_string(),
+                size: 8,
+                alignment: 8,
+            },
+            pointer_depth: 0,
+            is_const: false,
+            is_volatile: false,
+            dwarf_offset: Some(0x40),
+        });
+
+        let mut data = Vec::new();
+        let libraries = [(Path::new("libadd.so"), signatures.as_slice())];
+        write_export(&mut data, ExportFormat::Json, libraries, &registry).unwrap();
+        let export = read_export(data.as_slice(), ExportFormat::Json).unwrap();
+        assert_eq!(export.types.len(), 1);
+        assert_eq!(export.types[0].id, signatures[0].return_type_id);
+    }
+
+    #[test]
+    fn test_json_schema() {
+        let (registry, signatures) = analysis();
+        let mut data = Vec::new();
+        let libraries = [(Path::new("libadd.so"), signatures.as_slice())];
+        write_export(&mut data, ExportFormat::Json, libraries, &registry).unwrap();
+
+        let json: serde_json::Value = serde_json::from_slice(&data).unwrap();
+        let int = registry.all_types().next().unwrap().id.0;
+        assert_eq!(json["format"], "dwarffi");
+        assert_eq!(json["version"], EXPORT_VERSION);
+        let function = &json["libraries"][0]["functions"][0];
+        assert_eq!(function["return_type_id"], int);
+        assert_eq!(function["parameters"][0]["type_id"], int);
+        assert_eq!(json["types"][0]["id"], int);
+        assert_eq!(json["types"][0]["kind"]["Primitive"]["name"], "int");
+    }
+
+    #[test]
+    fn test_rejects_other_data() {
+        assert!(read_export(&b"garbage!garbage"[..], ExportFormat::Bincode).is_err());
+        let other = br#"{"format":"dwarffi","version":0,"libraries":[],"types":[]}"#;
+        assert!(read_export(&other[..], ExportFormat::Json).is_err());
+    }
+}
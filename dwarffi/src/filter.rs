@@ -0,0 +1,171 @@
+//! include/exclude filters on function names.
+//!
+//! filters are applied where names are first seen: to the exported symbol
+//! table before the name index is built, and to each DWARF function name
+//! before its return and parameter types are resolved. a filtered run only
+//! pays for the functions it keeps.
+
+use crate::stable_hash::StableHasher;
+use serde::{Deserialize, Serialize};
+use std::collections::BTreeSet;
+use std::hash::Hasher;
+
+/// which functions to keep. patterns are globs where `*` matches any run of
+/// characters and `?` exactly one; a pattern without either is an exact name.
+/// a name is kept when it matches an include pattern (or there are none) and
+/// no exclude pattern. the empty filter keeps everything.
+#[derive(Debug, Clone, Default, PartialEq, Eq, Serialize, Deserialize)]
+pub struct FunctionFilter {
+    include_names: BTreeSet<String>,
+    include_globs: Vec<String>,
+    exclude_names: BTreeSet<String>,
+    exclude_globs: Vec<String>,
+}
+
+impl FunctionFilter {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// keep functions matching `pattern`
+    pub fn include(&mut self, pattern: impl Into<String>) -> &mut Self {
+        let pattern = pattern.into();
+        if is_glob(&pattern) {
+            self.include_globs.push(pattern);
+        } else {
+            self.include_names.insert(pattern);
+        }
+        self
+    }
+
+    /// drop functions matching `pattern`, even when they are included
+    pub fn exclude(&mut self, pattern: impl Into<String>) -> &mut Self {
+        let pattern = pattern.into();
+        if is_glob(&pattern) {
+            self.exclude_globs.push(pattern);
+        } else {
+            self.exclude_names.insert(pattern);
+        }
+        self
+    }
+
+    /// include every name listed in `list`, one per line. blank lines and
+    /// lines starting with `#` are skipped.
+    pub fn include_list(&mut self, list: &str) -> &mut Self {
+        for line in list.lines().map(str::trim) {
+            if !line.is_empty() && !line.starts_with('#') {
+                self.include(line);
+            }
+        }
+        self
+    }
+
+    /// does this filter keep everything?
+    pub fn is_empty(&self) -> bool {
+        self.include_names.is_empty()
+            && self.include_globs.is_empty()
+            && self.exclude_names.is_empty()
+            && self.exclude_globs.is_empty()
+    }
+
+    pub fn matches(&self, name: &str) -> bool {
+        let included = (self.include_names.is_empty() && self.include_globs.is_empty())
+            || self.include_names.contains(name)
+            || self.include_globs.iter().any(|glob| glob_match(glob, name));
+        included
+            && !self.exclude_names.contains(name)
+            && !self.exclude_globs.iter().any(|glob| glob_match(glob, name))
+    }
+
+    /// stable hash of the patterns, for cache keys
+    pub(crate) fn stable_hash(&self) -> u64 {
+        let mut hasher = StableHasher::new();
+        for patterns in [&self.include_names, &self.exclude_names] {
+            hasher.write_u64(patterns.len() as u64);
+            patterns.iter().for_each(|name| hasher.write_str(name));
+        }
+        for patterns in [&self.include_globs, &self.exclude_globs] {
+            hasher.write_u64(patterns.len() as u64);
+            patterns.iter().for_each(|glob| hasher.write_str(glob));
+        }
+        hasher.finish()
+    }
+}
+
+fn is_glob(pattern: &str) -> bool {
+    pattern.contains(['*', '?'])
+}
+
+/// match `name` against a glob in linear time: on a mismatch, retry from the
+/// last `*` with it swallowing one more byte
+fn glob_match(glob: &str, name: &str) -> bool {
+    let (glob, name) = (glob.as_bytes(), name.as_bytes());
+    let (mut g, mut n) = (0, 0);
+    // position of the last `*` in the glob, and where in the name it started
+    let mut star = None;
+
+    while n < name.len() {
+        match glob.get(g) {
+            Some(b'*') => {
+                star = Some((g, n));
+                g += 1;
+            }
+            Some(&c) if c == b'?' || c == name[n] => {
+                g += 1;
+                n += 1;
+            }
+            _ => match star {
+                Some((star_g, star_n)) => {
+                    g = star_g + 1;
+                    n = star_n + 1;
+                    star = Some((star_g, star_n + 1));
+                }
+                None => return false,
+            },
+        }
+    }
+
+    glob[g..].iter().all(|&c| c == b'*')
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_glob_match() {
+        assert!(glob_match("mylib_*", "mylib_open"));
+        assert!(glob_match("mylib_*", "mylib_"));
+        assert!(glob_match("*_free", "point_free"));
+        assert!(glob_match("a*b*c", "axxbyyc"));
+        assert!(glob_match("get_?", "get_x"));
+        assert!(!glob_match("get_?", "get_xy"));
+        assert!(!glob_match("mylib_*", "other_open"));
+        assert!(!glob_match("a*b", "acbc"));
+    }
+
+    #[test]
+    fn test_include_and_exclude() {
+        let mut filter = FunctionFilter::new();
+        assert!(filter.matches("anything"));
+
+        filter.include("point_*").include("create_person");
+        filter.exclude("point_internal_*");
+
+        assert!(filter.matches("point_add"));
+        assert!(filter.matches("create_person"));
+        assert!(!filter.matches("point_internal_check"));
+        assert!(!filter.matches("destroy_person"));
+    }
+
+    #[test]
+    fn test_include_list_skips_comments() {
+        let mut filter = FunctionFilter::new();
+        filter.include_list("# wanted\npoint_add\n\n  create_person  \n");
+
+        assert!(filter.matches("point_add"));
+        assert!(filter.matches("create_person"));
+        assert!(!filter.matches("# wanted"));
+        assert!(!filter.matches("point_sub"));
+    }
+}
@@ -6,15 +6,42 @@
 //! - some limitations around arrays and nested types
 //! - use at your own risk!
 
+mod cache;
+mod die_index;
 mod dwarf_analyzer;
+mod export;
+mod filter;
+mod name_index;
+mod parallel;
 mod reader;
+mod service;
+mod split_dwarf;
+mod spill;
+mod stable_hash;
+mod stats;
 mod symbol_reader;
 pub mod type_registry;
 mod type_resolver;
+mod type_units;
 pub mod types;
+mod unit_ranges;
 
-pub use dwarf_analyzer::{AnalysisResult, DwarfAnalyzer};
+pub use cache::{AnalysisCache, CacheKey};
+pub use dwarf_analyzer::{
+    AnalysisOptions, AnalysisResult, BatchAnalysis, DwarfAnalyzer, LibraryAnalysis,
+    SpilledAnalysis, UnitAnalysis,
+};
+pub use export::{
+    AnalysisExport, EXPORT_VERSION, ExportFormat, ExportedLibrary, read_export, write_export,
+    write_spilled_export,
+};
+pub use filter::FunctionFilter;
+pub use parallel::parallel_map_ordered;
+pub use service::{AnalysisService, LoadedLibrary};
+pub use spill::{MemoryBudget, SignatureSpool};
+pub use stats::AnalysisStats;
 pub use type_registry::{
-    BaseTypeKind, EnumVariant, StructField, Type, TypeId, TypeRegistry, UnionField,
+    BaseTypeKind, EnumVariant, SharedTypeRegistry, StructField, Type, TypeId, TypeIndex,
+    TypeRegistry, UnionField,
 };
 pub use types::{FunctionSignature, Parameter};
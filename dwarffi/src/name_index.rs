@@ -0,0 +1,369 @@
+//! find exported functions through the DWARF name accelerator tables.
+//!
+//! `.debug_names` (DWARF 5) and `.debug_pubnames` map a name straight to the
+//! unit and DIE that defines it. when looking for a few exported functions
+//! this lets the analyzer skip every unit that defines none of them, and only
+//! visit the listed DIEs in the units that do. units not described by any
+//! table are still scanned in full.
+
+use anyhow::{Result, anyhow, bail};
+use gimli::{
+    DebugInfoOffset, DebugPubNames, DebugStr, DebugStrOffset, Format, Reader, ReaderOffset,
+    UnitOffset,
+};
+use std::collections::{HashMap, HashSet};
+
+/// what the analyzer has to look at in one unit
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum UnitTargets<'a, T> {
+    /// the unit is not covered by an index, walk all of it
+    Scan,
+    /// only these subprogram DIEs (possibly none) are relevant
+    Only(&'a [UnitOffset<T>]),
+}
+
+pub struct NameIndex<R: Reader> {
+    /// units described by at least one table
+    covered: HashSet<R::Offset>,
+    /// wanted subprogram DIEs per unit, sorted by offset
+    functions: HashMap<R::Offset, Vec<UnitOffset<R::Offset>>>,
+}
+
+impl<R: Reader> NameIndex<R> {
+    /// read whichever accelerator tables are present, keeping entries whose
+    /// name passes `is_wanted`. returns `None` when the binary has no usable
+    /// table; a malformed table is logged and ignored, since the index is only
+    /// a shortcut around a full scan.
+    pub fn build(
+        debug_names: R,
+        debug_pubnames: R,
+        debug_str: &DebugStr<R>,
+        is_wanted: impl Fn(&str) -> bool,
+    ) -> Option<Self> {
+        let mut index = Self {
+            covered: HashSet::new(),
+            functions: HashMap::new(),
+        };
+
+        if !debug_names.is_empty() {
+            if let Err(e) = index.read_debug_names(debug_names, debug_str, &is_wanted) {
+                log::warn!("ignore unreadable .debug_names: {}", e);
+                return None;
+            }
+        } else if !debug_pubnames.is_empty()
+            && let Err(e) = index.read_pubnames(debug_pubnames, &is_wanted)
+        {
+            log::warn!("ignore unreadable .debug_pubnames: {}", e);
+            return None;
+        }
+
+        if index.covered.is_empty() {
+            return None;
+        }
+
+        for offsets in index.functions.values_mut() {
+            offsets.sort_unstable();
+            offsets.dedup();
+        }
+
+        log::debug!(
+            "name index covers {} units, {} of them define wanted functions",
+            index.covered.len(),
+            index.functions.len()
+        );
+        Some(index)
+    }
+
+    /// the DIEs to visit in the unit whose header is at `unit`
+    pub fn targets(&self, unit: DebugInfoOffset<R::Offset>) -> UnitTargets<'_, R::Offset> {
+        if !self.covered.contains(&unit.0) {
+            return UnitTargets::Scan;
+        }
+
+        match self.functions.get(&unit.0) {
+            Some(offsets) => UnitTargets::Only(offsets),
+            None => UnitTargets::Only(&[]),
+        }
+    }
+
+    fn add(&mut self, unit: R::Offset, die: UnitOffset<R::Offset>) {
+        self.functions.entry(unit).or_default().push(die);
+    }
+
+    /// `.debug_pubnames` lists every external name. it carries no tag, so
+    /// variables and enumerators come along too; the analyzer skips anything
+    /// that is not a subprogram definition.
+    fn read_pubnames(&mut self, section: R, is_wanted: &impl Fn(&str) -> bool) -> Result<()> {
+        let mut items = DebugPubNames::from(section).items();
+        while let Some(entry) = items.next()? {
+            let unit = entry.unit_header_offset().0;
+            self.covered.insert(unit);
+
+            if is_wanted(&entry.name().to_string_lossy()?) {
+                self.add(unit, entry.die_offset());
+            }
+        }
+        Ok(())
+    }
+
+    /// `.debug_names` (DWARF 5, section 6.1.1). a section may hold several
+    /// tables back to back, one per linked module.
+    fn read_debug_names(
+        &mut self,
+        mut section: R,
+        debug_str: &DebugStr<R>,
+        is_wanted: &impl Fn(&str) -> bool,
+    ) -> Result<()> {
+        while !section.is_empty() {
+            let (length, format) = section.read_initial_length()?;
+            let mut table = section.split(length)?;
+
+            let version = table.read_u16()?;
+            if version != 5 {
+                bail!("unsupported .debug_names version {}", version);
+            }
+            let _padding = table.read_u16()?;
+            let comp_unit_count = table.read_u32()?;
+            let local_type_unit_count = table.read_u32()?;
+            let foreign_type_unit_count = table.read_u32()?;
+            let bucket_count = table.read_u32()?;
+            let name_count = table.read_u32()?;
+            let abbrev_table_size = table.read_u32()?;
+            let augmentation_string_size = table.read_u32()?;
+            skip_bytes(&mut table, augmentation_string_size as u64)?;
+
+            let mut units = Vec::with_capacity(comp_unit_count as usize);
+            for _ in 0..comp_unit_count {
+                units.push(table.read_offset(format)?);
+            }
+            self.covered.extend(units.iter().copied());
+
+            let offset_size = format.word_size() as u64;
+            skip_bytes(&mut table, offset_size * local_type_unit_count as u64)?;
+            skip_bytes(&mut table, 8 * foreign_type_unit_count as u64)?;
+            // hash lookup table: buckets, then one hash per name
+            skip_bytes(&mut table, 4 * bucket_count as u64)?;
+            if bucket_count > 0 {
+                skip_bytes(&mut table, 4 * name_count as u64)?;
+            }
+
+            let mut string_offsets = table.clone();
+            skip_bytes(&mut table, offset_size * name_count as u64)?;
+            let mut entry_offsets = table.clone();
+            skip_bytes(&mut table, offset_size * name_count as u64)?;
+
+            let mut abbrev_data = table.split(R::Offset::from_u32(abbrev_table_size))?;
+            let abbrevs = read_name_abbrevs(&mut abbrev_data)?;
+            let entry_pool = table;
+
+            for _ in 0..name_count {
+                let string_offset = string_offsets.read_offset(format)?;
+                let entry_offset = entry_offsets.read_offset(format)?;
+
+                let name = debug_str.get_str(DebugStrOffset(string_offset))?;
+                if !is_wanted(&name.to_string_lossy()?) {
+                    continue;
+                }
+
+                let mut entries = entry_pool.clone();
+                entries.skip(entry_offset)?;
+                self.read_name_entries(&mut entries, &abbrevs, &units, format)?;
+            }
+        }
+        Ok(())
+    }
+
+    /// the entry list of one name, terminated by a zero abbreviation code
+    fn read_name_entries(
+        &mut self,
+        entries: &mut R,
+        abbrevs: &HashMap<u64, NameAbbrev>,
+        units: &[R::Offset],
+        format: Format,
+    ) -> Result<()> {
+        loop {
+            let code = entries.read_uleb128()?;
+            if code == 0 {
+                return Ok(());
+            }
+            let abbrev = abbrevs
+                .get(&code)
+                .ok_or_else(|| anyhow!("unknown .debug_names abbreviation {}", code))?;
+
+            // a table with a single unit may leave out the unit index
+            let mut comp_unit = (units.len() == 1).then_some(0);
+            let mut die_offset = None;
+            let mut in_type_unit = false;
+
+            for &(idx, form) in &abbrev.attributes {
+                let value = read_index_value(entries, form, format)?;
+                match idx {
+                    gimli::DW_IDX_compile_unit => comp_unit = Some(value),
+                    gimli::DW_IDX_type_unit => in_type_unit = true,
+                    gimli::DW_IDX_die_offset => die_offset = Some(value),
+                    _ => {}
+                }
+            }
+
+            if abbrev.tag != gimli::DW_TAG_subprogram || in_type_unit {
+                continue;
+            }
+
+            if let (Some(comp_unit), Some(die_offset)) = (comp_unit, die_offset)
+                && let Some(&unit) = units.get(comp_unit as usize)
+            {
+                self.add(unit, UnitOffset(R::Offset::from_u64(die_offset)?));
+            }
+        }
+    }
+}
+
+struct NameAbbrev {
+    tag: gimli::DwTag,
+    attributes: Vec<(gimli::DwIdx, gimli::DwForm)>,
+}
+
+fn read_name_abbrevs<R: Reader>(data: &mut R) -> Result<HashMap<u64, NameAbbrev>> {
+    let mut abbrevs = HashMap::new();
+    loop {
+        let code = data.read_uleb128()?;
+        if code == 0 {
+            return Ok(abbrevs);
+        }
+
+        let tag = gimli::DwTag(data.read_uleb128_u16()?);
+        let mut attributes = Vec::new();
+        loop {
+            let idx = data.read_uleb128_u16()?;
+            let form = data.read_uleb128_u16()?;
+            if idx == 0 && form == 0 {
+                break;
+            }
+            attributes.push((gimli::DwIdx(idx), gimli::DwForm(form)));
+        }
+
+        abbrevs.insert(code, NameAbbrev { tag, attributes });
+    }
+}
+
+/// index attribute values are all small constants or references
+fn read_index_value<R: Reader>(input: &mut R, form: gimli::DwForm, format: Format) -> Result<u64> {
+    let value = match form {
+        gimli::DW_FORM_flag_present => 1,
+        gimli::DW_FORM_data1 | gimli::DW_FORM_ref1 | gimli::DW_FORM_flag => input.read_u8()? as u64,
+        gimli::DW_FORM_data2 | gimli::DW_FORM_ref2 => input.read_u16()? as u64,
+        gimli::DW_FORM_data4 | gimli::DW_FORM_ref4 => input.read_u32()? as u64,
+        gimli::DW_FORM_data8 | gimli::DW_FORM_ref8 | gimli::DW_FORM_ref_sig8 => input.read_u64()?,
+        gimli::DW_FORM_udata | gimli::DW_FORM_ref_udata => input.read_uleb128()?,
+        gimli::DW_FORM_sdata => input.read_sleb128()? as u64,
+        gimli::DW_FORM_ref_addr | gimli::DW_FORM_sec_offset => {
+            input.read_offset(format)?.into_u64()
+        }
+        gimli::DW_FORM_data16 => {
+            skip_bytes(input, 16)?;
+            0
+        }
+        _ => bail!("unsupported .debug_names form {}", form),
+    };
+    Ok(value)
+}
+
+fn skip_bytes<R: Reader>(input: &mut R, len: u64) -> Result<()> {
+    input.skip(R::Offset::from_u64(len)?)?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use gimli::{EndianSlice, LittleEndian};
+
+    type TestReader<'a> = EndianSlice<'a, LittleEndian>;
+
+    /// one 32-bit table for a single unit at 0x40 with two named
+    /// subprograms and one variable
+    fn debug_names_table() -> (Vec<u8>, Vec<u8>) {
+        let debug_str = b"add\0sub\0counter\0".to_vec();
+
+        let mut body = Vec::new();
+        body.extend(5u16.to_le_bytes()); // version
+        body.extend(0u16.to_le_bytes()); // padding
+        body.extend(1u32.to_le_bytes()); // comp_unit_count
+        body.extend(0u32.to_le_bytes()); // local_type_unit_count
+        body.extend(0u32.to_le_bytes()); // foreign_type_unit_count
+        body.extend(0u32.to_le_bytes()); // bucket_count, no hash table
+        body.extend(3u32.to_le_bytes()); // name_count
+        let abbrevs: &[u8] = &[
+            1, 0x2e, 3, 0x13, 0, 0, // subprogram: die_offset ref4
+            2, 0x34, 3, 0x13, 0, 0, // variable: die_offset ref4
+            0,
+        ];
+        body.extend((abbrevs.len() as u32).to_le_bytes());
+        body.extend(0u32.to_le_bytes()); // augmentation_string_size
+        body.extend(0x40u32.to_le_bytes()); // comp unit list
+
+        // string offsets, then entry pool offsets
+        for offset in [0u32, 4, 8] {
+            body.extend(offset.to_le_bytes());
+        }
+        for offset in [0u32, 6, 12] {
+            body.extend(offset.to_le_bytes());
+        }
+        body.extend(abbrevs);
+
+        // entry pool: code, ref4 die offset, terminator
+        body.extend([1, 0x2a, 0, 0, 0, 0]);
+        body.extend([1, 0x50, 0, 0, 0, 0]);
+        body.extend([2, 0x70, 0, 0, 0, 0]);
+
+        let mut section = (body.len() as u32).to_le_bytes().to_vec();
+        section.extend(body);
+        (section, debug_str)
+    }
+
+    fn build<'a>(
+        debug_names: &'a [u8],
+        debug_str: &'a [u8],
+        wanted: &[&str],
+    ) -> Option<NameIndex<TestReader<'a>>> {
+        NameIndex::build(
+            EndianSlice::new(debug_names, LittleEndian),
+            EndianSlice::new(&[], LittleEndian),
+            &DebugStr::from(EndianSlice::new(debug_str, LittleEndian)),
+            |name| wanted.contains(&name),
+        )
+    }
+
+    #[test]
+    fn test_debug_names_finds_wanted_subprograms() {
+        let (debug_names, debug_str) = debug_names_table();
+        let index = build(&debug_names, &debug_str, &["sub", "counter"]).unwrap();
+
+        // the variable matches by name but is not a subprogram
+        assert_eq!(
+            index.targets(DebugInfoOffset(0x40)),
+            UnitTargets::Only(&[UnitOffset(0x50)])
+        );
+    }
+
+    #[test]
+    fn test_unlisted_units_are_scanned() {
+        let (debug_names, debug_str) = debug_names_table();
+        let index = build(&debug_names, &debug_str, &[]).unwrap();
+
+        assert_eq!(index.targets(DebugInfoOffset(0x40)), UnitTargets::Only(&[]));
+        assert_eq!(index.targets(DebugInfoOffset(0x1000)), UnitTargets::Scan);
+    }
+
+    #[test]
+    fn test_no_tables_means_no_index() {
+        assert!(build(&[], &[], &["add"]).is_none());
+    }
+
+    #[test]
+    fn test_truncated_table_is_ignored() {
+        let (debug_names, debug_str) = debug_names_table();
+        let truncated = &debug_names[..debug_names.len() - 4];
+        assert!(build(truncated, &debug_str, &["add"]).is_none());
+    }
+}
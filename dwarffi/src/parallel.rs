@@ -0,0 +1,88 @@
+//! independent work on a few scoped threads, collected in order
+
+use anyhow::Result;
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+/// `f` of every item, in item order, on up to `threads` scoped threads that
+/// each take the next item nobody has taken yet. with one thread or one item
+/// everything runs on the calling thread. once an item fails no thread starts
+/// another, and the error of the first item that failed is returned. a panic
+/// in `f` is resumed on the calling thread.
+pub fn parallel_map_ordered<T, U, F>(items: &[T], threads: usize, f: F) -> Result<Vec<U>>
+where
+    T: Sync,
+    U: Send,
+    F: Fn(&T) -> Result<U> + Sync,
+{
+    let threads = threads.min(items.len());
+    if threads <= 1 {
+        return items.iter().map(&f).collect();
+    }
+
+    let next = AtomicUsize::new(0);
+    let mut done: Vec<(usize, Result<U>)> = std::thread::scope(|scope| {
+        let workers: Vec<_> = (0..threads)
+            .map(|_| {
+                scope.spawn(|| {
+                    let mut done = Vec::new();
+                    loop {
+                        let index = next.fetch_add(1, Ordering::Relaxed);
+                        let Some(item) = items.get(index) else {
+                            break;
+                        };
+                        let result = f(item);
+                        if result.is_err() {
+                            // no point starting the others
+                            next.store(items.len(), Ordering::Relaxed);
+                        }
+                        done.push((index, result));
+                    }
+                    done
+                })
+            })
+            .collect();
+        workers
+            .into_iter()
+            .flat_map(|worker| {
+                worker
+                    .join()
+                    .unwrap_or_else(|panic| std::panic::resume_unwind(panic))
+            })
+            .collect()
+    });
+    done.sort_unstable_by_key(|(index, _)| *index);
+
+    done.into_iter().map(|(_, result)| result).collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use anyhow::bail;
+
+    #[test]
+    fn test_results_keep_item_order() {
+        let items: Vec<usize> = (0..1000).collect();
+        for threads in [0, 1, 3, 8] {
+            let squares = parallel_map_ordered(&items, threads, |item| Ok(item * item)).unwrap();
+            assert_eq!(
+                squares,
+                items.iter().map(|item| item * item).collect::<Vec<_>>()
+            );
+        }
+    }
+
+    #[test]
+    fn test_first_failed_item_is_the_error() {
+        let items: Vec<usize> = (0..1000).collect();
+        for threads in [1, 8] {
+            let result = parallel_map_ordered(&items, threads, |item| {
+                if *item % 100 == 50 {
+                    bail!("item {} failed", item);
+                }
+                Ok(*item)
+            });
+            assert_eq!(result.unwrap_err().to_string(), "item 50 failed");
+        }
+    }
+}
@@ -1,65 +1,352 @@
 //! Load files and read them with DWARF
-use anyhow::{Context, Result};
-use gimli::{EndianRcSlice, RunTimeEndian};
-use object::{Object, ObjectSection};
-pub type DwarfReader = EndianRcSlice<RunTimeEndian>;
+use crate::parallel::parallel_map_ordered;
+use anyhow::{Context, Result, bail};
+use gimli::{Dwarf, DwarfPackage, DwarfPackageSections, DwarfSections, EndianSlice, RunTimeEndian};
+use object::{CompressedData, CompressionFormat, Object, ObjectSection};
+use std::borrow::Cow;
+use std::collections::HashMap;
+use std::path::{Path, PathBuf};
 
-pub fn load_file(path: &std::path::Path) -> Result<Vec<u8>> {
+pub type DwarfReader<'data> = EndianSlice<'data, RunTimeEndian>;
+
+/// raw bytes of an object file. files loaded from disk stay memory-mapped for
+/// as long as the analyzer lives, so sections are read straight out of the
+/// mapping instead of from a full copy of the binary.
+pub enum FileData {
+    Owned(Vec<u8>),
+    Mapped(memmap2::Mmap),
+}
+
+impl std::ops::Deref for FileData {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            FileData::Owned(data) => data,
+            FileData::Mapped(mmap) => mmap,
+        }
+    }
+}
+
+pub fn load_file(path: &Path) -> Result<FileData> {
     log::debug!("load file: {}", path.display());
 
     let file = std::fs::File::open(path)
         .with_context(|| format!("failed to open file: {}", path.display()))?;
 
+    // the mapping is only valid while nobody truncates the file underneath
+    // us. that is the same contract every debugger/objdump style tool relies
+    // on, and avoids paging the whole binary in before we parse anything.
     let mmap = unsafe { memmap2::Mmap::map(&file)? };
-    let data = mmap.to_vec();
 
-    log::debug!("file load success, size: {} bytes", data.len());
-    Ok(data)
+    log::debug!("file map success, size: {} bytes", mmap.len());
+    Ok(FileData::Mapped(mmap))
 }
 
-pub fn object_section_loader(
-    data: &[u8],
-) -> Result<impl Fn(gimli::SectionId) -> Result<DwarfReader>> {
+/// an id that changes whenever the binary is rebuilt: the ELF build-id note
+/// or the Mach-O `LC_UUID`. None when the binary carries neither.
+pub fn binary_id(data: &[u8]) -> Result<Option<Vec<u8>>> {
     let object_file = object::File::parse(data)?;
-    log::debug!("parse object file success");
-    let endianness = if object_file.is_little_endian() {
+
+    if let Some(build_id) = object_file.build_id()? {
+        return Ok(Some(build_id.to_vec()));
+    }
+    if let Some(uuid) = object_file.mach_uuid()? {
+        return Ok(Some(uuid.to_vec()));
+    }
+
+    Ok(None)
+}
+
+/// DWARF sections of one object file. sections stored uncompressed in the
+/// file borrow straight from the file data; only sections that actually need
+/// decompression get their own buffer.
+pub struct DebugSections<'data> {
+    sections: DwarfSections<Cow<'data, [u8]>>,
+    /// name accelerator tables, gimli's `Dwarf` does not carry these
+    debug_names: Cow<'data, [u8]>,
+    debug_pubnames: Cow<'data, [u8]>,
+    endian: RunTimeEndian,
+}
+
+impl<'data> DebugSections<'data> {
+    /// load the sections of `data`, decompressing compressed ones on up to
+    /// `threads` threads
+    pub fn load(data: &'data [u8], threads: usize) -> Result<Self> {
+        let object_file = object::File::parse(data)?;
+        log::debug!("parse object file success");
+
+        let debug_names = ".debug_names";
+        let debug_pubnames = gimli::SectionId::DebugPubNames.name();
+        let mut names = vec![debug_names, debug_pubnames];
+        DwarfSections::load(|id| -> Result<()> {
+            names.push(id.name());
+            Ok(())
+        })?;
+        let mut data = SectionData::load(&object_file, names, threads)?;
+
+        let sections = DwarfSections::load(|id| -> Result<_> { Ok(data.take(id.name())) })?;
+        Ok(Self {
+            sections,
+            debug_names: data.take(debug_names),
+            debug_pubnames: data.take(debug_pubnames),
+            endian: endian(&object_file),
+        })
+    }
+
+    /// load the `.dwo` sections of a split DWARF object. the result still
+    /// needs [`Dwarf::make_dwo`] with the skeleton's file.
+    pub fn load_dwo(data: &'data [u8]) -> Result<Self> {
+        let object_file = object::File::parse(data)?;
+        log::debug!("parse split DWARF object success");
+
+        // split units are loaded by the unit workers, one thread each
+        let mut data = SectionData::load_dwo(&object_file, |load| DwarfSections::load(load), 1)?;
+        let sections = DwarfSections::load(|id| -> Result<_> { Ok(data.take_dwo(id)) })?;
+        Ok(Self {
+            sections,
+            debug_names: Cow::Borrowed(&[]),
+            debug_pubnames: Cow::Borrowed(&[]),
+            endian: endian(&object_file),
+        })
+    }
+
+    /// a DWARF view over the sections. readers are plain slices, so they are
+    /// `Copy` and cheap to pass around.
+    pub fn dwarf(&self) -> Dwarf<DwarfReader<'_>> {
+        self.sections
+            .borrow(|section| EndianSlice::new(section, self.endian))
+    }
+
+    /// the `.debug_names` section, empty when absent
+    pub fn debug_names(&self) -> DwarfReader<'_> {
+        EndianSlice::new(&self.debug_names, self.endian)
+    }
+
+    /// the `.debug_pubnames` section, empty when absent
+    pub fn debug_pubnames(&self) -> DwarfReader<'_> {
+        EndianSlice::new(&self.debug_pubnames, self.endian)
+    }
+}
+
+/// sections of a DWARF package (`.dwp`), the split units of a whole binary
+pub struct PackageSections<'data> {
+    sections: DwarfPackageSections<Cow<'data, [u8]>>,
+    endian: RunTimeEndian,
+}
+
+impl<'data> PackageSections<'data> {
+    /// load the sections of `data`, decompressing compressed ones on up to
+    /// `threads` threads
+    pub fn load(data: &'data [u8], threads: usize) -> Result<Self> {
+        let object_file = object::File::parse(data)?;
+        log::debug!("parse DWARF package success");
+
+        let mut data = SectionData::load_dwo(
+            &object_file,
+            |load| DwarfPackageSections::load(load),
+            threads,
+        )?;
+        let sections = DwarfPackageSections::load(|id| -> Result<_> { Ok(data.take_dwo(id)) })?;
+        Ok(Self {
+            sections,
+            endian: endian(&object_file),
+        })
+    }
+
+    /// the package with its unit indices parsed. units are only decoded when
+    /// looked up.
+    pub fn package(&self) -> Result<DwarfPackage<DwarfReader<'_>>> {
+        Ok(self.sections.borrow(
+            |section| EndianSlice::new(section, self.endian),
+            EndianSlice::new(&[], self.endian),
+        )?)
+    }
+}
+
+fn endian(object_file: &object::File) -> RunTimeEndian {
+    if object_file.is_little_endian() {
         RunTimeEndian::Little
     } else {
         RunTimeEndian::Big
+    }
+}
+
+/// does the binary carry its own DWARF, or was it stripped?
+pub fn has_debug_info(data: &[u8]) -> Result<bool> {
+    let object_file = object::File::parse(data)?;
+    Ok(object_file
+        .section_by_name(gimli::SectionId::DebugInfo.name())
+        .is_some_and(|section| section.size() > 0))
+}
+
+/// default root of separate debug files on Linux distributions
+const DEBUG_ROOT: &str = "/usr/lib/debug";
+
+/// places the debug info of a stripped binary may live, most specific first:
+/// the build-id tree, the `.gnu_debuglink` file next to the binary, in its
+/// `.debug` directory or under the debug root, and a macOS dSYM bundle.
+pub fn debug_file_candidates(path: Option<&Path>, data: &[u8]) -> Result<Vec<PathBuf>> {
+    let object_file = object::File::parse(data)?;
+    let mut candidates = Vec::new();
+
+    if let Some(build_id) = object_file.build_id()?
+        && let [first, rest @ ..] = build_id
+        && !rest.is_empty()
+    {
+        let rest: String = rest.iter().map(|byte| format!("{:02x}", byte)).collect();
+        candidates.push(
+            Path::new(DEBUG_ROOT)
+                .join(".build-id")
+                .join(format!("{:02x}", first))
+                .join(format!("{}.debug", rest)),
+        );
+    }
+
+    let Some(path) = path else {
+        return Ok(candidates);
     };
+    let dir = path.parent().unwrap_or(Path::new(""));
+
+    if let Some((name, _crc)) = object_file.gnu_debuglink()? {
+        let name = Path::new(std::str::from_utf8(name)?);
+        candidates.push(dir.join(name));
+        candidates.push(dir.join(".debug").join(name));
+        if let Ok(dir) = dir.canonicalize() {
+            let relative = dir.strip_prefix("/").unwrap_or(&dir);
+            candidates.push(Path::new(DEBUG_ROOT).join(relative).join(name));
+        }
+    }
+
+    if let Some(file_name) = path.file_name() {
+        let mut bundle = path.as_os_str().to_owned();
+        bundle.push(".dSYM");
+        candidates.push(
+            PathBuf::from(bundle)
+                .join("Contents/Resources/DWARF")
+                .join(file_name),
+        );
+    }
 
-    let load_section = move |id: gimli::SectionId| -> Result<DwarfReader> {
-        let section_name = id.name();
-        let section_data = match object_file.section_by_name(section_name) {
-            Some(section) => {
-                log::debug!(
-                    "load section: {} (size: {} bytes)",
-                    section_name,
-                    section.size()
-                );
-                match section.uncompressed_data() {
-                    Ok(data) => data,
-                    // could not decompress
-                    Err(_) => {
-                        log::warn!("decompress section fail, section: {}", section_name);
-                        std::borrow::Cow::Borrowed(&[][..])
-                    }
-                }
+    // a debuglink may name the binary itself
+    candidates.retain(|candidate| candidate != path);
+    Ok(candidates)
+}
+
+/// the contents of some sections of an object file, by name. gimli asks for
+/// its sections one at a time; collecting the names first lets every
+/// compressed section be inflated at once instead of one after the other.
+struct SectionData<'data> {
+    sections: HashMap<&'static str, Cow<'data, [u8]>>,
+}
+
+impl<'data> SectionData<'data> {
+    /// read the sections `names`. those that are compressed are decompressed
+    /// on up to `threads` threads, largest first. a section that is missing
+    /// is empty, one that fails to decompress is an error.
+    fn load(
+        object_file: &object::File<'data>,
+        names: Vec<&'static str>,
+        threads: usize,
+    ) -> Result<Self> {
+        let mut sections = HashMap::with_capacity(names.len());
+        let mut compressed = Vec::new();
+        for name in names {
+            if sections.contains_key(name) {
+                continue;
             }
-            // name does not exist
-            None => {
-                log::debug!("section not found: {}", section_name);
-                std::borrow::Cow::Borrowed(&[][..])
+            let Some(section) = object_file.section_by_name(name) else {
+                log::debug!("section not found: {}", name);
+                sections.insert(name, Cow::Borrowed(&[][..]));
+                continue;
+            };
+            log::debug!("load section: {} (size: {} bytes)", name, section.size());
+            let data = section
+                .compressed_data()
+                .with_context(|| format!("failed to read section {}", name))?;
+            if data.format == CompressionFormat::None {
+                sections.insert(name, Cow::Borrowed(data.data));
+            } else {
+                compressed.push((name, data));
             }
-        };
+        }
 
-        // copies out of section data
-        let owned_data = section_data.into_owned();
-        let rc_data = std::rc::Rc::from(owned_data);
-        let reader = EndianRcSlice::new(rc_data, endianness);
+        compressed.sort_unstable_by_key(|(_, data)| std::cmp::Reverse(data.uncompressed_size));
+        for (name, data) in decompress_all(&compressed, threads)? {
+            log::debug!("decompressed section: {} ({} bytes)", name, data.len());
+            sections.insert(name, Cow::Owned(data));
+        }
+        Ok(Self { sections })
+    }
 
-        Ok(reader)
-    };
+    /// read the `.dwo` sections that `load` asks for, e.g.
+    /// [`DwarfSections::load`]
+    fn load_dwo<T>(
+        object_file: &object::File<'data>,
+        load: impl FnOnce(&mut dyn FnMut(gimli::SectionId) -> Result<()>) -> Result<T>,
+        threads: usize,
+    ) -> Result<Self> {
+        let mut names = Vec::new();
+        load(&mut |id| {
+            // some sections never live in a split object
+            names.extend(id.dwo_name());
+            Ok(())
+        })?;
+        Self::load(object_file, names, threads)
+    }
+
+    /// the contents of `name`, empty when it was missing or already taken
+    fn take(&mut self, name: &str) -> Cow<'data, [u8]> {
+        self.sections.remove(name).unwrap_or(Cow::Borrowed(&[][..]))
+    }
+
+    fn take_dwo(&mut self, id: gimli::SectionId) -> Cow<'data, [u8]> {
+        id.dwo_name()
+            .map_or(Cow::Borrowed(&[][..]), |name| self.take(name))
+    }
+}
+
+/// decompress `sections` on up to `threads` scoped threads. the first error
+/// stops the others from starting another section.
+fn decompress_all(
+    sections: &[(&'static str, CompressedData<'_>)],
+    threads: usize,
+) -> Result<Vec<(&'static str, Vec<u8>)>> {
+    parallel_map_ordered(sections, threads, |(name, data)| {
+        let data =
+            inflate(data).with_context(|| format!("failed to decompress section {}", name))?;
+        Ok((*name, data))
+    })
+}
+
+/// the contents of a compressed section. object stops inflating a zlib
+/// stream once it has the uncompressed size and never checks the Adler-32
+/// checksum that ends it, so a damaged stream could read as other debug info
+fn inflate(data: &CompressedData<'_>) -> Result<Vec<u8>> {
+    let inflated = data.decompress()?.into_owned();
+    if data.format == CompressionFormat::Zlib {
+        let checksum = data
+            .data
+            .last_chunk()
+            .map(|&bytes| u32::from_be_bytes(bytes));
+        if checksum != Some(adler32(&inflated)) {
+            bail!("zlib checksum mismatch");
+        }
+    }
+    Ok(inflated)
+}
 
-    Ok(load_section)
+fn adler32(data: &[u8]) -> u32 {
+    const MOD: u32 = 65521;
+    let (mut a, mut b) = (1u32, 0u32);
+    // the most bytes before b can overflow
+    for chunk in data.chunks(5552) {
+        for &byte in chunk {
+            a += u32::from(byte);
+            b += a;
+        }
+        a %= MOD;
+        b %= MOD;
+    }
+    (b << 16) | a
 }
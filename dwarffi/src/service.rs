@@ -0,0 +1,140 @@
+//! analyses kept in memory across queries, for tools that ask about the same
+//! libraries over and over.
+//!
+//! the first query for a library analyzes it. later queries get the same
+//! result back as long as the file did not change: each one compares the
+//! file's size and modification time with the ones it had when it was
+//! analyzed, and a changed file is analyzed again. a separate debug file
+//! that changes on its own is not noticed.
+
+use crate::cache::AnalysisCache;
+use crate::dwarf_analyzer::{AnalysisOptions, DwarfAnalyzer};
+use crate::stats::AnalysisStats;
+use crate::type_registry::TypeRegistry;
+use crate::types::FunctionSignature;
+use anyhow::{Context, Result};
+use std::collections::HashMap;
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Mutex, MutexGuard, PoisonError};
+use std::time::SystemTime;
+
+/// what a library file looked like when it was analyzed
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct FileStamp {
+    len: u64,
+    modified: Option<SystemTime>,
+}
+
+impl FileStamp {
+    fn of(path: &Path) -> Result<Self> {
+        let metadata = std::fs::metadata(path)
+            .with_context(|| format!("failed to read library: {}", path.display()))?;
+        Ok(Self {
+            len: metadata.len(),
+            modified: metadata.modified().ok(),
+        })
+    }
+}
+
+/// one analyzed library of an [`AnalysisService`]
+pub struct LoadedLibrary {
+    pub path: PathBuf,
+    /// in name order
+    pub signatures: Vec<FunctionSignature>,
+    pub type_registry: TypeRegistry,
+    /// the run that analyzed the library
+    pub stats: AnalysisStats,
+    stamp: FileStamp,
+}
+
+impl LoadedLibrary {
+    pub fn signature(&self, name: &str) -> Option<&FunctionSignature> {
+        self.signatures
+            .binary_search_by(|sig| sig.name.as_str().cmp(name))
+            .ok()
+            .map(|i| &self.signatures[i])
+    }
+
+    /// a registry of the types the function `name` refers to, directly or
+    /// through other types
+    pub fn type_closure(&self, name: &str) -> Option<TypeRegistry> {
+        let signature = self.signature(name)?;
+        Some(self.type_registry.closure(signature.type_ids()))
+    }
+}
+
+/// analyses of libraries, kept until their file changes
+pub struct AnalysisService {
+    options: AnalysisOptions,
+    cache: Option<AnalysisCache>,
+    libraries: Mutex<HashMap<PathBuf, Arc<LoadedLibrary>>>,
+}
+
+impl AnalysisService {
+    /// every library is analyzed with `options`
+    pub fn new(options: AnalysisOptions) -> Self {
+        Self {
+            options,
+            cache: None,
+            libraries: Mutex::default(),
+        }
+    }
+
+    /// look libraries up in `cache` before analyzing them, and store them in
+    /// it after
+    pub fn with_cache(mut self, cache: AnalysisCache) -> Self {
+        self.cache = Some(cache);
+        self
+    }
+
+    /// the analysis of the library at `path`, from memory unless the file
+    /// changed since it was analyzed. two queries that miss on the same
+    /// library at once both analyze it, and the later one is kept
+    pub fn library(&self, path: &Path) -> Result<Arc<LoadedLibrary>> {
+        let path = std::fs::canonicalize(path)
+            .with_context(|| format!("failed to read library: {}", path.display()))?;
+        let stamp = FileStamp::of(&path)?;
+        if let Some(library) = self.lock().get(&path)
+            && library.stamp == stamp
+        {
+            return Ok(library.clone());
+        }
+
+        log::info!("analyzing {}", path.display());
+        let analyzer = DwarfAnalyzer::from_file(&path)?;
+        let result = match &self.cache {
+            Some(cache) => analyzer.extract_analysis_cached(&self.options, cache)?,
+            None => analyzer.extract_analysis_with(&self.options)?,
+        };
+        let mut signatures = result.signatures;
+        signatures.sort_by(|a, b| a.name.cmp(&b.name));
+        let library = Arc::new(LoadedLibrary {
+            path: path.clone(),
+            signatures,
+            type_registry: result.type_registry,
+            stats: result.stats,
+            stamp,
+        });
+        self.lock().insert(path, library.clone());
+        Ok(library)
+    }
+
+    /// drop the analysis of `path`, returns whether there was one
+    pub fn invalidate(&self, path: &Path) -> bool {
+        let path = std::fs::canonicalize(path).unwrap_or_else(|_| path.to_path_buf());
+        self.lock().remove(&path).is_some()
+    }
+
+    /// the libraries in memory
+    pub fn loaded(&self) -> Vec<PathBuf> {
+        let mut paths: Vec<PathBuf> = self.lock().keys().cloned().collect();
+        paths.sort();
+        paths
+    }
+
+    fn lock(&self) -> MutexGuard<'_, HashMap<PathBuf, Arc<LoadedLibrary>>> {
+        self.libraries
+            .lock()
+            .unwrap_or_else(PoisonError::into_inner)
+    }
+}
@@ -0,0 +1,190 @@
+//! analysis within a memory budget.
+//!
+//! an analysis normally keeps every signature and every type in memory until
+//! the output is written. with a [`MemoryBudget`] the registry keeps only the
+//! types used most recently in memory and writes the others to a spill file,
+//! keyed by their content-addressed id, and the signatures are written to a
+//! second file as each unit finishes. what stays in memory is an index: the
+//! position of each record on disk, and the name of each function.
+//!
+//! spill files are scratch space for one run. they are created in the
+//! budget's directory and removed when the analysis is dropped.
+
+use crate::types::FunctionSignature;
+use anyhow::{Context, Result};
+use serde::Serialize;
+use serde::de::DeserializeOwned;
+use std::fs::File;
+use std::io::{Read, Seek, SeekFrom, Write};
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Mutex, PoisonError};
+
+/// how much memory the types of an analysis may take, and where the rest
+/// goes
+#[derive(Debug, Clone)]
+pub struct MemoryBudget {
+    /// bytes of types kept in memory, counted as their encoded size. the
+    /// DIEs of the units being analyzed come on top
+    pub bytes: usize,
+    /// directory of the spill files
+    pub dir: PathBuf,
+}
+
+impl MemoryBudget {
+    pub fn new(bytes: usize, dir: impl Into<PathBuf>) -> Self {
+        Self {
+            bytes,
+            dir: dir.into(),
+        }
+    }
+}
+
+/// where a record is in a [`SpillFile`]
+#[derive(Debug, Clone, Copy)]
+pub(crate) struct Record {
+    offset: u64,
+    len: u32,
+}
+
+/// append-only file of bincode records, removed when dropped
+pub(crate) struct SpillFile {
+    path: PathBuf,
+    file: Mutex<(File, u64)>,
+}
+
+impl SpillFile {
+    /// a new file in `budget`'s directory, `kind` is part of its name
+    pub fn create(budget: &MemoryBudget, kind: &str) -> Result<Self> {
+        // several analyses of one process may spill at once
+        static NEXT_FILE: AtomicUsize = AtomicUsize::new(0);
+        let path = budget.dir.join(format!(
+            "dwarffi-{}-{}.{}",
+            std::process::id(),
+            NEXT_FILE.fetch_add(1, Ordering::Relaxed),
+            kind
+        ));
+        let file = File::options()
+            .read(true)
+            .write(true)
+            .create_new(true)
+            .open(&path)
+            .with_context(|| format!("failed to create spill file: {}", path.display()))?;
+        log::debug!("spilling {} to {}", kind, path.display());
+        Ok(Self {
+            path,
+            file: Mutex::new((file, 0)),
+        })
+    }
+
+    pub fn append<T: Serialize>(&self, value: &T) -> Result<Record> {
+        let data = bincode::serialize(value)?;
+        let mut file = self.file.lock().unwrap_or_else(PoisonError::into_inner);
+        let (file, end) = &mut *file;
+        file.seek(SeekFrom::Start(*end))?;
+        file.write_all(&data)
+            .with_context(|| format!("failed to write spill file: {}", self.path.display()))?;
+        let record = Record {
+            offset: *end,
+            len: u32::try_from(data.len())?,
+        };
+        *end += data.len() as u64;
+        Ok(record)
+    }
+
+    pub fn read<T: DeserializeOwned>(&self, record: Record) -> Result<T> {
+        let mut data = vec![0; record.len as usize];
+        {
+            let mut file = self.file.lock().unwrap_or_else(PoisonError::into_inner);
+            let (file, _) = &mut *file;
+            file.seek(SeekFrom::Start(record.offset))?;
+            file.read_exact(&mut data)
+                .with_context(|| format!("failed to read spill file: {}", self.path.display()))?;
+        }
+        Ok(bincode::deserialize(&data)?)
+    }
+}
+
+impl Drop for SpillFile {
+    fn drop(&mut self) {
+        if let Err(e) = std::fs::remove_file(&self.path) {
+            log::warn!("failed to remove spill file {}: {}", self.path.display(), e);
+        }
+    }
+}
+
+/// the signatures of an analysis within a memory budget, on disk. only
+/// their names are kept in memory
+pub struct SignatureSpool {
+    file: SpillFile,
+    records: Vec<(String, Record)>,
+}
+
+impl SignatureSpool {
+    pub(crate) fn create(budget: &MemoryBudget) -> Result<Self> {
+        Ok(Self {
+            file: SpillFile::create(budget, "signatures")?,
+            records: Vec::new(),
+        })
+    }
+
+    pub(crate) fn push(&mut self, signature: &FunctionSignature) -> Result<()> {
+        let record = self.file.append(signature)?;
+        self.records.push((signature.name.clone(), record));
+        Ok(())
+    }
+
+    pub fn len(&self) -> usize {
+        self.records.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.records.is_empty()
+    }
+
+    /// the signatures in name order from now on, instead of unit order
+    pub fn sort_by_name(&mut self) {
+        self.records.sort_by(|(a, _), (b, _)| a.cmp(b));
+    }
+
+    /// read the signatures back, one at a time
+    pub fn iter(&self) -> impl Iterator<Item = Result<FunctionSignature>> + '_ {
+        self.records
+            .iter()
+            .map(|(_, record)| self.file.read(*record))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::type_registry::TypeId;
+
+    fn signature(name: &str) -> FunctionSignature {
+        FunctionSignature {
+            name: name.to_string(),
+            return_type_id: TypeId(1),
+            parameters: Vec::new(),
+            is_variadic: false,
+            is_exported: true,
+        }
+    }
+
+    #[test]
+    fn test_spool_reads_back_in_name_order() {
+        let budget = MemoryBudget::new(0, std::env::temp_dir());
+        let mut spool = SignatureSpool::create(&budget).unwrap();
+        for name in ["b", "c", "a"] {
+            spool.push(&signature(name)).unwrap();
+        }
+        spool.sort_by_name();
+
+        let names: Vec<String> = spool.iter().map(|sig| sig.unwrap().name).collect();
+        assert_eq!(names, ["a", "b", "c"]);
+
+        let path = spool.file.path.clone();
+        assert!(path.exists());
+        drop(spool);
+        assert!(!path.exists());
+    }
+}
@@ -0,0 +1,111 @@
+//! split DWARF: skeleton units in the binary point at their full units in a
+//! `.dwo` file per object, or in one `.dwp` package next to the binary.
+//!
+//! split units are loaded lazily, when their skeleton is analyzed, so units
+//! the name index rules out never have their object opened.
+
+use crate::reader::DwarfReader;
+use anyhow::{Result, anyhow};
+use gimli::{DebugLineOffset, Dwarf, DwarfPackage, Reader, Section, Unit, UnitType};
+use std::path::{Path, PathBuf};
+
+/// where the split units of one binary can be found
+pub struct SplitSources<'a, 'data> {
+    /// the `<binary>.dwp` package, when there is one
+    pub package: Option<&'a DwarfPackage<DwarfReader<'data>>>,
+    /// directory of the binary, searched when a `.dwo` is not at the path
+    /// recorded at compile time
+    pub binary_dir: Option<&'a Path>,
+}
+
+/// the package of a binary at `path`, by the usual `<binary>.dwp` naming
+pub fn package_path(path: &Path) -> PathBuf {
+    let mut package = path.as_os_str().to_owned();
+    package.push(".dwp");
+    PathBuf::from(package)
+}
+
+/// the `.dwo` file a skeleton unit points at. the recorded name is relative
+/// to the unit's compilation directory; when that does not exist (the build
+/// tree moved) the file name is looked up next to the binary.
+pub fn dwo_path(
+    dwarf: &Dwarf<DwarfReader<'_>>,
+    skeleton: &Unit<DwarfReader<'_>>,
+    binary_dir: Option<&Path>,
+) -> Result<Option<PathBuf>> {
+    let Some(name) = skeleton.dwo_name()? else {
+        return Ok(None);
+    };
+    let name = dwarf.attr_string(skeleton, name)?;
+    let name = PathBuf::from(name.to_string_lossy().as_ref());
+
+    let recorded = match &skeleton.comp_dir {
+        Some(comp_dir) => Path::new(comp_dir.to_string_lossy().as_ref()).join(&name),
+        None => name.clone(),
+    };
+    if recorded.is_file() {
+        return Ok(Some(recorded));
+    }
+
+    let beside_binary = binary_dir
+        .zip(name.file_name())
+        .map(|(dir, file_name)| dir.join(file_name))
+        .filter(|path| path.is_file());
+    Ok(beside_binary.or(Some(recorded)))
+}
+
+/// turn the sections of a split object into a `Dwarf` that reads through the
+/// skeleton's file for addresses and line strings
+pub fn adopt_parent<'a>(split: &mut Dwarf<DwarfReader<'a>>, parent: &Dwarf<DwarfReader<'a>>) {
+    split.make_dwo(parent);
+    // file names of the skeleton's line table, read when the split object
+    // has none of its own, live in the parent
+    split.debug_line_str = parent.debug_line_str;
+}
+
+/// the full unit of `skeleton` in `split`, with the attributes only the
+/// skeleton carries copied over
+pub fn split_unit<'a>(
+    split: &Dwarf<DwarfReader<'a>>,
+    skeleton: &Unit<DwarfReader<'a>>,
+) -> Result<Unit<DwarfReader<'a>>> {
+    // a .dwo may also hold type units, pick the compilation unit
+    let mut headers = split.units();
+    let mut unit = loop {
+        let header = headers
+            .next()?
+            .ok_or_else(|| anyhow!("split DWARF object has no matching unit"))?;
+        if matches!(
+            header.type_(),
+            UnitType::Type { .. } | UnitType::SplitType { .. }
+        ) {
+            continue;
+        }
+        let unit = split.unit(header)?;
+        if unit.dwo_id == skeleton.dwo_id {
+            break unit;
+        }
+    };
+
+    unit.copy_relocated_attributes(skeleton);
+    if unit.comp_dir.is_none() {
+        unit.comp_dir = skeleton.comp_dir;
+    }
+    // decl_file indices of a split unit refer to the file table of its own
+    // .debug_line.dwo, whose directories are in another order than the
+    // skeleton's. a split unit has no DW_AT_stmt_list, its table is the one
+    // at the start of the section (of its contribution, in a package)
+    if unit.line_program.is_none() {
+        unit.line_program = if split.debug_line.reader().is_empty() {
+            skeleton.line_program.clone()
+        } else {
+            Some(split.debug_line.program(
+                DebugLineOffset(0),
+                unit.header.address_size(),
+                unit.comp_dir,
+                unit.name,
+            )?)
+        };
+    }
+    Ok(unit)
+}
@@ -0,0 +1,169 @@
+//! small, fast hasher whose output is stable across runs and platforms.
+//! used for content-addressed type ids, where the std `DefaultHasher` gives
+//! no stability guarantee and SipHash is more than we need.
+
+use std::hash::Hasher;
+
+const SEED: u64 = 0x243f_6a88_85a3_08d3;
+const MULTIPLIER: u64 = 0x9e37_79b9_7f4a_7c15;
+const FINISH: u64 = 0xa076_1d64_78bd_642f;
+
+/// multiply into 128 bits and fold the halves back together
+#[inline]
+fn folded_multiply(a: u64, b: u64) -> u64 {
+    let full = (a as u128).wrapping_mul(b as u128);
+    (full as u64) ^ ((full >> 64) as u64)
+}
+
+/// streaming hasher over little-endian 64-bit words. integers are always
+/// hashed as `u64`, so `usize` fields hash the same on 32 and 64 bit hosts.
+#[derive(Debug, Clone)]
+pub struct StableHasher {
+    state: u64,
+}
+
+impl StableHasher {
+    pub fn new() -> Self {
+        Self { state: SEED }
+    }
+
+    /// hash a string with its length, so adjacent strings can't run together
+    pub fn write_str(&mut self, s: &str) {
+        self.write_u64(s.len() as u64);
+        self.write(s.as_bytes());
+    }
+}
+
+impl Default for StableHasher {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Hasher for StableHasher {
+    fn write(&mut self, bytes: &[u8]) {
+        let mut chunks = bytes.chunks_exact(8);
+        for chunk in &mut chunks {
+            self.write_u64(u64::from_le_bytes(chunk.try_into().unwrap()));
+        }
+
+        let rest = chunks.remainder();
+        if !rest.is_empty() {
+            let mut word = [0u8; 8];
+            word[..rest.len()].copy_from_slice(rest);
+            self.write_u64(u64::from_le_bytes(word));
+        }
+    }
+
+    #[inline]
+    fn write_u8(&mut self, i: u8) {
+        self.write_u64(i as u64);
+    }
+
+    #[inline]
+    fn write_u32(&mut self, i: u32) {
+        self.write_u64(i as u64);
+    }
+
+    #[inline]
+    fn write_u64(&mut self, i: u64) {
+        self.state = folded_multiply(self.state ^ i, MULTIPLIER);
+    }
+
+    #[inline]
+    fn write_usize(&mut self, i: usize) {
+        self.write_u64(i as u64);
+    }
+
+    #[inline]
+    fn write_i64(&mut self, i: i64) {
+        self.write_u64(i as u64);
+    }
+
+    #[inline]
+    fn finish(&self) -> u64 {
+        folded_multiply(self.state, FINISH)
+    }
+}
+
+/// hasher for keys that already are well mixed hashes, such as type ids.
+/// one multiply instead of a full hash: the keys of a map may share bits, as
+/// the ids of one registry shard share their low ones, and a hash table takes
+/// the bucket from the low bits of the hash and a tag from the high ones.
+#[derive(Debug, Clone, Default)]
+pub struct IdHasher {
+    value: u64,
+}
+
+impl Hasher for IdHasher {
+    fn write(&mut self, bytes: &[u8]) {
+        // only reached for keys that are not a single u64, mix them properly
+        let mut hasher = StableHasher { state: self.value };
+        hasher.write(bytes);
+        self.value = hasher.finish();
+    }
+
+    #[inline]
+    fn write_u64(&mut self, i: u64) {
+        self.value = i;
+    }
+
+    #[inline]
+    fn finish(&self) -> u64 {
+        folded_multiply(self.value, MULTIPLIER)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn hash_words(words: &[u64]) -> u64 {
+        let mut hasher = StableHasher::new();
+        for word in words {
+            hasher.write_u64(*word);
+        }
+        hasher.finish()
+    }
+
+    #[test]
+    fn test_known_value_is_stable() {
+        // ids end up in caches and generated output, they must never change
+        // silently between builds
+        let mut hasher = StableHasher::new();
+        hasher.write_str("Point");
+        hasher.write_usize(8);
+        assert_eq!(hasher.finish(), 0x4cba_8ed8_0ed7_f635);
+    }
+
+    #[test]
+    fn test_ids_sharing_low_bits_spread_over_buckets() {
+        use std::collections::HashSet;
+        use std::hash::{BuildHasher, BuildHasherDefault};
+
+        // the ids of one of 64 shards
+        let build = BuildHasherDefault::<IdHasher>::default();
+        let hashes: Vec<u64> = (0..4096u64)
+            .map(|i| build.hash_one(hash_words(&[i]) << 6 | 5))
+            .collect();
+        let buckets: HashSet<u64> = hashes.iter().map(|hash| hash & 4095).collect();
+        let tags: HashSet<u64> = hashes.iter().map(|hash| hash >> 57).collect();
+        // 4096 random values into 4096 buckets fill about 63% of them
+        assert!(buckets.len() > 2400, "{} buckets", buckets.len());
+        assert_eq!(tags.len(), 128);
+    }
+
+    #[test]
+    fn test_order_and_length_sensitive() {
+        assert_ne!(hash_words(&[1, 2]), hash_words(&[2, 1]));
+        assert_ne!(hash_words(&[0]), hash_words(&[0, 0]));
+
+        let mut ab = StableHasher::new();
+        ab.write_str("ab");
+        ab.write_str("c");
+        let mut a = StableHasher::new();
+        a.write_str("a");
+        a.write_str("bc");
+        assert_ne!(ab.finish(), a.finish());
+    }
+}
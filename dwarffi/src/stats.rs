@@ -0,0 +1,206 @@
+//! where the time of an analysis went, and how much work it did.
+//!
+//! phases that run once are wall time. work done per compilation unit is
+//! summed over all units, so with several threads it adds up to more than
+//! the wall time of the analysis.
+
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::time::Duration;
+
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct AnalysisStats {
+    /// the whole analysis, wall time
+    pub total: Duration,
+    /// finding and mapping a separate debug file and split DWARF package
+    pub load: Duration,
+    /// reading the DWARF sections, decompressing those that are compressed
+    pub sections: Duration,
+    /// reading the exported symbol table
+    pub symbols: Duration,
+    /// unit headers and name accelerator tables
+    pub index: Duration,
+    /// decoding the DIEs of every unit (and fingerprinting them for the unit
+    /// cache), summed over units
+    pub die_walk: Duration,
+    /// finding functions and resolving their types, summed over units
+    pub type_resolution: Duration,
+    /// flattening the shared registry into the result
+    pub merge: Duration,
+
+    /// the result came from the whole binary cache, nothing was analyzed
+    pub cache_hit: bool,
+    /// compilation units in the binary
+    pub units: usize,
+    /// units the name index ruled out without decoding them
+    pub units_skipped: usize,
+    /// units whose signatures came from the unit cache
+    pub units_cached: usize,
+    /// type units decoded. each is decoded once, however many units refer
+    /// to its type
+    pub type_units: usize,
+    /// DIEs decoded
+    pub dies: usize,
+    /// functions found
+    pub functions: usize,
+    /// type references resolved, and how many of them found the DIE already
+    /// resolved in the same unit
+    pub type_lookups: usize,
+    pub type_lookup_hits: usize,
+    /// types looked up by shape, and how many reused another unit's resolution
+    pub decl_lookups: usize,
+    pub decl_hits: usize,
+    /// types handed to the registry, and how many of those it already had
+    pub types_registered: usize,
+    pub types_deduplicated: usize,
+    /// distinct types in the registry at the end. types are never removed,
+    /// so this is also its peak size
+    pub registry_types: usize,
+    /// types written to disk to stay within a memory budget
+    pub types_spilled: usize,
+}
+
+impl AnalysisStats {
+    /// every timed phase, by name, in the order they run
+    pub fn phases(&self) -> [(&'static str, Duration); 8] {
+        [
+            ("load", self.load),
+            ("sections", self.sections),
+            ("symbols", self.symbols),
+            ("index", self.index),
+            ("die_walk", self.die_walk),
+            ("type_resolution", self.type_resolution),
+            ("merge", self.merge),
+            ("total", self.total),
+        ]
+    }
+
+    /// every counter, by name
+    pub fn counters(&self) -> [(&'static str, usize); 15] {
+        [
+            ("cache_hit", usize::from(self.cache_hit)),
+            ("units", self.units),
+            ("units_skipped", self.units_skipped),
+            ("units_cached", self.units_cached),
+            ("type_units", self.type_units),
+            ("dies", self.dies),
+            ("functions", self.functions),
+            ("type_lookups", self.type_lookups),
+            ("type_lookup_hits", self.type_lookup_hits),
+            ("decl_lookups", self.decl_lookups),
+            ("decl_hits", self.decl_hits),
+            ("types_registered", self.types_registered),
+            ("types_deduplicated", self.types_deduplicated),
+            ("registry_types", self.registry_types),
+            ("types_spilled", self.types_spilled),
+        ]
+    }
+}
+
+/// totals of several analyses, e.g. the libraries of a batch. every field
+/// is added, `cache_hit` holds when any of them hit
+impl std::ops::AddAssign<&AnalysisStats> for AnalysisStats {
+    fn add_assign(&mut self, other: &AnalysisStats) {
+        self.total += other.total;
+        self.load += other.load;
+        self.sections += other.sections;
+        self.symbols += other.symbols;
+        self.index += other.index;
+        self.die_walk += other.die_walk;
+        self.type_resolution += other.type_resolution;
+        self.merge += other.merge;
+        self.cache_hit |= other.cache_hit;
+        self.units += other.units;
+        self.units_skipped += other.units_skipped;
+        self.units_cached += other.units_cached;
+        self.type_units += other.type_units;
+        self.dies += other.dies;
+        self.functions += other.functions;
+        self.type_lookups += other.type_lookups;
+        self.type_lookup_hits += other.type_lookup_hits;
+        self.decl_lookups += other.decl_lookups;
+        self.decl_hits += other.decl_hits;
+        self.types_registered += other.types_registered;
+        self.types_deduplicated += other.types_deduplicated;
+        self.registry_types += other.registry_types;
+        self.types_spilled += other.types_spilled;
+    }
+}
+
+/// what a type resolver did in one unit
+#[derive(Debug, Clone, Copy, Default)]
+pub(crate) struct ResolverStats {
+    pub type_lookups: usize,
+    pub type_lookup_hits: usize,
+    pub decl_lookups: usize,
+    pub decl_hits: usize,
+    pub types_registered: usize,
+}
+
+/// the work of a resolver for a type unit, done on behalf of another
+impl std::ops::AddAssign for ResolverStats {
+    fn add_assign(&mut self, other: ResolverStats) {
+        self.type_lookups += other.type_lookups;
+        self.type_lookup_hits += other.type_lookup_hits;
+        self.decl_lookups += other.decl_lookups;
+        self.decl_hits += other.decl_hits;
+        self.types_registered += other.types_registered;
+    }
+}
+
+/// per unit stats, added up from every worker thread. each unit adds its
+/// numbers once when it is done.
+#[derive(Default)]
+pub(crate) struct UnitCounters {
+    units_cached: AtomicUsize,
+    dies: AtomicUsize,
+    die_walk_nanos: AtomicU64,
+    type_resolution_nanos: AtomicU64,
+    type_lookups: AtomicUsize,
+    type_lookup_hits: AtomicUsize,
+    decl_lookups: AtomicUsize,
+    decl_hits: AtomicUsize,
+    types_registered: AtomicUsize,
+}
+
+impl UnitCounters {
+    pub fn add_walk(&self, dies: usize, elapsed: Duration) {
+        self.dies.fetch_add(dies, Ordering::Relaxed);
+        self.die_walk_nanos
+            .fetch_add(elapsed.as_nanos() as u64, Ordering::Relaxed);
+    }
+
+    pub fn add_cached(&self, types: usize) {
+        self.units_cached.fetch_add(1, Ordering::Relaxed);
+        self.types_registered.fetch_add(types, Ordering::Relaxed);
+    }
+
+    pub fn add_resolution(&self, resolver: &ResolverStats, elapsed: Duration) {
+        self.type_resolution_nanos
+            .fetch_add(elapsed.as_nanos() as u64, Ordering::Relaxed);
+        self.type_lookups
+            .fetch_add(resolver.type_lookups, Ordering::Relaxed);
+        self.type_lookup_hits
+            .fetch_add(resolver.type_lookup_hits, Ordering::Relaxed);
+        self.decl_lookups
+            .fetch_add(resolver.decl_lookups, Ordering::Relaxed);
+        self.decl_hits
+            .fetch_add(resolver.decl_hits, Ordering::Relaxed);
+        self.types_registered
+            .fetch_add(resolver.types_registered, Ordering::Relaxed);
+    }
+
+    /// add the numbers collected so far to `stats`
+    pub fn add_to(&self, stats: &mut AnalysisStats) {
+        let load = |counter: &AtomicUsize| counter.load(Ordering::Relaxed);
+        let nanos = |counter: &AtomicU64| Duration::from_nanos(counter.load(Ordering::Relaxed));
+        stats.units_cached += load(&self.units_cached);
+        stats.dies += load(&self.dies);
+        stats.die_walk += nanos(&self.die_walk_nanos);
+        stats.type_resolution += nanos(&self.type_resolution_nanos);
+        stats.type_lookups += load(&self.type_lookups);
+        stats.type_lookup_hits += load(&self.type_lookup_hits);
+        stats.decl_lookups += load(&self.decl_lookups);
+        stats.decl_hits += load(&self.decl_hits);
+        stats.types_registered += load(&self.types_registered);
+    }
+}
@@ -1,3 +1,4 @@
+use crate::filter::FunctionFilter;
 use anyhow::{Context, Result};
 use object::{Object, ObjectSymbol};
 use std::collections::HashSet;
@@ -18,7 +19,19 @@ impl<'data> SymbolReader<'data> {
 
     /// get unique symbol names
     pub fn get_exported_symbols(&self) -> Result<HashSet<String>> {
-        let mut symbols = HashSet::new();
+        Ok(self
+            .exported_symbols(&FunctionFilter::default())?
+            .symbols
+            .iter()
+            .map(|name| name.to_string())
+            .collect())
+    }
+
+    /// exported function symbols that pass `filter`, borrowed from the
+    /// symbol string table
+    pub fn exported_symbols(&self, filter: &FunctionFilter) -> Result<ExportedSymbols<'data>> {
+        // (name, address) of every exported function symbol
+        let mut symbols = Vec::new();
 
         log::debug!("check dynamic symbols");
         let mut dynamic_count = 0;
@@ -30,7 +43,7 @@ impl<'data> SymbolReader<'data> {
                 && let Ok(name) = symbol.name()
             {
                 log::trace!("symbol: {}", name);
-                symbols.insert(name.to_string());
+                symbols.push((name, symbol.address()));
             }
         }
 
@@ -53,7 +66,7 @@ impl<'data> SymbolReader<'data> {
                         && let Ok(name) = symbol.name()
                     {
                         log::trace!("regular symbol: {}", name);
-                        symbols.insert(name.to_string());
+                        symbols.push((name, symbol.address()));
                     }
                 }
             }
@@ -66,6 +79,134 @@ impl<'data> SymbolReader<'data> {
         }
 
         log::info!("total exported function symbols found: {}", symbols.len());
-        Ok(symbols)
+        if !filter.is_empty() {
+            // filter on the C name, not the symbol macOS prefixes with `_`
+            symbols.retain(|(name, _)| {
+                filter.matches(name) || name.strip_prefix('_').is_some_and(|c| filter.matches(c))
+            });
+            log::info!("function symbols kept by filter: {}", symbols.len());
+        }
+
+        let names = symbols.iter().map(|&(name, _)| name).collect();
+        // addresses of relocatable objects are section offsets, not the ones
+        // their DWARF uses
+        let addresses = if self.object_file.kind() == object::ObjectKind::Relocatable {
+            Vec::new()
+        } else {
+            let macho = self.object_file.format() == object::BinaryFormat::MachO;
+            // the low bit of an ARM symbol only marks Thumb code
+            let mask = if self.object_file.architecture() == object::Architecture::Arm {
+                !1
+            } else {
+                !0
+            };
+            symbols
+                .iter()
+                .map(|&(name, address)| {
+                    let name = if macho {
+                        name.strip_prefix('_').unwrap_or(name)
+                    } else {
+                        name
+                    };
+                    (address & mask, name)
+                })
+                .collect()
+        };
+        Ok(ExportedSymbols::new(names, addresses))
+    }
+}
+
+/// exported symbol names, matched against DWARF function names without
+/// allocating
+pub struct ExportedSymbols<'data> {
+    /// symbol names as they appear in the binary
+    symbols: HashSet<&'data str>,
+    /// the symbol names, plus each one without its leading underscore, since
+    /// macOS prepends one to every C symbol
+    function_names: HashSet<&'data str>,
+    /// (address, C name) of every symbol, sorted. aliases share an address.
+    /// empty when the addresses don't match the DWARF ones
+    addresses: Vec<(u64, &'data str)>,
+}
+
+impl<'data> ExportedSymbols<'data> {
+    fn new(symbols: HashSet<&'data str>, mut addresses: Vec<(u64, &'data str)>) -> Self {
+        let mut function_names = symbols.clone();
+        function_names.extend(symbols.iter().filter_map(|name| name.strip_prefix('_')));
+        addresses.sort_unstable();
+        addresses.dedup();
+        Self {
+            symbols,
+            function_names,
+            addresses,
+        }
+    }
+
+    /// are functions found by address? otherwise only by name
+    pub fn has_addresses(&self) -> bool {
+        !self.addresses.is_empty()
+    }
+
+    /// does any symbol point into `begin..end`?
+    pub fn any_in(&self, begin: u64, end: u64) -> bool {
+        let first = self
+            .addresses
+            .partition_point(|&(address, _)| address < begin);
+        self.addresses
+            .get(first)
+            .is_some_and(|&(address, _)| address < end)
+    }
+
+    /// the C names of every symbol at `address`
+    pub fn functions_at(&self, address: u64) -> impl Iterator<Item = &'data str> + '_ {
+        let first = self.addresses.partition_point(|&(a, _)| a < address);
+        self.addresses[first..]
+            .iter()
+            .take_while(move |&&(a, _)| a == address)
+            .map(|&(_, name)| name)
+    }
+
+    /// does a DWARF function name match an exported symbol, either as is or
+    /// with an underscore prefix?
+    pub fn contains_function(&self, name: &str) -> bool {
+        self.function_names.contains(name)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_underscore_prefixed_symbols_match() {
+        let symbols =
+            ExportedSymbols::new(HashSet::from(["_point_add", "create_person"]), Vec::new());
+
+        assert!(symbols.contains_function("point_add"));
+        assert!(symbols.contains_function("_point_add"));
+        assert!(symbols.contains_function("create_person"));
+        // a symbol never matches with an underscore removed from the DWARF side
+        assert!(!symbols.contains_function("_create_person"));
+        assert!(!symbols.contains_function("point"));
+    }
+
+    #[test]
+    fn test_aliases_share_an_address() {
+        let addresses = vec![
+            (0x2000, "point_sub"),
+            (0x1000, "point_add"),
+            (0x1000, "point_plus"),
+        ];
+        let symbols = ExportedSymbols::new(HashSet::new(), addresses);
+
+        assert!(symbols.has_addresses());
+        let aliases: Vec<&str> = symbols.functions_at(0x1000).collect();
+        assert_eq!(aliases, ["point_add", "point_plus"]);
+        assert_eq!(symbols.functions_at(0x1800).count(), 0);
+
+        assert!(symbols.any_in(0x0800, 0x1001));
+        assert!(symbols.any_in(0x1001, 0x3000));
+        assert!(!symbols.any_in(0x1001, 0x2000));
+        assert!(!symbols.any_in(0x2001, 0x3000));
     }
 }
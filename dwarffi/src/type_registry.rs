@@ -1,10 +1,15 @@
-use serde::Serialize;
-/// type registry for storing and managing C type information extracted from DWARF
-use std::collections::HashMap;
-use std::hash::{Hash, Hasher};
+use crate::spill::{MemoryBudget, Record, SpillFile};
+use crate::stable_hash::{IdHasher, StableHasher};
+use anyhow::{Context, Result};
 use log;
+use serde::{Deserialize, Serialize};
+/// type registry for storing and managing C type information extracted from DWARF
+use std::collections::{BTreeMap, HashMap, HashSet};
+use std::hash::{BuildHasherDefault, Hash, Hasher};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Mutex, MutexGuard, PoisonError};
 
-#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Serialize)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Serialize, Deserialize)]
 pub struct TypeId(pub u64);
 
 impl Hash for TypeId {
@@ -13,7 +18,16 @@ impl Hash for TypeId {
     }
 }
 
-#[derive(Debug, Clone, PartialEq)]
+/// map keyed by type id. ids are already hashes, so they are used as is
+type IdMap<V> = HashMap<TypeId, V, BuildHasherDefault<IdHasher>>;
+
+/// dense position of a type in a [`TypeRegistry`], from 0 to `len() - 1`.
+/// stable for the lifetime of the registry, so it can index side tables
+/// and bitsets over all types.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub struct TypeIndex(pub u32);
+
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
 pub struct Type {
     pub id: TypeId,
     pub kind: BaseTypeKind,
@@ -23,7 +37,7 @@ pub struct Type {
     pub dwarf_offset: Option<u64>,
 }
 
-#[derive(Debug, Clone, PartialEq)]
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
 pub enum BaseTypeKind {
     /// int, float, uint8_t, size_t, etc.
     Primitive {
@@ -36,6 +50,8 @@ pub enum BaseTypeKind {
         name: String,
         fields: Vec<StructField>,
         size: usize,
+        /// `DW_AT_alignment`, or that of the most aligned field. 1 when a
+        /// field is not at its natural offset, i.e. the struct is packed
         alignment: usize,
         is_opaque: bool, // true if forward declaration only
     },
@@ -74,123 +90,70 @@ pub enum BaseTypeKind {
     },
 }
 
-#[derive(Debug, Clone, PartialEq)]
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
 pub struct StructField {
     pub name: String,
     pub type_id: TypeId,
     pub offset: usize, // offset in bytes from struct start
     pub size: usize,   // size in bytes
+    /// alignment of the field's type in bytes, ignoring any packing
+    pub alignment: usize,
 }
 
-#[derive(Debug, Clone, PartialEq)]
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
 pub struct UnionField {
     pub name: String,
     pub type_id: TypeId,
 }
 
-#[derive(Debug, Clone, PartialEq)]
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
 pub struct EnumVariant {
     pub name: String,
     pub value: i64,
 }
 
-#[derive(Serialize)]
-enum CanonicalTypeKind {
-    Primitive(CanonicalPrimitive),
-    Struct(CanonicalStruct),
-    Union(CanonicalUnion),
-    Enum(CanonicalEnum),
-    Array(CanonicalArray),
-    Typedef(CanonicalTypedef),
-    Function(CanonicalFunction),
-}
-
-#[derive(Serialize)]
-struct CanonicalPrimitive {
-    name: String,
-    size: usize,
-    alignment: usize,
-}
-
-#[derive(Serialize)]
-struct CanonicalStruct {
-    name: String,
-    fields: Vec<CanonicalField>,
-    size: usize,
-    alignment: usize,
-    is_opaque: bool,
-}
-
-#[derive(Serialize)]
-struct CanonicalField {
-    name: String,
-    type_id: TypeId,
-    offset: usize,
-    size: usize,
-}
-
-#[derive(Serialize)]
-struct CanonicalUnion {
-    name: String,
-    variants: Vec<CanonicalUnionVariant>,
-    size: usize,
-    alignment: usize,
-}
-
-#[derive(Serialize, Ord, PartialOrd, Eq, PartialEq)]
-struct CanonicalUnionVariant {
-    name: String,
-    type_id: TypeId,
-}
-
-#[derive(Serialize)]
-struct CanonicalEnum {
-    name: String,
-    backing_id: TypeId,
-    variants: Vec<CanonicalEnumVariant>,
-    size: usize,
-}
-
-#[derive(Serialize, Ord, PartialOrd, Eq, PartialEq)]
-struct CanonicalEnumVariant {
-    name: String,
-    value: i64,
-}
-
-#[derive(Serialize)]
-struct CanonicalArray {
-    element_type_id: TypeId,
-    count: usize,
-    size: usize,
-}
-
-#[derive(Serialize)]
-struct CanonicalTypedef {
-    name: String,
-    aliased_type_id: TypeId,
-}
-
-#[derive(Serialize)]
-struct CanonicalFunction {
-    return_type_id: Option<TypeId>,
-    parameter_type_ids: Vec<TypeId>, // order matters (calling convention)
-    is_variadic: bool,
-}
-
 impl BaseTypeKind {
-    /// convert to canonical form for hashing
-    /// sorts enum/union variants by name
-    fn to_canonical(&self) -> CanonicalTypeKind {
+    /// ids of the types this kind refers to directly
+    pub fn referenced_type_ids(&self) -> Vec<TypeId> {
+        match self {
+            BaseTypeKind::Primitive { .. } => Vec::new(),
+            BaseTypeKind::Struct { fields, .. } => fields.iter().map(|f| f.type_id).collect(),
+            BaseTypeKind::Union { variants, .. } => variants.iter().map(|v| v.type_id).collect(),
+            BaseTypeKind::Enum { backing_id, .. } => vec![*backing_id],
+            BaseTypeKind::Array {
+                element_type_id, ..
+            } => vec![*element_type_id],
+            BaseTypeKind::Typedef {
+                aliased_type_id, ..
+            } => vec![*aliased_type_id],
+            BaseTypeKind::Function {
+                return_type_id,
+                parameter_type_ids,
+                ..
+            } => return_type_id
+                .iter()
+                .chain(parameter_type_ids)
+                .copied()
+                .collect(),
+        }
+    }
+
+    /// stream the canonical form of this kind into `hasher`. struct fields
+    /// and function parameters keep their order (layout and calling
+    /// convention depend on it), enum/union variants are combined order
+    /// independently so declaration order does not change the id.
+    fn hash_canonical(&self, hasher: &mut StableHasher) {
         match self {
             BaseTypeKind::Primitive {
                 name,
                 size,
                 alignment,
-            } => CanonicalTypeKind::Primitive(CanonicalPrimitive {
-                name: name.clone(),
-                size: *size,
-                alignment: *alignment,
-            }),
+            } => {
+                hasher.write_u8(0);
+                hasher.write_str(name);
+                hasher.write_usize(*size);
+                hasher.write_usize(*alignment);
+            }
 
             BaseTypeKind::Struct {
                 name,
@@ -199,24 +162,19 @@ impl BaseTypeKind {
                 alignment,
                 is_opaque,
             } => {
-                // keep field order (memory layout is order-dependent)
-                let canonical_fields = fields
-                    .iter()
-                    .map(|f| CanonicalField {
-                        name: f.name.clone(),
-                        type_id: f.type_id,
-                        offset: f.offset,
-                        size: f.size,
-                    })
-                    .collect();
-
-                CanonicalTypeKind::Struct(CanonicalStruct {
-                    name: name.clone(),
-                    fields: canonical_fields,
-                    size: *size,
-                    alignment: *alignment,
-                    is_opaque: *is_opaque,
-                })
+                hasher.write_u8(1);
+                hasher.write_str(name);
+                hasher.write_usize(fields.len());
+                for field in fields {
+                    hasher.write_str(&field.name);
+                    hasher.write_u64(field.type_id.0);
+                    hasher.write_usize(field.offset);
+                    hasher.write_usize(field.size);
+                    hasher.write_usize(field.alignment);
+                }
+                hasher.write_usize(*size);
+                hasher.write_usize(*alignment);
+                hasher.write_u8(*is_opaque as u8);
             }
 
             BaseTypeKind::Union {
@@ -225,22 +183,17 @@ impl BaseTypeKind {
                 size,
                 alignment,
             } => {
-                // sort variants by name for canonical ordering
-                let mut sorted_variants: Vec<_> = variants
-                    .iter()
-                    .map(|v| CanonicalUnionVariant {
-                        name: v.name.clone(),
-                        type_id: v.type_id,
-                    })
-                    .collect();
-                sorted_variants.sort_by(|a, b| a.name.cmp(&b.name));
-
-                CanonicalTypeKind::Union(CanonicalUnion {
-                    name: name.clone(),
-                    variants: sorted_variants,
-                    size: *size,
-                    alignment: *alignment,
-                })
+                hasher.write_u8(2);
+                hasher.write_str(name);
+                hasher.write_usize(variants.len());
+                hasher.write_u64(unordered_hash(variants.iter().map(|v| {
+                    let mut variant = StableHasher::new();
+                    variant.write_str(&v.name);
+                    variant.write_u64(v.type_id.0);
+                    variant.finish()
+                })));
+                hasher.write_usize(*size);
+                hasher.write_usize(*alignment);
             }
 
             BaseTypeKind::Enum {
@@ -249,99 +202,125 @@ impl BaseTypeKind {
                 variants,
                 size,
             } => {
-                // sort variants by name for canonical ordering
-                let mut sorted_variants: Vec<_> = variants
-                    .iter()
-                    .map(|v| CanonicalEnumVariant {
-                        name: v.name.clone(),
-                        value: v.value,
-                    })
-                    .collect();
-                sorted_variants.sort_by(|a, b| a.name.cmp(&b.name));
-
-                CanonicalTypeKind::Enum(CanonicalEnum {
-                    name: name.clone(),
-                    backing_id: *backing_id,
-                    variants: sorted_variants,
-                    size: *size,
-                })
+                hasher.write_u8(3);
+                hasher.write_str(name);
+                hasher.write_u64(backing_id.0);
+                hasher.write_usize(variants.len());
+                hasher.write_u64(unordered_hash(variants.iter().map(|v| {
+                    let mut variant = StableHasher::new();
+                    variant.write_str(&v.name);
+                    variant.write_i64(v.value);
+                    variant.finish()
+                })));
+                hasher.write_usize(*size);
             }
 
             BaseTypeKind::Array {
                 element_type_id,
                 count,
                 size,
-            } => CanonicalTypeKind::Array(CanonicalArray {
-                element_type_id: *element_type_id,
-                count: *count,
-                size: *size,
-            }),
+            } => {
+                hasher.write_u8(4);
+                hasher.write_u64(element_type_id.0);
+                hasher.write_usize(*count);
+                hasher.write_usize(*size);
+            }
 
             BaseTypeKind::Typedef {
                 name,
                 aliased_type_id,
-            } => CanonicalTypeKind::Typedef(CanonicalTypedef {
-                name: name.clone(),
-                aliased_type_id: *aliased_type_id,
-            }),
+            } => {
+                hasher.write_u8(5);
+                hasher.write_str(name);
+                hasher.write_u64(aliased_type_id.0);
+            }
 
             BaseTypeKind::Function {
                 return_type_id,
                 parameter_type_ids,
                 is_variadic,
             } => {
-                // keep parameter order (calling convention is order-dependent)
-                CanonicalTypeKind::Function(CanonicalFunction {
-                    return_type_id: *return_type_id,
-                    parameter_type_ids: parameter_type_ids.clone(),
-                    is_variadic: *is_variadic,
-                })
+                hasher.write_u8(6);
+                match return_type_id {
+                    Some(id) => {
+                        hasher.write_u8(1);
+                        hasher.write_u64(id.0);
+                    }
+                    None => hasher.write_u8(0),
+                }
+                hasher.write_usize(parameter_type_ids.len());
+                for id in parameter_type_ids {
+                    hasher.write_u64(id.0);
+                }
+                hasher.write_u8(*is_variadic as u8);
             }
         }
     }
 }
 
+/// combine element hashes so the result does not depend on their order.
+/// sum and xor together keep repeated elements from cancelling out.
+fn unordered_hash(hashes: impl Iterator<Item = u64>) -> u64 {
+    let (sum, xor) = hashes.fold((0u64, 0u64), |(sum, xor), h| {
+        (sum.wrapping_add(h), xor ^ h.rotate_left(29))
+    });
+    sum ^ xor.wrapping_mul(0x9e37_79b9_7f4a_7c15)
+}
+
 fn compute_type_id(
     kind: &BaseTypeKind,
     pointer_depth: usize,
     is_const: bool,
     is_volatile: bool,
 ) -> TypeId {
-    use bincode::Options;
-    use std::collections::hash_map::DefaultHasher;
-
-    let canonical = kind.to_canonical();
-
-    let bytes = bincode::DefaultOptions::new()
-        .with_fixint_encoding() // Ensure consistent integer encoding
-        .serialize(&(canonical, pointer_depth, is_const, is_volatile))
-        .expect("serialization cannot fail");
-
-    let mut hasher = DefaultHasher::new();
-    bytes.hash(&mut hasher);
+    let mut hasher = StableHasher::new();
+    kind.hash_canonical(&mut hasher);
+    hasher.write_usize(pointer_depth);
+    hasher.write_u8(is_const as u8);
+    hasher.write_u8(is_volatile as u8);
     TypeId(hasher.finish())
 }
 
-/// central registry
+/// central registry. types are stored densely in registration order; ids,
+/// DWARF offsets and names map to positions in that table.
 #[derive(Debug, Clone)]
 pub struct TypeRegistry {
-    types: HashMap<TypeId, Type>,
-    dwarf_to_id: HashMap<u64, TypeId>,
-    name_to_ids: HashMap<String, Vec<TypeId>>,
+    types: Vec<Type>,
+    id_to_index: IdMap<TypeIndex>,
+    dwarf_to_index: HashMap<u64, TypeIndex>,
+    name_to_indices: HashMap<String, Vec<TypeIndex>>,
 }
 
 impl TypeRegistry {
     pub fn new() -> Self {
         Self {
-            types: HashMap::new(),
-            dwarf_to_id: HashMap::new(),
-            name_to_ids: HashMap::new(),
+            types: Vec::new(),
+            id_to_index: IdMap::default(),
+            dwarf_to_index: HashMap::new(),
+            name_to_indices: HashMap::new(),
         }
     }
 
     /// register a new type with a content-addressed ID
     /// if an identical type already exists, returns its ID
     pub fn register_type(&mut self, mut type_: Type) -> TypeId {
+        // the type seen at the same DWARF offset before is usually this one,
+        // comparing is cheaper than hashing. offsets of different binaries,
+        // merged into one registry, or of different split units may collide
+        if let Some(offset) = type_.dwarf_offset
+            && let Some(&index) = self.dwarf_to_index.get(&offset)
+        {
+            let known = &self.types[index.0 as usize];
+            if known.pointer_depth == type_.pointer_depth
+                && known.is_const == type_.is_const
+                && known.is_volatile == type_.is_volatile
+                && known.kind == type_.kind
+            {
+                log::trace!("type already registered at offset {:#010x}", offset);
+                return known.id;
+            }
+        }
+
         // compute content-addressed ID from type structure
         let id = compute_type_id(
             &type_.kind,
@@ -351,52 +330,124 @@ impl TypeRegistry {
         );
 
         // check if already exists (automatic deduplication!)
-        if self.types.contains_key(&id) {
+        if self.id_to_index.contains_key(&id) {
             log::trace!("type already registered with id {:016x}", id.0);
             return id; // Same structure = same ID, already registered
         }
 
         type_.id = id;
+        self.insert_registered(type_);
+        id
+    }
+
+    /// append a type whose id has already been computed and is not yet
+    /// present
+    fn insert_registered(&mut self, type_: Type) {
+        let id = type_.id;
+        let index = TypeIndex(
+            u32::try_from(self.types.len()).expect("more than u32::MAX types registered"),
+        );
 
+        self.id_to_index.insert(id, index);
         if let Some(offset) = type_.dwarf_offset {
-            self.dwarf_to_id.insert(offset, id);
+            self.dwarf_to_index.insert(offset, index);
         }
 
         let name = type_.get_name();
         log::trace!("registered type {} with id {:016x}", name, id.0);
+        self.name_to_indices.entry(name).or_default().push(index);
 
-        self.name_to_ids
-            .entry(name)
-            .or_default()
-            .push(id);
+        self.types.push(type_);
+    }
 
-        self.types.insert(id, type_);
-        id
+    /// rebuild a registry from already registered types, in id order
+    pub(crate) fn from_sorted_types(types: Vec<Type>) -> Self {
+        let mut registry = Self::new();
+        registry.types.reserve_exact(types.len());
+        registry.id_to_index.reserve(types.len());
+        for type_ in types {
+            registry.insert_registered(type_);
+        }
+        registry
+    }
+
+    /// every type, in id order
+    pub(crate) fn sorted_types(&self) -> Vec<&Type> {
+        let mut types: Vec<&Type> = self.types.iter().collect();
+        types.sort_unstable_by_key(|t| t.id);
+        types
+    }
+
+    /// a registry of the types reachable from `roots`
+    pub fn closure(&self, roots: impl IntoIterator<Item = TypeId>) -> TypeRegistry {
+        let types = self
+            .reachable_ids(roots)
+            .into_iter()
+            .filter_map(|id| self.get_type(id).cloned())
+            .collect();
+        TypeRegistry::from_sorted_types(types)
+    }
+
+    /// ids of the types reachable from `roots`, in id order
+    pub fn reachable_ids(&self, roots: impl IntoIterator<Item = TypeId>) -> Vec<TypeId> {
+        let mut seen = HashSet::new();
+        let mut stack: Vec<TypeId> = roots.into_iter().collect();
+        let mut ids = Vec::new();
+
+        while let Some(id) = stack.pop() {
+            if !seen.insert(id) {
+                continue;
+            }
+            if let Some(type_) = self.get_type(id) {
+                stack.extend(type_.kind.referenced_type_ids());
+                ids.push(id);
+            }
+        }
+
+        ids.sort_unstable();
+        ids
     }
 
     pub fn get_type(&self, id: TypeId) -> Option<&Type> {
-        self.types.get(&id)
+        self.index_of(id).map(|index| self.get_by_index(index))
     }
 
     pub fn get_type_mut(&mut self, id: TypeId) -> Option<&mut Type> {
-        self.types.get_mut(&id)
+        let index = self.index_of(id)?;
+        Some(&mut self.types[index.0 as usize])
+    }
+
+    /// dense index of the type with `id`
+    pub fn index_of(&self, id: TypeId) -> Option<TypeIndex> {
+        self.id_to_index.get(&id).copied()
+    }
+
+    /// the type at `index`. panics if the index is not from this registry
+    pub fn get_by_index(&self, index: TypeIndex) -> &Type {
+        &self.types[index.0 as usize]
     }
 
     pub fn get_by_dwarf_offset(&self, offset: u64) -> Option<&Type> {
-        self.dwarf_to_id
+        self.dwarf_to_index
             .get(&offset)
-            .and_then(|id| self.types.get(id))
+            .map(|&index| self.get_by_index(index))
     }
 
     pub fn get_by_name(&self, name: &str) -> Vec<&Type> {
-        self.name_to_ids
+        self.name_to_indices
             .get(name)
-            .map(|ids: &Vec<TypeId>| ids.iter().filter_map(|id| self.types.get(id)).collect())
+            .map(|indices| {
+                indices
+                    .iter()
+                    .map(|&index| self.get_by_index(index))
+                    .collect()
+            })
             .unwrap_or_default()
     }
 
+    /// every type, in [`TypeIndex`] order
     pub fn all_types(&self) -> impl Iterator<Item = &Type> {
-        self.types.values()
+        self.types.iter()
     }
 
     pub fn len(&self) -> usize {
@@ -407,36 +458,34 @@ impl TypeRegistry {
         self.types.is_empty()
     }
 
-    /// merge another registry into this one.
+    /// merge another registry into this one. types new to this registry are
+    /// appended in the other registry's order.
     pub fn merge(&mut self, other: TypeRegistry) {
         let initial_count = self.len();
         let merging_count = other.len();
 
-        // union the types (content-addressed, so same ID = same type)
-        for (id, type_) in other.types {
-            self.types.entry(id).or_insert(type_);
-        }
-
-        // merge name index (deduplicate TypeIds)
-        for (name, ids) in other.name_to_ids {
-            let existing = self.name_to_ids.entry(name).or_default();
-            for id in ids {
-                if !existing.contains(&id) {
-                    existing.push(id);
+        for type_ in other.types {
+            match self.index_of(type_.id) {
+                // content-addressed, so same ID = same type. keep the offset
+                // so lookups by either DIE still find it
+                Some(index) => {
+                    if let Some(offset) = type_.dwarf_offset {
+                        self.dwarf_to_index.entry(offset).or_insert(index);
+                    }
                 }
+                None => self.insert_registered(type_),
             }
         }
 
-        // merge DWARF offset index
-        for (offset, id) in other.dwarf_to_id {
-            self.dwarf_to_id.entry(offset).or_insert(id);
-        }
-
         let final_count = self.len();
         let added = final_count - initial_count;
         let duplicates = merging_count - added;
-        log::debug!("merged type registry: {} types, {} new, {} duplicates",
-                    merging_count, added, duplicates);
+        log::debug!(
+            "merged type registry: {} types, {} new, {} duplicates",
+            merging_count,
+            added,
+            duplicates
+        );
     }
 }
 
@@ -446,6 +495,327 @@ impl Default for TypeRegistry {
     }
 }
 
+/// number of independently locked shards in a [`SharedTypeRegistry`]
+const SHARD_COUNT: usize = 64;
+
+/// type registry that many resolvers register into at the same time.
+/// types are sharded by their content-addressed id, so identical types from
+/// different compilation units are dropped at insert time instead of in a
+/// merge pass.
+///
+/// a registry with a [`MemoryBudget`] keeps the types of each shard that
+/// were used least recently in a spill file once the shard is over its part
+/// of the budget. spilled types are read back when they are used again.
+pub struct SharedTypeRegistry {
+    shards: Vec<Mutex<Shard>>,
+    spill: Option<Spill>,
+}
+
+#[derive(Default)]
+struct Shard {
+    types: IdMap<Type>,
+    /// types written to the spill file. a type read back stays here too,
+    /// its record is still good when it is evicted again
+    spilled: IdMap<SpilledType>,
+    /// types in memory by when they were last used, least recent first,
+    /// with their tick and encoded size. only kept with a budget
+    recency: BTreeMap<u64, TypeId>,
+    used: IdMap<(u64, usize)>,
+    clock: u64,
+    bytes: usize,
+}
+
+struct SpilledType {
+    record: Record,
+    /// the lowest offset across registrations since the type was written
+    dwarf_offset: Option<u64>,
+}
+
+struct Spill {
+    file: SpillFile,
+    /// bytes of types each shard keeps in memory
+    shard_bytes: usize,
+    /// types written to the file
+    written: AtomicUsize,
+}
+
+impl SharedTypeRegistry {
+    pub fn new() -> Self {
+        Self {
+            shards: (0..SHARD_COUNT).map(|_| Mutex::default()).collect(),
+            spill: None,
+        }
+    }
+
+    /// a registry that keeps about `budget.bytes` of types in memory and
+    /// spills the others into a file in `budget.dir`
+    pub fn with_budget(budget: &MemoryBudget) -> Result<Self> {
+        Ok(Self {
+            spill: Some(Spill {
+                file: SpillFile::create(budget, "types")?,
+                shard_bytes: budget.bytes / SHARD_COUNT,
+                written: AtomicUsize::new(0),
+            }),
+            ..Self::new()
+        })
+    }
+
+    fn shard(&self, id: TypeId) -> MutexGuard<'_, Shard> {
+        // ids are already hashes. the ids of a shard share their low bits,
+        // IdHasher mixes them again for the shard's maps
+        self.shards[id.0 as usize % SHARD_COUNT]
+            .lock()
+            .unwrap_or_else(PoisonError::into_inner)
+    }
+
+    /// register a type, returning its content-addressed ID.
+    /// when the type is already present the lowest DWARF offset is kept, so
+    /// the result does not depend on which thread got there first.
+    pub fn register_type(&self, mut type_: Type) -> TypeId {
+        type_.id = compute_type_id(
+            &type_.kind,
+            type_.pointer_depth,
+            type_.is_const,
+            type_.is_volatile,
+        );
+        self.insert_registered(type_)
+    }
+
+    /// add a type whose id was computed by an earlier registration, e.g. one
+    /// read back from a cache
+    pub(crate) fn insert_registered(&self, type_: Type) -> TypeId {
+        let id = type_.id;
+        let mut shard = self.shard(id);
+        let offset = type_.dwarf_offset;
+        let lower = |current: Option<u64>| match (offset, current) {
+            (Some(offset), Some(current)) => Some(offset.min(current)),
+            (offset, current) => current.or(offset),
+        };
+
+        if let Some(existing) = shard.types.get_mut(&id) {
+            log::trace!("type already registered with id {:016x}", id.0);
+            existing.dwarf_offset = lower(existing.dwarf_offset);
+        } else if let Some(spilled) = shard.spilled.get_mut(&id) {
+            log::trace!("type already spilled with id {:016x}", id.0);
+            spilled.dwarf_offset = lower(spilled.dwarf_offset);
+        } else {
+            self.keep(&mut shard, type_);
+        }
+        id
+    }
+
+    /// put `type_` in memory, spilling others when that takes the shard over
+    /// its budget
+    fn keep(&self, shard: &mut Shard, type_: Type) {
+        let Some(spill) = &self.spill else {
+            shard.types.insert(type_.id, type_);
+            return;
+        };
+        let size = bincode::serialized_size(&type_).map_or(0, |size| size as usize);
+        shard.bytes += size;
+        let id = type_.id;
+        shard.types.insert(id, type_);
+        shard.touch(id, size);
+
+        while shard.bytes > spill.shard_bytes && shard.recency.len() > 1 {
+            let Some((_, oldest)) = shard.recency.pop_first() else {
+                break;
+            };
+            let (_, size) = shard.used.remove(&oldest).unwrap_or_default();
+            let Some(type_) = shard.types.remove(&oldest) else {
+                continue;
+            };
+            if let Some(spilled) = shard.spilled.get_mut(&oldest) {
+                spilled.dwarf_offset = type_.dwarf_offset;
+            } else {
+                match spill.file.append(&type_) {
+                    Ok(record) => {
+                        spill.written.fetch_add(1, Ordering::Relaxed);
+                        let dwarf_offset = type_.dwarf_offset;
+                        shard.spilled.insert(
+                            oldest,
+                            SpilledType {
+                                record,
+                                dwarf_offset,
+                            },
+                        );
+                    }
+                    Err(e) => {
+                        // over budget is still a correct result
+                        log::warn!("keep type {:016x} in memory: {:#}", oldest.0, e);
+                        shard.types.insert(oldest, type_);
+                        shard.touch(oldest, size);
+                        break;
+                    }
+                }
+            }
+            shard.bytes -= size;
+        }
+    }
+
+    /// run `f` on a registered type without cloning it. `None` for an
+    /// unknown id, an error when a spilled type cannot be read back
+    pub fn with_type<T>(&self, id: TypeId, f: impl FnOnce(&Type) -> T) -> Result<Option<T>> {
+        let mut shard = self.shard(id);
+        if let Some(type_) = shard.types.get(&id) {
+            let result = f(type_);
+            if let Some(&(_, size)) = shard.used.get(&id) {
+                shard.touch(id, size);
+            }
+            return Ok(Some(result));
+        }
+
+        let (Some(spill), Some(spilled)) = (&self.spill, shard.spilled.get(&id)) else {
+            return Ok(None);
+        };
+        let type_ = Self::read_spilled(spill, spilled)?;
+        let result = f(&type_);
+        self.keep(&mut shard, type_);
+        Ok(Some(result))
+    }
+
+    fn read_spilled(spill: &Spill, spilled: &SpilledType) -> Result<Type> {
+        let mut type_: Type = spill
+            .file
+            .read(spilled.record)
+            .context("failed to read back a spilled type")?;
+        type_.dwarf_offset = spilled.dwarf_offset;
+        Ok(type_)
+    }
+
+    pub fn len(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.lock().unwrap_or_else(PoisonError::into_inner).len())
+            .sum()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// types written to the spill file so far, 0 without a budget
+    pub fn spilled(&self) -> usize {
+        self.spill
+            .as_ref()
+            .map_or(0, |spill| spill.written.load(Ordering::Relaxed))
+    }
+
+    /// the ids of every type, in order
+    pub fn sorted_ids(&self) -> Vec<TypeId> {
+        let mut ids: Vec<TypeId> = self
+            .shards
+            .iter()
+            .flat_map(|shard| {
+                let shard = shard.lock().unwrap_or_else(PoisonError::into_inner);
+                let spilled_only = shard
+                    .spilled
+                    .keys()
+                    .filter(|id| !shard.types.contains_key(id));
+                shard
+                    .types
+                    .keys()
+                    .chain(spilled_only)
+                    .copied()
+                    .collect::<Vec<_>>()
+            })
+            .collect();
+        ids.sort_unstable();
+        ids
+    }
+
+    /// ids of the types reachable from `roots`, in id order. spilled types
+    /// are read back one at a time
+    pub fn reachable_ids(&self, roots: impl IntoIterator<Item = TypeId>) -> Result<Vec<TypeId>> {
+        let mut seen = HashSet::new();
+        let mut stack: Vec<TypeId> = roots.into_iter().collect();
+        let mut ids = Vec::new();
+
+        while let Some(id) = stack.pop() {
+            if !seen.insert(id) {
+                continue;
+            }
+            if let Some(referenced) =
+                self.with_type(id, |type_| type_.kind.referenced_type_ids())?
+            {
+                stack.extend(referenced);
+                ids.push(id);
+            }
+        }
+
+        ids.sort_unstable();
+        Ok(ids)
+    }
+
+    /// copy the types reachable from `roots` into a regular registry, while
+    /// other threads may still be registering
+    pub fn snapshot(&self, roots: impl IntoIterator<Item = TypeId>) -> Result<TypeRegistry> {
+        let mut seen = HashSet::new();
+        let mut stack: Vec<TypeId> = roots.into_iter().collect();
+        let mut types = Vec::new();
+
+        while let Some(id) = stack.pop() {
+            if !seen.insert(id) {
+                continue;
+            }
+            if let Some(type_) = self.with_type(id, Type::clone)? {
+                stack.extend(type_.kind.referenced_type_ids());
+                types.push(type_);
+            }
+        }
+
+        types.sort_unstable_by_key(|t| t.id);
+        Ok(TypeRegistry::from_sorted_types(types))
+    }
+
+    /// flatten the shards into a regular registry, reading back every
+    /// spilled type. types are indexed in id order so name lookups come out
+    /// the same on every run.
+    pub fn into_registry(self) -> Result<TypeRegistry> {
+        let spill = self.spill;
+        let mut types = Vec::new();
+        for shard in self.shards {
+            let mut shard = shard.into_inner().unwrap_or_else(PoisonError::into_inner);
+            if let Some(spill) = &spill {
+                for (id, spilled) in &shard.spilled {
+                    if !shard.types.contains_key(id) {
+                        shard.types.insert(*id, Self::read_spilled(spill, spilled)?);
+                    }
+                }
+            }
+            types.extend(shard.types.into_values());
+        }
+        types.sort_unstable_by_key(|t| t.id);
+        Ok(TypeRegistry::from_sorted_types(types))
+    }
+}
+
+impl Shard {
+    fn len(&self) -> usize {
+        let spilled_only = self
+            .spilled
+            .keys()
+            .filter(|id| !self.types.contains_key(id))
+            .count();
+        self.types.len() + spilled_only
+    }
+
+    /// mark the type `id` in memory as the most recently used
+    fn touch(&mut self, id: TypeId, size: usize) {
+        self.clock += 1;
+        if let Some((tick, _)) = self.used.insert(id, (self.clock, size)) {
+            self.recency.remove(&tick);
+        }
+        self.recency.insert(self.clock, id);
+    }
+}
+
+impl Default for SharedTypeRegistry {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
 impl Type {
     pub(crate) fn get_name(&self) -> String {
         match &self.kind {
@@ -713,12 +1083,14 @@ mod tests {
                         type_id: int_id,
                         offset: 0,
                         size: 4,
+                        alignment: 4,
                     },
                     StructField {
                         name: "y".to_string(),
                         type_id: int_id,
                         offset: 4,
                         size: 4,
+                        alignment: 4,
                     },
                 ],
                 size: 8,
@@ -975,6 +1347,7 @@ mod tests {
                     type_id: int_id,
                     offset: 0,
                     size: 4,
+                    alignment: 4,
                 }],
                 size: 4,
                 alignment: 4,
@@ -1113,12 +1486,14 @@ mod tests {
                         type_id: int_id,
                         offset: 0,
                         size: 4,
+                        alignment: 4,
                     },
                     StructField {
                         name: "y".to_string(),
                         type_id: int_id,
                         offset: 4,
                         size: 4,
+                        alignment: 4,
                     },
                 ],
                 size: 8,
@@ -1141,12 +1516,14 @@ mod tests {
                         type_id: int_id,
                         offset: 0,
                         size: 4,
+                        alignment: 4,
                     },
                     StructField {
                         name: "y".to_string(),
                         type_id: int_id,
                         offset: 4,
                         size: 4,
+                        alignment: 4,
                     },
                 ],
                 size: 8,
@@ -1431,7 +1808,7 @@ mod tests {
         let id1 = registry.register_type(union1);
         let id2 = registry.register_type(union2);
 
-        // order does not matter - canonical form sorts by name
+        // order does not matter - variants are hashed order independently
         assert_eq!(id1, id2);
         // int, float, DataUnion
         assert_eq!(registry.len(), 3);
@@ -1466,12 +1843,14 @@ mod tests {
                         type_id: int_id,
                         offset: 0,
                         size: 4,
+                        alignment: 4,
                     },
                     StructField {
                         name: "y".to_string(),
                         type_id: int_id,
                         offset: 4,
                         size: 4,
+                        alignment: 4,
                     },
                 ],
                 size: 8,
@@ -1495,12 +1874,14 @@ mod tests {
                         type_id: int_id,
                         offset: 0, // Different offset!
                         size: 4,
+                        alignment: 4,
                     },
                     StructField {
                         name: "x".to_string(),
                         type_id: int_id,
                         offset: 4,
                         size: 4,
+                        alignment: 4,
                     },
                 ],
                 size: 8,
@@ -1734,6 +2115,7 @@ mod tests {
                     type_id: int_id_reg2,
                     offset: 0,
                     size: 4,
+                    alignment: 4,
                 }],
                 size: 4,
                 alignment: 4,
@@ -1773,4 +2155,167 @@ mod tests {
             _ => panic!("Expected struct"),
         }
     }
+
+    fn primitive(name: &str, size: usize, dwarf_offset: u64) -> Type {
+        Type {
+            id: TypeId(0),
+            kind: BaseTypeKind::Primitive {
+                name: name.to_string(),
+                size,
+                alignment: size,
+            },
+            pointer_depth: 0,
+            is_const: false,
+            is_volatile: false,
+            dwarf_offset: Some(dwarf_offset),
+        }
+    }
+
+    #[test]
+    fn test_shared_registry_concurrent_dedup() {
+        let shared = SharedTypeRegistry::new();
+
+        std::thread::scope(|scope| {
+            for unit in 0..8u64 {
+                let shared = &shared;
+                scope.spawn(move || {
+                    // every "unit" sees the same types at its own offsets
+                    shared.register_type(primitive("int", 4, 0x1000 * (unit + 1)));
+                    shared.register_type(primitive("char", 1, 0x1000 * (unit + 1) + 8));
+                });
+            }
+        });
+
+        assert_eq!(shared.len(), 2);
+
+        let registry = shared.into_registry().unwrap();
+        assert_eq!(registry.len(), 2);
+        assert_eq!(registry.get_by_name("int").len(), 1);
+
+        // lowest offset wins regardless of registration order
+        let int_type = registry.get_by_name("int")[0];
+        assert_eq!(int_type.dwarf_offset, Some(0x1000));
+        let char_id = registry.get_by_name("char")[0].id;
+        assert_eq!(registry.get_by_dwarf_offset(0x1008).unwrap().id, char_id);
+    }
+
+    #[test]
+    fn test_shared_registry_matches_sequential_ids() {
+        let shared = SharedTypeRegistry::new();
+        let mut registry = TypeRegistry::new();
+
+        let shared_id = shared.register_type(primitive("double", 8, 0x40));
+        let id = registry.register_type(primitive("double", 8, 0x40));
+
+        assert_eq!(shared_id, id);
+        assert_eq!(
+            shared.with_type(id, |t| t.get_name()).unwrap(),
+            Some("double".to_string())
+        );
+    }
+
+    #[test]
+    fn test_known_dwarf_offset_skips_hashing() {
+        let mut registry = TypeRegistry::new();
+        let id = registry.register_type(primitive("int", 4, 0x80));
+
+        // same DIE seen again, resolves through the offset index
+        assert_eq!(registry.register_type(primitive("int", 4, 0x80)), id);
+        assert_eq!(registry.len(), 1);
+
+        // another type at the same offset, e.g. of another binary
+        let long = registry.register_type(primitive("long", 8, 0x80));
+        assert_ne!(long, id);
+        assert_eq!(registry.len(), 2);
+        assert_eq!(registry.get_type(long).unwrap().get_name(), "long");
+    }
+
+    #[test]
+    fn test_indices_are_dense_and_survive_merge() {
+        let mut registry = TypeRegistry::new();
+        let int = registry.register_type(primitive("int", 4, 0x80));
+        let long = registry.register_type(primitive("long", 8, 0x90));
+        assert_eq!(registry.index_of(int), Some(TypeIndex(0)));
+        assert_eq!(registry.index_of(long), Some(TypeIndex(1)));
+
+        let mut other = TypeRegistry::new();
+        other.register_type(primitive("long", 8, 0xa0));
+        let char_ = other.register_type(primitive("char", 1, 0xb0));
+        registry.merge(other);
+
+        // existing types keep their place, new ones are appended
+        assert_eq!(registry.index_of(int), Some(TypeIndex(0)));
+        assert_eq!(registry.index_of(long), Some(TypeIndex(1)));
+        assert_eq!(registry.index_of(char_), Some(TypeIndex(2)));
+        assert_eq!(registry.get_by_index(TypeIndex(2)).id, char_);
+        assert_eq!(registry.get_by_dwarf_offset(0xa0).unwrap().id, long);
+    }
+
+    #[test]
+    fn test_budget_spills_and_reads_back() {
+        let budget = MemoryBudget::new(0, std::env::temp_dir());
+        let spilling = SharedTypeRegistry::with_budget(&budget).unwrap();
+        let plain = SharedTypeRegistry::new();
+        let primitive = |i: usize, offset: u64| Type {
+            id: TypeId(0),
+            kind: BaseTypeKind::Primitive {
+                name: format!("int{}", i),
+                size: 4,
+                alignment: 4,
+            },
+            pointer_depth: 0,
+            is_const: false,
+            is_volatile: false,
+            dwarf_offset: Some(offset),
+        };
+
+        let mut ids = Vec::new();
+        for i in 0..500 {
+            ids.push(spilling.register_type(primitive(i, 1000 + i as u64)));
+            plain.register_type(primitive(i, 1000 + i as u64));
+        }
+        // registering a spilled type again still keeps the lowest offset
+        for i in 0..500 {
+            spilling.register_type(primitive(i, i as u64));
+            plain.register_type(primitive(i, i as u64));
+        }
+
+        assert!(spilling.spilled() > 0);
+        assert_eq!(spilling.len(), 500);
+        assert_eq!(spilling.sorted_ids().len(), 500);
+        for (i, id) in ids.iter().enumerate() {
+            let offset = spilling.with_type(*id, |type_| type_.dwarf_offset);
+            assert_eq!(offset.unwrap(), Some(Some(i as u64)));
+        }
+        let spilled = spilling.into_registry().unwrap();
+        let plain = plain.into_registry().unwrap();
+        assert!(spilled.all_types().eq(plain.all_types()));
+    }
+
+    #[test]
+    fn test_unreadable_spill_is_an_error() {
+        let dir = std::env::temp_dir().join(format!("dwarffi-spill-test-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        let budget = MemoryBudget::new(0, &dir);
+        let spilling = SharedTypeRegistry::with_budget(&budget).unwrap();
+        let ids: Vec<TypeId> = (0..100)
+            .map(|i| spilling.register_type(primitive(&format!("int{}", i), 4, i)))
+            .collect();
+        assert!(spilling.spilled() > 0);
+
+        for file in std::fs::read_dir(&dir).unwrap() {
+            let file = std::fs::File::options()
+                .write(true)
+                .open(file.unwrap().path());
+            file.unwrap().set_len(0).unwrap();
+        }
+        let results: Vec<_> = ids
+            .iter()
+            .map(|id| spilling.with_type(*id, Type::clone))
+            .collect();
+        assert!(results.iter().any(Result::is_err));
+        assert!(spilling.into_registry().is_err());
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
 }
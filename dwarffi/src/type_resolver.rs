@@ -1,41 +1,194 @@
-use crate::type_registry::{BaseTypeKind, Type, TypeId, TypeRegistry};
+use crate::die_index::{self, DieIndex};
+use crate::stable_hash::{IdHasher, StableHasher};
+use crate::stats::ResolverStats;
+use crate::type_registry::{BaseTypeKind, SharedTypeRegistry, Type, TypeId};
+use crate::type_units::TypeUnits;
 use anyhow::{Result, anyhow};
-use gimli::{AttributeValue, DebuggingInformationEntry, Dwarf, ReaderOffset, Unit, UnitOffset};
+use gimli::{
+    AttributeValue, DebugTypeSignature, DebuggingInformationEntry, Dwarf, Encoding, ReaderOffset,
+    Unit, UnitOffset, UnitSectionOffset,
+};
+use std::collections::HashMap;
+use std::hash::{BuildHasherDefault, Hasher};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{PoisonError, RwLock};
+
+/// entries a [`TypeResolver::shape`] may visit. a type that takes more is
+/// resolved in every unit instead of being shared
+const SHAPE_LIMIT: usize = 4096;
+
+/// map from unit offsets. they are dense, the multiply of [`IdHasher`] is
+/// enough to spread them
+type OffsetMap<V> = HashMap<u64, V, BuildHasherDefault<IdHasher>>;
+
+/// encoding of the unit a type was resolved in, and its shape. the encoding
+/// decides the size of pointers and how member locations read
+type ShapeKey = (Encoding, u64);
+
+/// types resolved by any unit of the analysis, keyed by their shape. header
+/// types are emitted again in every unit that includes the header: later
+/// units reuse the id instead of walking the DIE tree (and every field type)
+/// again.
+#[derive(Default)]
+pub struct DeclCache {
+    types: RwLock<HashMap<ShapeKey, TypeId>>,
+    /// bytes of ids kept at most. once the cache is full, later types are
+    /// resolved again in every unit
+    limit: Option<usize>,
+    bytes: AtomicUsize,
+}
+
+impl DeclCache {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn with_limit(bytes: usize) -> Self {
+        Self {
+            limit: Some(bytes),
+            ..Self::default()
+        }
+    }
+
+    fn get(&self, key: &ShapeKey) -> Option<TypeId> {
+        self.types
+            .read()
+            .unwrap_or_else(PoisonError::into_inner)
+            .get(key)
+            .copied()
+    }
+
+    fn insert(&self, key: ShapeKey, id: TypeId) {
+        if let Some(limit) = self.limit {
+            let size = size_of::<(ShapeKey, TypeId)>();
+            if self.bytes.fetch_add(size, Ordering::Relaxed) + size > limit {
+                self.bytes.fetch_sub(size, Ordering::Relaxed);
+                return;
+            }
+        }
+        self.types
+            .write()
+            .unwrap_or_else(PoisonError::into_inner)
+            .entry(key)
+            .or_insert(id);
+    }
+
+    pub fn len(&self) -> usize {
+        self.types
+            .read()
+            .unwrap_or_else(PoisonError::into_inner)
+            .len()
+    }
+}
 
-/// resolve DWARF type information into structured type registry
+/// resolve DWARF type information into the shared type registry
 pub struct TypeResolver<'dwarf, R: gimli::Reader> {
     dwarf: &'dwarf Dwarf<R>,
     unit: &'dwarf Unit<R>,
-    type_registry: TypeRegistry,
+    index: &'dwarf DieIndex<'dwarf, R>,
+    type_registry: &'dwarf SharedTypeRegistry,
+    decl_cache: &'dwarf DeclCache,
+    type_units: Option<&'dwarf TypeUnits<R>>,
+    /// types already resolved in this unit, by .debug_info offset
+    resolved: HashMap<u64, TypeId>,
+    /// shapes of the entries of this unit, by unit offset
+    shapes: OffsetMap<u64>,
+    /// decode struct fields, union variants and enum values
+    members: bool,
+    /// look types up in `decl_cache` by their shape
+    shared_decls: bool,
+    void_type_id: Option<TypeId>,
+    int_type_id: Option<TypeId>,
+    stats: ResolverStats,
 }
 
 impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
-    /// create new with empty registry with the given DWARF and unit
-    pub fn new(dwarf: &'dwarf Dwarf<R>, unit: &'dwarf Unit<R>) -> Self {
+    /// create a resolver for the given DWARF, unit and DIE index of that unit.
+    /// types are registered into `type_registry` and declared types are
+    /// shared through `decl_cache`
+    pub fn new(
+        dwarf: &'dwarf Dwarf<R>,
+        unit: &'dwarf Unit<R>,
+        index: &'dwarf DieIndex<'dwarf, R>,
+        type_registry: &'dwarf SharedTypeRegistry,
+        decl_cache: &'dwarf DeclCache,
+    ) -> Self {
         Self {
             dwarf,
             unit,
-            type_registry: TypeRegistry::new(),
+            index,
+            type_registry,
+            decl_cache,
+            type_units: None,
+            resolved: HashMap::new(),
+            shapes: OffsetMap::default(),
+            members: true,
+            shared_decls: true,
+            void_type_id: None,
+            int_type_id: None,
+            stats: ResolverStats::default(),
         }
     }
 
+    /// resolve structs, unions and enums by name and size only. their
+    /// members, and every type only a member refers to, are never decoded.
+    pub fn without_members(mut self) -> Self {
+        self.members = false;
+        self
+    }
+
+    /// resolve every type in this unit, without looking into or adding to
+    /// the decl cache
+    pub fn without_shared_decls(mut self) -> Self {
+        self.shared_decls = false;
+        self
+    }
+
+    /// resolve references by signature through `type_units`, the type units
+    /// of this resolver's DWARF
+    pub fn with_type_units(mut self, type_units: &'dwarf TypeUnits<R>) -> Self {
+        self.type_units = Some(type_units);
+        self
+    }
+
+    /// lookups and registrations so far
+    pub(crate) fn stats(&self) -> ResolverStats {
+        self.stats
+    }
+
     pub fn build_type_registry_entry(&mut self, offset: UnitOffset<R::Offset>) -> Result<TypeId> {
-        let dwarf_offset = offset.0.into_u64();
+        // offsets are kept section-relative so they stay unique across units
+        let dwarf_offset = match offset.to_unit_section_offset(self.unit) {
+            UnitSectionOffset::DebugInfoOffset(o) => o.0.into_u64(),
+            UnitSectionOffset::DebugTypesOffset(o) => o.0.into_u64(),
+        };
 
-        if let Some(type_) = self.type_registry.get_by_dwarf_offset(dwarf_offset) {
+        self.stats.type_lookups += 1;
+        if let Some(id) = self.resolved.get(&dwarf_offset) {
+            self.stats.type_lookup_hits += 1;
             log::trace!("type already registered at offset {:#010x}", dwarf_offset);
-            return Ok(type_.id);
+            return Ok(*id);
         }
 
-        let mut entries = self.unit.entries_at_offset(offset)?;
-        let (_, entry) = entries
-            .next_dfs()?
-            .ok_or_else(|| anyhow!("no entry at offset"))?;
+        let shape = if self.shared_decls {
+            self.shape(offset)?
+        } else {
+            None
+        };
+        let key = shape.map(|shape| (self.unit.encoding(), shape));
+        if let Some(key) = &key {
+            self.stats.decl_lookups += 1;
+            if let Some(id) = self.decl_cache.get(key) {
+                self.stats.decl_hits += 1;
+                log::trace!("type at offset {:#010x} resolved before", dwarf_offset);
+                self.resolved.insert(dwarf_offset, id);
+                return Ok(id);
+            }
+        }
 
         log::trace!("extracting type at offset {:#010x}", dwarf_offset);
 
-        let (kind, pointer_depth, is_const, is_volatile) =
-            self.extract_type_metadata(entry, offset)?;
+        let (kind, pointer_depth, is_const, is_volatile) = self.extract_type_metadata(offset)?;
 
         let extracted_type = Type {
             id: TypeId(0),
@@ -46,7 +199,12 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
             dwarf_offset: Some(dwarf_offset),
         };
 
+        self.stats.types_registered += 1;
         let id = self.type_registry.register_type(extracted_type);
+        self.resolved.insert(dwarf_offset, id);
+        if let Some(key) = key {
+            self.decl_cache.insert(key, id);
+        }
         Ok(id)
     }
 
@@ -54,6 +212,88 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         self.get_or_create_void_type()
     }
 
+    /// the type an attribute value refers to: an entry of this unit, or the
+    /// type of a type unit by its signature. `None` when it refers to
+    /// neither
+    pub fn referenced_type(&mut self, value: AttributeValue<R>) -> Result<Option<TypeId>> {
+        if let AttributeValue::DebugTypesRef(signature) = value {
+            return self.signature_type(signature);
+        }
+        match self.type_ref(value) {
+            Some(offset) => self.build_type_registry_entry(offset).map(Some),
+            None => Ok(None),
+        }
+    }
+
+    /// the type of the type unit with `signature`, decoding the unit with a
+    /// resolver of its own the first time any unit refers to it
+    fn signature_type(&mut self, signature: DebugTypeSignature) -> Result<Option<TypeId>> {
+        let Some(type_units) = self.type_units else {
+            log::debug!("no type units to look up {:#018x} in", signature.0);
+            return Ok(None);
+        };
+        self.stats.type_lookups += 1;
+        if let Some(id) = type_units.get(signature) {
+            self.stats.type_lookup_hits += 1;
+            return Ok(Some(id));
+        }
+        let Some((header, type_offset)) = type_units.unit(signature) else {
+            log::debug!("no type unit with signature {:#018x}", signature.0);
+            return Ok(None);
+        };
+
+        log::trace!("decoding type unit {:#018x}", signature.0);
+        let unit = self.dwarf.unit(header)?;
+        let index = DieIndex::build(&unit)?;
+        let mut resolver = TypeResolver::new(
+            self.dwarf,
+            &unit,
+            &index,
+            self.type_registry,
+            self.decl_cache,
+        )
+        .with_type_units(type_units);
+        resolver.members = self.members;
+        resolver.shared_decls = self.shared_decls;
+        let id = resolver.build_type_registry_entry(type_offset)?;
+        self.stats += resolver.stats;
+        type_units.insert(signature, id);
+        Ok(Some(id))
+    }
+
+    /// the kind of the registered type `id` with more qualifiers, for a
+    /// chain of pointers and qualifiers that ends in a type unit
+    fn qualified(
+        &self,
+        id: TypeId,
+        pointer_depth: usize,
+        is_const: bool,
+        is_volatile: bool,
+    ) -> Result<(BaseTypeKind, usize, bool, bool)> {
+        let qualified = self
+            .type_registry
+            .with_type(id, |t| {
+                (
+                    t.kind.clone(),
+                    t.pointer_depth + pointer_depth,
+                    t.is_const || is_const,
+                    t.is_volatile || is_volatile,
+                )
+            })?
+            .expect("type units are resolved into the registry");
+        Ok(qualified)
+    }
+
+    /// turn a type reference into an offset in this unit. `DW_FORM_ref_addr`
+    /// references are followed when they point back into the same unit.
+    fn type_ref(&self, value: AttributeValue<R>) -> Option<UnitOffset<R::Offset>> {
+        match value {
+            AttributeValue::UnitRef(offset) => Some(offset),
+            AttributeValue::DebugInfoRef(offset) => offset.to_unit_offset(&self.unit.header),
+            _ => None,
+        }
+    }
+
     fn get_name(&self, entry: &DebuggingInformationEntry<R>) -> Result<String> {
         if let Some(attr) = entry.attr(gimli::DW_AT_name)? {
             let name_reader = self.dwarf.attr_string(self.unit, attr.value())?;
@@ -67,7 +307,6 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
 
     fn extract_type_metadata(
         &mut self,
-        _entry: &DebuggingInformationEntry<R>,
         offset: UnitOffset<R::Offset>,
     ) -> Result<(BaseTypeKind, usize, bool, bool)> {
         let mut pointer_depth = 0;
@@ -75,58 +314,35 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         let mut is_volatile = false;
         let mut current_offset = offset;
 
+        let index = self.index;
         loop {
-            let mut entries = self.unit.entries_at_offset(current_offset)?;
-            let (_, entry) = entries
-                .next_dfs()?
-                .ok_or_else(|| anyhow!("no entry at offset"))?;
+            let entry = index.entry(current_offset)?;
 
             match entry.tag() {
-                gimli::DW_TAG_pointer_type => {
-                    pointer_depth += 1;
-                    // follow to pointee
-                    if let Some(attr) = entry.attr(gimli::DW_AT_type)?
-                        && let AttributeValue::UnitRef(next_offset) = attr.value()
-                    {
-                        current_offset = next_offset;
-                        continue;
-                    }
-                    // void* if no type attribute
-                    let kind = BaseTypeKind::Primitive {
-                        name: "void".to_string(),
-                        size: 0,
-                        alignment: 1,
-                    };
-                    return Ok((kind, pointer_depth, is_const, is_volatile));
-                }
-
-                gimli::DW_TAG_const_type => {
-                    is_const = true;
-                    // Follow to inner type
-                    if let Some(attr) = entry.attr(gimli::DW_AT_type)?
-                        && let AttributeValue::UnitRef(next_offset) = attr.value()
-                    {
-                        current_offset = next_offset;
-                        continue;
+                gimli::DW_TAG_pointer_type
+                | gimli::DW_TAG_const_type
+                | gimli::DW_TAG_volatile_type => {
+                    match entry.tag() {
+                        gimli::DW_TAG_pointer_type => pointer_depth += 1,
+                        gimli::DW_TAG_const_type => is_const = true,
+                        _ => is_volatile = true,
                     }
-                    // const void if no type
-                    let kind = BaseTypeKind::Primitive {
-                        name: "void".to_string(),
-                        size: 0,
-                        alignment: 1,
-                    };
-                    return Ok((kind, pointer_depth, is_const, is_volatile));
-                }
-
-                gimli::DW_TAG_volatile_type => {
-                    is_volatile = true;
-                    // follow to inner type
-                    if let Some(attr) = entry.attr(gimli::DW_AT_type)?
-                        && let AttributeValue::UnitRef(next_offset) = attr.value()
-                    {
-                        current_offset = next_offset;
-                        continue;
+                    // follow to the pointee or qualified type
+                    match entry.attr_value(gimli::DW_AT_type)? {
+                        Some(AttributeValue::DebugTypesRef(signature)) => {
+                            if let Some(id) = self.signature_type(signature)? {
+                                return self.qualified(id, pointer_depth, is_const, is_volatile);
+                            }
+                        }
+                        Some(value) => {
+                            if let Some(next_offset) = self.type_ref(value) {
+                                current_offset = next_offset;
+                                continue;
+                            }
+                        }
+                        None => {}
                     }
+                    // void (void*, const void) if no type attribute
                     let kind = BaseTypeKind::Primitive {
                         name: "void".to_string(),
                         size: 0,
@@ -140,23 +356,11 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
                     return Ok((kind, pointer_depth, is_const, is_volatile));
                 }
 
-                gimli::DW_TAG_typedef => {
-                    let kind = self.extract_typedef_type(entry)?;
-                    return Ok((kind, pointer_depth, is_const, is_volatile));
-                }
-
-                gimli::DW_TAG_structure_type => {
-                    let kind = self.extract_struct_type(entry, current_offset)?;
-                    return Ok((kind, pointer_depth, is_const, is_volatile));
-                }
-
-                gimli::DW_TAG_union_type => {
-                    let kind = self.extract_union_type(entry, current_offset)?;
-                    return Ok((kind, pointer_depth, is_const, is_volatile));
-                }
-
-                gimli::DW_TAG_enumeration_type => {
-                    let kind = self.extract_enum_type(entry, current_offset)?;
+                gimli::DW_TAG_typedef
+                | gimli::DW_TAG_structure_type
+                | gimli::DW_TAG_union_type
+                | gimli::DW_TAG_enumeration_type => {
+                    let kind = self.extract_declared_type(entry, current_offset)?;
                     return Ok((kind, pointer_depth, is_const, is_volatile));
                 }
 
@@ -183,6 +387,129 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         }
     }
 
+    /// typedefs, structs, unions and enums
+    fn extract_declared_type(
+        &mut self,
+        entry: &DebuggingInformationEntry<R>,
+        offset: UnitOffset<R::Offset>,
+    ) -> Result<BaseTypeKind> {
+        match entry.tag() {
+            gimli::DW_TAG_typedef => self.extract_typedef_type(entry),
+            gimli::DW_TAG_structure_type => self.extract_struct_type(entry, offset),
+            gimli::DW_TAG_union_type => self.extract_union_type(entry, offset),
+            _ => self.extract_enum_type(entry, offset),
+        }
+    }
+
+    /// hash of everything the type at `offset` is made of: the attributes
+    /// and children of its entry, and the shapes of the entries they refer
+    /// to, down to base types. where it was declared is left out. two types
+    /// with the same shape resolve to the same type. `None` when that takes
+    /// more than [`SHAPE_LIMIT`] entries
+    fn shape(&mut self, offset: UnitOffset<R::Offset>) -> Result<Option<u64>> {
+        let mut budget = SHAPE_LIMIT;
+        let shape = self.shape_of(offset, &mut Vec::new(), &mut budget)?;
+        Ok(shape.map(|(shape, _)| shape))
+    }
+
+    /// the shape of `offset` while the entries of `stack` are being hashed,
+    /// and the lowest position in `stack` it refers back to. a reference to
+    /// an entry of `stack` is hashed as how far up the stack it is, so a
+    /// shape that only refers back to itself does not depend on where the
+    /// walk came from, and is kept for the rest of the unit
+    fn shape_of(
+        &mut self,
+        offset: UnitOffset<R::Offset>,
+        stack: &mut Vec<u64>,
+        budget: &mut usize,
+    ) -> Result<Option<(u64, usize)>> {
+        let key = offset.0.into_u64();
+        if let Some(shape) = self.shapes.get(&key) {
+            return Ok(Some((*shape, usize::MAX)));
+        }
+        let depth = stack.len();
+        if let Some(position) = stack.iter().position(|entry| *entry == key) {
+            let mut hasher = StableHasher::new();
+            hasher.write_u64(u64::MAX);
+            hasher.write_u64((depth - position) as u64);
+            return Ok(Some((hasher.finish(), position)));
+        }
+        if *budget == 0 {
+            return Ok(None);
+        }
+        *budget -= 1;
+
+        stack.push(key);
+        let mut hasher = StableHasher::new();
+        let mut lowest = usize::MAX;
+        let entry = self.index.entry(offset)?;
+        let shape = self.hash_entry(entry, &mut hasher, stack, budget, &mut lowest);
+        stack.pop();
+        if shape?.is_none() {
+            return Ok(None);
+        }
+
+        let shape = hasher.finish();
+        if lowest >= depth {
+            self.shapes.insert(key, shape);
+        }
+        Ok(Some((shape, lowest)))
+    }
+
+    /// add `entry` and its children to `hasher`. returns
+    /// `None` when the budget ran out
+    fn hash_entry(
+        &mut self,
+        entry: &DebuggingInformationEntry<'dwarf, 'dwarf, R>,
+        hasher: &mut StableHasher,
+        stack: &mut Vec<u64>,
+        budget: &mut usize,
+        lowest: &mut usize,
+    ) -> Result<Option<()>> {
+        hasher.write_u64(u64::from(entry.tag().0));
+
+        let mut attrs = entry.attrs();
+        while let Some(attr) = attrs.next()? {
+            match attr.name() {
+                gimli::DW_AT_decl_file
+                | gimli::DW_AT_decl_line
+                | gimli::DW_AT_decl_column
+                | gimli::DW_AT_sibling => continue,
+                name => hasher.write_u64(u64::from(name.0)),
+            }
+            let value = attr.value();
+            match value {
+                AttributeValue::UnitRef(_) | AttributeValue::DebugInfoRef(_) => {
+                    // another unit's entry, whose shape is out of reach
+                    let Some(target) = self.type_ref(value) else {
+                        return Ok(None);
+                    };
+                    let Some((shape, position)) = self.shape_of(target, stack, budget)? else {
+                        return Ok(None);
+                    };
+                    hasher.write_u64(shape);
+                    *lowest = (*lowest).min(position);
+                }
+                value => die_index::hash_value(hasher, self.dwarf, self.unit, value)?,
+            }
+        }
+
+        if !entry.has_children() {
+            return Ok(Some(()));
+        }
+        let index = self.index;
+        for child in index.children(entry.offset())? {
+            hasher.write_u64(u64::MAX - 1);
+            if self
+                .hash_entry(child, hasher, stack, budget, lowest)?
+                .is_none()
+            {
+                return Ok(None);
+            }
+        }
+        Ok(Some(()))
+    }
+
     fn extract_primitive_type(&self, entry: &DebuggingInformationEntry<R>) -> Result<BaseTypeKind> {
         let name = self.get_name(entry)?;
         let size = entry
@@ -206,8 +533,8 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         let name = self.get_name(entry)?;
 
         let aliased_type_id = if let Some(attr) = entry.attr(gimli::DW_AT_type)? {
-            if let AttributeValue::UnitRef(offset) = attr.value() {
-                self.build_type_registry_entry(offset)?
+            if let Some(type_id) = self.referenced_type(attr.value())? {
+                type_id
             } else {
                 self.get_or_create_void_type()?
             }
@@ -224,9 +551,8 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
     }
 
     fn get_or_create_void_type(&mut self) -> Result<TypeId> {
-        let void_types = self.type_registry.get_by_name("void");
-        if let Some(void_type) = void_types.first() {
-            return Ok(void_type.id);
+        if let Some(id) = self.void_type_id {
+            return Ok(id);
         }
 
         let void_type = Type {
@@ -242,7 +568,10 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
             dwarf_offset: None,
         };
 
-        Ok(self.type_registry.register_type(void_type))
+        self.stats.types_registered += 1;
+        let id = self.type_registry.register_type(void_type);
+        self.void_type_id = Some(id);
+        Ok(id)
     }
 
     fn extract_struct_type(
@@ -280,9 +609,24 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         }
 
         // extract fields (children of struct entry)
-        let fields = self.extract_struct_fields(offset)?;
+        let fields = if self.members {
+            self.extract_struct_fields(offset)?
+        } else {
+            Vec::new()
+        };
 
-        let alignment = fields.iter().map(|f| f.size).max().unwrap_or(1);
+        let alignment = match Self::explicit_alignment(entry)? {
+            Some(alignment) => alignment,
+            None => {
+                let natural = fields.iter().map(|f| f.alignment).max().unwrap_or(1).max(1);
+                // DWARF has no attribute for packing, it shows in the offsets
+                let packed = !size.is_multiple_of(natural)
+                    || fields
+                        .iter()
+                        .any(|f| !f.offset.is_multiple_of(f.alignment.max(1)));
+                if packed { 1 } else { natural }
+            }
+        };
 
         Ok(BaseTypeKind::Struct {
             name,
@@ -298,13 +642,8 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         struct_offset: UnitOffset<R::Offset>,
     ) -> Result<Vec<crate::type_registry::StructField>> {
         let mut fields = Vec::new();
-        let mut tree = self.unit.entries_tree(Some(struct_offset))?;
-        let struct_node = tree.root()?;
-
-        let mut children = struct_node.children();
-        while let Some(child) = children.next()? {
-            let entry = child.entry();
-
+        let index = self.index;
+        for entry in index.children(struct_offset)? {
             if entry.tag() != gimli::DW_TAG_member {
                 continue;
             }
@@ -312,8 +651,8 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
             let name = self.get_name(entry).unwrap_or_default();
 
             let type_id = if let Some(attr) = entry.attr(gimli::DW_AT_type)? {
-                if let AttributeValue::UnitRef(offset) = attr.value() {
-                    self.build_type_registry_entry(offset)?
+                if let Some(type_id) = self.referenced_type(attr.value())? {
+                    type_id
                 } else {
                     log::trace!("skip field {} with invalid type reference", name);
                     continue;
@@ -323,24 +662,22 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
                 continue;
             };
 
-            let offset = entry
-                .attr(gimli::DW_AT_data_member_location)?
-                .and_then(|attr| attr.udata_value())
-                .unwrap_or(0) as usize;
-
-            // Get size from the field's type
-            let field_type = self.type_registry.get_type(type_id);
-            let size = if let Some(ft) = field_type {
-                match &ft.kind {
-                    BaseTypeKind::Primitive { size, .. } => *size,
-                    BaseTypeKind::Struct { size, .. } => *size,
-                    BaseTypeKind::Array { size, .. } => *size,
-                    _ => 0,
+            let offset = match entry.attr_value(gimli::DW_AT_data_member_location)? {
+                // DWARF 2 producers write `DW_OP_plus_uconst <offset>`
+                Some(AttributeValue::Exprloc(expression)) => {
+                    let mut bytes = expression.0;
+                    match gimli::Operation::parse(&mut bytes, self.unit.encoding())? {
+                        gimli::Operation::PlusConstant { value } => value as usize,
+                        _ => 0,
+                    }
                 }
-            } else {
-                0
+                Some(value) => value.udata_value().unwrap_or(0) as usize,
+                None => 0,
             };
 
+            // size and alignment of the field's type
+            let (size, alignment) = self.type_layout(type_id)?.unwrap_or((0, 1));
+
             log::trace!(
                 "{:>12} {:#010x}: {} @ offset {}",
                 "field",
@@ -354,6 +691,7 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
                 type_id,
                 offset,
                 size,
+                alignment,
             });
         }
 
@@ -383,21 +721,24 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
             size
         );
 
-        let variants = self.extract_union_fields(offset)?;
-
-        let alignment = variants
-            .iter()
-            .filter_map(|v| {
-                self.type_registry
-                    .get_type(v.type_id)
-                    .and_then(|t| match &t.kind {
-                        BaseTypeKind::Primitive { alignment, .. } => Some(*alignment),
-                        BaseTypeKind::Struct { alignment, .. } => Some(*alignment),
-                        _ => None,
-                    })
-            })
-            .max()
-            .unwrap_or(1);
+        let variants = if self.members {
+            self.extract_union_fields(offset)?
+        } else {
+            Vec::new()
+        };
+
+        let alignment = match Self::explicit_alignment(entry)? {
+            Some(alignment) => alignment,
+            None => {
+                let mut alignment = 1;
+                for variant in &variants {
+                    if let Some((_, variant_alignment)) = self.type_layout(variant.type_id)? {
+                        alignment = alignment.max(variant_alignment);
+                    }
+                }
+                alignment
+            }
+        };
 
         Ok(BaseTypeKind::Union {
             name,
@@ -412,13 +753,8 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         union_offset: UnitOffset<R::Offset>,
     ) -> Result<Vec<crate::type_registry::UnionField>> {
         let mut variants = Vec::new();
-        let mut tree = self.unit.entries_tree(Some(union_offset))?;
-        let union_node = tree.root()?;
-
-        let mut children = union_node.children();
-        while let Some(child) = children.next()? {
-            let entry = child.entry();
-
+        let index = self.index;
+        for entry in index.children(union_offset)? {
             if entry.tag() != gimli::DW_TAG_member {
                 continue;
             }
@@ -426,8 +762,8 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
             let name = self.get_name(entry).unwrap_or_default();
 
             let type_id = if let Some(attr) = entry.attr(gimli::DW_AT_type)? {
-                if let AttributeValue::UnitRef(offset) = attr.value() {
-                    self.build_type_registry_entry(offset)?
+                if let Some(type_id) = self.referenced_type(attr.value())? {
+                    type_id
                 } else {
                     log::trace!("skip variant {} with invalid type reference", name);
                     continue;
@@ -469,8 +805,8 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
 
         // extract underlying type (DWARF DW_AT_type on enum)
         let backing_id = if let Some(attr) = entry.attr(gimli::DW_AT_type)? {
-            if let AttributeValue::UnitRef(type_offset) = attr.value() {
-                self.build_type_registry_entry(type_offset)?
+            if let Some(type_id) = self.referenced_type(attr.value())? {
+                type_id
             } else {
                 self.get_or_create_int_type()?
             }
@@ -478,7 +814,11 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
             self.get_or_create_int_type()?
         };
 
-        let variants = self.extract_enum_variants(offset)?;
+        let variants = if self.members {
+            self.extract_enum_variants(offset)?
+        } else {
+            Vec::new()
+        };
 
         Ok(BaseTypeKind::Enum {
             name,
@@ -493,13 +833,8 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         enum_offset: UnitOffset<R::Offset>,
     ) -> Result<Vec<crate::type_registry::EnumVariant>> {
         let mut variants = Vec::new();
-        let mut tree = self.unit.entries_tree(Some(enum_offset))?;
-        let enum_node = tree.root()?;
-
-        let mut children = enum_node.children();
-        while let Some(child) = children.next()? {
-            let entry = child.entry();
-
+        let index = self.index;
+        for entry in index.children(enum_offset)? {
             if entry.tag() != gimli::DW_TAG_enumerator {
                 continue;
             }
@@ -526,8 +861,8 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
     ) -> Result<BaseTypeKind> {
         // get element type
         let element_type_id = if let Some(attr) = entry.attr(gimli::DW_AT_type)? {
-            if let AttributeValue::UnitRef(type_offset) = attr.value() {
-                self.build_type_registry_entry(type_offset)?
+            if let Some(type_id) = self.referenced_type(attr.value())? {
+                type_id
             } else {
                 return Err(anyhow!("array missing element type"));
             }
@@ -539,16 +874,9 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         let count = self.extract_array_count(offset)?;
 
         // calculate size
-        let element_type = self
-            .type_registry
-            .get_type(element_type_id)
+        let element_size = self
+            .type_size(element_type_id)?
             .ok_or_else(|| anyhow!("element type not found"))?;
-        let element_size = match &element_type.kind {
-            BaseTypeKind::Primitive { size, .. } => *size,
-            BaseTypeKind::Struct { size, .. } => *size,
-            BaseTypeKind::Array { size, .. } => *size,
-            _ => 0,
-        };
 
         let total_size = element_size * count;
 
@@ -567,14 +895,63 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         })
     }
 
-    fn extract_array_count(&mut self, array_offset: UnitOffset<R::Offset>) -> Result<usize> {
-        let mut tree = self.unit.entries_tree(Some(array_offset))?;
-        let array_node = tree.root()?;
+    /// byte size of a registered type (0 for kinds without a known size)
+    fn type_size(&self, id: TypeId) -> Result<Option<usize>> {
+        Ok(self.type_layout(id)?.map(|(size, _)| size))
+    }
+
+    /// byte size and alignment of a value of a registered type. pointers
+    /// have the unit's address size, typedefs and arrays that of what they
+    /// hold.
+    fn type_layout(&self, id: TypeId) -> Result<Option<(usize, usize)>> {
+        let pointer = usize::from(self.unit.header.address_size());
+        // (size, alignment), or the type to take them from
+        let layout = self.type_registry.with_type(id, |t| {
+            if t.pointer_depth > 0 {
+                return Ok((pointer, pointer));
+            }
+            match &t.kind {
+                BaseTypeKind::Primitive {
+                    size, alignment, ..
+                }
+                | BaseTypeKind::Struct {
+                    size, alignment, ..
+                }
+                | BaseTypeKind::Union {
+                    size, alignment, ..
+                } => Ok((*size, (*alignment).max(1))),
+                BaseTypeKind::Enum { size, .. } => Ok((*size, (*size).max(1))),
+                BaseTypeKind::Array {
+                    element_type_id,
+                    size,
+                    ..
+                } => Err((*element_type_id, Some(*size))),
+                BaseTypeKind::Typedef {
+                    aliased_type_id, ..
+                } => Err((*aliased_type_id, None)),
+                BaseTypeKind::Function { .. } => Ok((0, 1)),
+            }
+        })?;
+        match layout {
+            None => Ok(None),
+            Some(Ok(layout)) => Ok(Some(layout)),
+            Some(Err((inner, own_size))) => Ok(self
+                .type_layout(inner)?
+                .map(|(size, alignment)| (own_size.unwrap_or(size), alignment))),
+        }
+    }
 
-        let mut children = array_node.children();
-        while let Some(child) = children.next()? {
-            let entry = child.entry();
+    /// `DW_AT_alignment` of a struct or union, when the source asked for one
+    fn explicit_alignment(entry: &DebuggingInformationEntry<R>) -> Result<Option<usize>> {
+        Ok(entry
+            .attr(gimli::DW_AT_alignment)?
+            .and_then(|attr| attr.udata_value())
+            .map(|alignment| alignment as usize))
+    }
 
+    fn extract_array_count(&mut self, array_offset: UnitOffset<R::Offset>) -> Result<usize> {
+        let index = self.index;
+        for entry in index.children(array_offset)? {
             if entry.tag() == gimli::DW_TAG_subrange_type {
                 // DW_AT_upper_bound or DW_AT_count
                 if let Some(attr) = entry.attr(gimli::DW_AT_count)?
@@ -608,14 +985,9 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         );
 
         // extract return type from DW_AT_type (none = void)
-        let return_type_id = if let Some(attr) = entry.attr(gimli::DW_AT_type)? {
-            if let AttributeValue::UnitRef(type_offset) = attr.value() {
-                Some(self.build_type_registry_entry(type_offset)?)
-            } else {
-                None
-            }
-        } else {
-            None
+        let return_type_id = match entry.attr_value(gimli::DW_AT_type)? {
+            Some(value) => self.referenced_type(value)?,
+            None => None,
         };
 
         // extract parameters from children
@@ -641,20 +1013,14 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
         let mut parameter_type_ids = Vec::new();
         let mut is_variadic = false;
 
-        let mut tree = self.unit.entries_tree(Some(func_offset))?;
-        let func_node = tree.root()?;
-
-        let mut children = func_node.children();
-        while let Some(child) = children.next()? {
-            let entry = child.entry();
-
+        let index = self.index;
+        for entry in index.children(func_offset)? {
             match entry.tag() {
                 gimli::DW_TAG_formal_parameter => {
                     // Extract parameter type
                     if let Some(attr) = entry.attr(gimli::DW_AT_type)?
-                        && let AttributeValue::UnitRef(type_offset) = attr.value()
+                        && let Some(param_type_id) = self.referenced_type(attr.value())?
                     {
-                        let param_type_id = self.build_type_registry_entry(type_offset)?;
                         parameter_type_ids.push(param_type_id);
                         log::trace!("{:>12} parameter type added", "function");
                     }
@@ -675,9 +1041,8 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
     }
 
     fn get_or_create_int_type(&mut self) -> Result<TypeId> {
-        let int_types = self.type_registry.get_by_name("int");
-        if let Some(int_type) = int_types.first() {
-            return Ok(int_type.id);
+        if let Some(id) = self.int_type_id {
+            return Ok(id);
         }
 
         // create a default int type if not found
@@ -694,15 +1059,9 @@ impl<'dwarf, R: gimli::Reader> TypeResolver<'dwarf, R> {
             dwarf_offset: None,
         };
 
-        Ok(self.type_registry.register_type(int_type))
-    }
-
-    pub fn into_registry(self) -> TypeRegistry {
-        self.type_registry
-    }
-
-    #[allow(dead_code)]
-    pub fn get_registry(&self) -> &TypeRegistry {
-        &self.type_registry
+        self.stats.types_registered += 1;
+        let id = self.type_registry.register_type(int_type);
+        self.int_type_id = Some(id);
+        Ok(id)
     }
 }
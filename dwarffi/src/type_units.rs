@@ -0,0 +1,109 @@
+//! types the compiler moved out of the compilation units into type units
+//! (`-fdebug-types-section`): `.debug_types` in DWARF 4, units of type
+//! `DW_UT_type` in `.debug_info` in DWARF 5. other units refer to such a type
+//! by the 8 byte signature of its unit.
+//!
+//! the headers of every type unit are read once per analysis. a type unit is
+//! decoded the first time any unit refers to it, and its [`TypeId`] is kept
+//! for every later reference, from any unit.
+
+use crate::type_registry::TypeId;
+use anyhow::Result;
+use gimli::{DebugTypeSignature, Dwarf, Reader, ReaderOffset, UnitHeader, UnitOffset, UnitType};
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{PoisonError, RwLock};
+
+/// the offset type is a parameter of its own, like in gimli's `UnitHeader`,
+/// so `TypeUnits` of a shorter lived reader can stand in for a longer one
+pub struct TypeUnits<R, Offset = <R as Reader>::Offset>
+where
+    R: Reader<Offset = Offset>,
+    Offset: ReaderOffset,
+{
+    /// header of each type unit, and the offset of its type in the unit
+    units: HashMap<DebugTypeSignature, (UnitHeader<R, Offset>, UnitOffset<Offset>)>,
+    /// types of the units decoded so far
+    types: RwLock<HashMap<DebugTypeSignature, TypeId>>,
+    decoded: AtomicUsize,
+}
+
+impl<R: Reader> TypeUnits<R> {
+    /// the type units of `.debug_types` and the DWARF 5 type units among
+    /// `headers`, the headers of `.debug_info`
+    pub fn read(dwarf: &Dwarf<R>, headers: &[UnitHeader<R>]) -> Result<Self> {
+        let mut units = HashMap::new();
+        let mut debug_types = dwarf.type_units();
+        while let Some(header) = debug_types.next()? {
+            Self::add(&mut units, header);
+        }
+        for header in headers {
+            Self::add(&mut units, header.clone());
+        }
+
+        if !units.is_empty() {
+            log::debug!("{} type units", units.len());
+        }
+        Ok(Self {
+            units,
+            types: RwLock::default(),
+            decoded: AtomicUsize::new(0),
+        })
+    }
+
+    fn add(
+        units: &mut HashMap<DebugTypeSignature, (UnitHeader<R>, UnitOffset<R::Offset>)>,
+        header: UnitHeader<R>,
+    ) {
+        if let UnitType::Type {
+            type_signature,
+            type_offset,
+        } = header.type_()
+        {
+            // the same type from several objects, the linker keeps them all
+            units.entry(type_signature).or_insert((header, type_offset));
+        }
+    }
+
+    /// whether `header` is a type unit rather than a compilation unit
+    pub fn is_type_unit(header: &UnitHeader<R>) -> bool {
+        matches!(
+            header.type_(),
+            UnitType::Type { .. } | UnitType::SplitType { .. }
+        )
+    }
+
+    /// the type of the unit with `signature`, when it was decoded already
+    pub fn get(&self, signature: DebugTypeSignature) -> Option<TypeId> {
+        self.types
+            .read()
+            .unwrap_or_else(PoisonError::into_inner)
+            .get(&signature)
+            .copied()
+    }
+
+    /// the header of the unit with `signature` and the offset of its type,
+    /// to decode it
+    pub fn unit(
+        &self,
+        signature: DebugTypeSignature,
+    ) -> Option<(UnitHeader<R>, UnitOffset<R::Offset>)> {
+        self.units.get(&signature).cloned()
+    }
+
+    /// keep the type of a decoded unit. two units referring to the same new
+    /// type at once may both decode it, the registry makes that one type
+    pub fn insert(&self, signature: DebugTypeSignature, type_id: TypeId) {
+        self.decoded.fetch_add(1, Ordering::Relaxed);
+        self.types
+            .write()
+            .unwrap_or_else(PoisonError::into_inner)
+            .entry(signature)
+            .or_insert(type_id);
+    }
+
+    /// type units decoded so far
+    pub fn decoded(&self) -> usize {
+        self.decoded.load(Ordering::Relaxed)
+    }
+}
@@ -1,14 +1,15 @@
 use crate::type_registry::{TypeId, TypeRegistry};
+use serde::{Deserialize, Serialize};
 
 /// c function parameters have a name and a type
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct Parameter {
     pub name: String,
     pub type_id: TypeId,
 }
 
 /// struct to hold a complete function signature
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct FunctionSignature {
     pub name: String,
     pub return_type_id: TypeId,
@@ -18,6 +19,12 @@ pub struct FunctionSignature {
 }
 
 impl FunctionSignature {
+    /// the return type and every parameter type
+    pub fn type_ids(&self) -> impl Iterator<Item = TypeId> + '_ {
+        std::iter::once(self.return_type_id)
+            .chain(self.parameters.iter().map(|param| param.type_id))
+    }
+
     /// format the function signature as a C-style declaration
     pub fn to_string(&self, registry: &TypeRegistry) -> String {
         // Resolve return type
@@ -0,0 +1,105 @@
+//! find the units that hold exported code through their address ranges.
+//!
+//! `.debug_aranges` lists the code addresses of each unit without decoding
+//! it. units it leaves out fall back to the `DW_AT_low_pc`/`DW_AT_ranges`
+//! of their root DIE. a unit whose ranges contain no exported symbol defines
+//! no exported function and is skipped; a unit without any ranges is still
+//! scanned, since nothing says where its code is.
+
+use crate::symbol_reader::ExportedSymbols;
+use anyhow::Result;
+use gimli::{DebugInfoOffset, Dwarf, Reader, ReaderOffset, UnitHeader};
+use std::collections::HashMap;
+
+pub struct UnitRanges<R: Reader> {
+    /// for every unit with known ranges, whether they hold exported code
+    exports: HashMap<DebugInfoOffset<R::Offset>, bool>,
+}
+
+impl<R: Reader> UnitRanges<R> {
+    /// map the units of `headers` to whether `symbols` point into their
+    /// code. a malformed `.debug_aranges` is logged and ignored, like a
+    /// unit whose root DIE can't be read.
+    pub fn build(dwarf: &Dwarf<R>, headers: &[UnitHeader<R>], symbols: &ExportedSymbols) -> Self {
+        let mut ranges = Self {
+            exports: HashMap::new(),
+        };
+        if let Err(e) = ranges.read_aranges(dwarf, symbols) {
+            log::warn!("ignore unreadable .debug_aranges: {}", e);
+            ranges.exports.clear();
+        }
+        let from_aranges = ranges.exports.len();
+
+        for header in headers {
+            let Some(offset) = header.offset().as_debug_info_offset() else {
+                continue;
+            };
+            if ranges.exports.contains_key(&offset) {
+                continue;
+            }
+            match Self::unit_exports(dwarf, header.clone(), symbols) {
+                Ok(Some(exports)) => {
+                    ranges.exports.insert(offset, exports);
+                }
+                Ok(None) => {}
+                Err(e) => log::debug!("no ranges for unit at {:#x}: {}", offset.0.into_u64(), e),
+            }
+        }
+
+        log::debug!(
+            "address ranges of {} units, {} from .debug_aranges, {} of them hold exported code",
+            ranges.exports.len(),
+            from_aranges,
+            ranges.exports.values().filter(|&&exports| exports).count()
+        );
+        ranges
+    }
+
+    /// does the unit whose header is at `unit` hold exported code? `None`
+    /// when its ranges are unknown
+    pub fn has_exports(&self, unit: DebugInfoOffset<R::Offset>) -> Option<bool> {
+        self.exports.get(&unit).copied()
+    }
+
+    fn read_aranges(&mut self, dwarf: &Dwarf<R>, symbols: &ExportedSymbols) -> Result<()> {
+        let mut headers = dwarf.debug_aranges.headers();
+        while let Some(header) = headers.next()? {
+            let mut exports = false;
+            let mut entries = header.entries();
+            while let Some(entry) = entries.next()? {
+                let range = entry.range();
+                exports |= symbols.any_in(range.begin, range.end);
+            }
+            // a unit may have several sets
+            *self.exports.entry(header.debug_info_offset()).or_default() |= exports;
+        }
+        Ok(())
+    }
+
+    /// whether the ranges of the unit's root DIE hold exported code, `None`
+    /// when it has none
+    fn unit_exports(
+        dwarf: &Dwarf<R>,
+        header: UnitHeader<R>,
+        symbols: &ExportedSymbols,
+    ) -> Result<Option<bool>> {
+        let unit = dwarf.unit(header)?;
+        let mut entries = unit.entries();
+        let Some((_, root)) = entries.next_dfs()? else {
+            return Ok(None);
+        };
+        if root.attr_value(gimli::DW_AT_low_pc)?.is_none()
+            && root.attr_value(gimli::DW_AT_ranges)?.is_none()
+        {
+            return Ok(None);
+        }
+
+        let mut ranges = dwarf.unit_ranges(&unit)?;
+        while let Some(range) = ranges.next()? {
+            if symbols.any_in(range.begin, range.end) {
+                return Ok(Some(true));
+            }
+        }
+        Ok(Some(false))
+    }
+}
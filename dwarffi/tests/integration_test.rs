@@ -1,6 +1,6 @@
 mod common;
 
-use dwarffi::DwarfAnalyzer;
+use dwarffi::{AnalysisCache, AnalysisOptions, DwarfAnalyzer, ExportFormat, FunctionFilter};
 use std::path::PathBuf;
 
 /// expected functions from test C lib.
@@ -13,6 +13,7 @@ const EXPECTED_SIGNATURES: &[&str] = &[
     "int* allocate_array(size_t count)",
     "void allocate_matrix(int** matrix, int rows, int cols)",
     "Color blend_colors(Color c1, Color c2)",
+    "Rectangle bounding_box_size(BoundingBox box)",
     "float calculate_distance(Point p1, Point p2)",
     "void cleanup_state(InternalState* state)",
     "void complex_function(const char* name, Point* points, size_t point_count, Rectangle bounds, Status* out_status)",
@@ -35,6 +36,8 @@ const EXPECTED_SIGNATURES: &[&str] = &[
     "void modify_value(int* ptr)",
     "void move_point(Point* p, int dx, int dy)",
     "float multiply_floats(float a, float b)",
+    "uint32_t packet_length(const PacketHeader* header)",
+    "int point_manhattan_length(Point p)",
     "void print_string(const char* str)",
     "void process_2d_array(int[5]* arr)",
     "void process_buffer(char* buffer, size_t length)",
@@ -44,6 +47,7 @@ const EXPECTED_SIGNATURES: &[&str] = &[
     "Status process_person_batch(Person** people, size_t count, Callback on_complete)",
     "int process_state(InternalState* state, int value)",
     "void register_callback(Callback cb, void* userdata)",
+    "void reset_person(Person* p)",
     "int return_int(void)",
     "void set_status(Status s)",
     "void simple_void_function(void)",
@@ -85,6 +89,460 @@ fn test_error_on_nonexistent_file() {
     assert!(result.is_err(), "Should fail on nonexistent file");
 }
 
+#[test]
+/// mapped and in-memory loading see the same debug info
+fn test_mapped_and_owned_load_match() {
+    let path = common::get_test_lib_path();
+    let mapped = DwarfAnalyzer::from_file(&path).expect("fail to map test library");
+    let owned = DwarfAnalyzer::new(std::fs::read(&path).expect("fail to read test library"));
+
+    let mapped_result = mapped.extract_analysis(false).expect("mapped analysis");
+    let owned_result = owned.extract_analysis(false).expect("owned analysis");
+
+    assert_eq!(
+        mapped_result.signatures.len(),
+        owned_result.signatures.len()
+    );
+    assert_eq!(
+        mapped_result.type_registry.len(),
+        owned_result.type_registry.len()
+    );
+}
+
+#[test]
+/// serial and threaded analysis produce identical output
+fn test_parallel_analysis_matches_serial() {
+    let path = common::get_test_lib_path();
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+
+    let render = |threads| {
+        let result = analyzer
+            .extract_analysis_with(&AnalysisOptions {
+                exported_only: false,
+                threads,
+                ..AnalysisOptions::default()
+            })
+            .expect("fail to extract functions");
+        let signatures: Vec<String> = result
+            .signatures
+            .iter()
+            .map(|sig| sig.to_string(&result.type_registry))
+            .collect();
+        (signatures, result.type_registry.len())
+    };
+
+    assert_eq!(render(1), render(4));
+    assert_eq!(render(1), render(0));
+}
+
+#[test]
+/// libraries analyzed together share one registry, and each still gets the
+/// signatures it would get on its own
+fn test_batch_analysis_shares_types() {
+    let path = common::get_test_lib_path();
+    let single = DwarfAnalyzer::from_file(&path)
+        .expect("fail to load test library")
+        .extract_analysis(true)
+        .expect("fail to extract functions");
+    let render = |signatures: &[dwarffi::FunctionSignature], registry| {
+        let mut rendered: Vec<String> = signatures
+            .iter()
+            .map(|sig| sig.to_string(registry))
+            .collect();
+        rendered.sort();
+        rendered
+    };
+    let expected = render(&single.signatures, &single.type_registry);
+
+    let batch = DwarfAnalyzer::analyze_batch(&[path.clone(), path], &AnalysisOptions::default())
+        .expect("fail to analyze libraries");
+
+    assert_eq!(batch.libraries.len(), 2);
+    for library in &batch.libraries {
+        assert_eq!(render(&library.signatures, &batch.type_registry), expected);
+    }
+    assert_eq!(batch.type_registry.len(), single.type_registry.len());
+}
+
+#[test]
+/// the stats of an analysis count what it found, and add up over a batch
+fn test_analysis_stats() {
+    let path = common::get_test_lib_path();
+    let options = AnalysisOptions {
+        exported_only: false,
+        threads: 4,
+        ..AnalysisOptions::default()
+    };
+    let result = DwarfAnalyzer::from_file(&path)
+        .expect("fail to load test library")
+        .extract_analysis_with(&options)
+        .expect("fail to extract functions");
+
+    let stats = &result.stats;
+    assert!(!stats.cache_hit);
+    assert!(stats.units > 0);
+    assert!(stats.dies > 0);
+    assert_eq!(stats.functions, result.signatures.len());
+    assert_eq!(stats.registry_types, result.type_registry.len());
+    assert!(stats.type_lookup_hits <= stats.type_lookups);
+    assert!(stats.decl_hits <= stats.decl_lookups);
+    assert_eq!(
+        stats.types_registered - stats.types_deduplicated,
+        stats.registry_types
+    );
+    assert!(stats.total >= stats.merge);
+
+    let batch = DwarfAnalyzer::analyze_batch(&[path.clone(), path], &options)
+        .expect("fail to analyze libraries");
+    assert_eq!(batch.stats.units, 2 * stats.units);
+    assert_eq!(batch.stats.dies, 2 * stats.dies);
+    assert_eq!(batch.stats.functions, 2 * stats.functions);
+    assert_eq!(batch.stats.registry_types, stats.registry_types);
+}
+
+#[test]
+/// sharing declared types between units only saves work, the analysis finds
+/// the same types without it
+fn test_unshared_declarations_match() {
+    let path = common::get_test_lib_path();
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+    let options = AnalysisOptions {
+        exported_only: false,
+        threads: 1,
+        ..AnalysisOptions::default()
+    };
+    let shared = analyzer
+        .extract_analysis_with(&options)
+        .expect("fail to extract functions");
+    let unshared = analyzer
+        .extract_analysis_with(&AnalysisOptions {
+            share_declarations: false,
+            ..options
+        })
+        .expect("fail to extract functions");
+
+    assert!(shared.stats.decl_hits > 0);
+    assert_eq!(unshared.stats.decl_lookups, 0);
+    let render = |result: &dwarffi::AnalysisResult| -> Vec<_> {
+        result
+            .signatures
+            .iter()
+            .map(|sig| sig.to_string(&result.type_registry))
+            .collect()
+    };
+    assert_eq!(render(&unshared), render(&shared));
+    let ids = |result: &dwarffi::AnalysisResult| -> Vec<_> {
+        let mut ids: Vec<_> = result
+            .type_registry
+            .all_types()
+            .map(|type_| type_.id)
+            .collect();
+        ids.sort();
+        ids
+    };
+    assert_eq!(ids(&unshared), ids(&shared));
+}
+
+#[test]
+/// an export of the test library reads back with every signature, and every
+/// type a signature or another type refers to is in it
+fn test_export_round_trip() {
+    let path = common::get_test_lib_path();
+    let result = DwarfAnalyzer::from_file(&path)
+        .expect("fail to load test library")
+        .extract_analysis(true)
+        .expect("fail to extract functions");
+
+    for format in [ExportFormat::Json, ExportFormat::Bincode] {
+        let mut data = Vec::new();
+        let libraries = [(path.as_path(), result.signatures.as_slice())];
+        dwarffi::write_export(&mut data, format, libraries, &result.type_registry)
+            .expect("fail to write export");
+        let export = dwarffi::read_export(data.as_slice(), format).expect("fail to read export");
+
+        assert_eq!(export.types.len(), result.type_registry.len());
+        assert!(export.types.is_sorted_by_key(|type_| type_.id));
+
+        let (libraries, registry) = export.into_parts();
+        assert_eq!(libraries.len(), 1);
+        let functions = &libraries[0].functions;
+        assert_eq!(functions.len(), result.signatures.len());
+        for function in functions {
+            for type_id in function.type_ids() {
+                assert!(registry.get_type(type_id).is_some(), "{}", function.name);
+            }
+        }
+        for type_ in registry.all_types() {
+            for type_id in type_.kind.referenced_type_ids() {
+                assert!(registry.get_type(type_id).is_some());
+            }
+        }
+    }
+}
+
+#[test]
+/// an analysis with no memory to spare spills types and still exports the
+/// same document, byte for byte
+fn test_spilled_export_matches_export() {
+    let path = common::get_test_lib_path();
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+    let options = AnalysisOptions {
+        exported_only: false,
+        threads: 1,
+        ..AnalysisOptions::default()
+    };
+    let mut result = analyzer
+        .extract_analysis_with(&options)
+        .expect("fail to extract functions");
+    result.signatures.sort_by(|a, b| a.name.cmp(&b.name));
+
+    let budget = dwarffi::MemoryBudget::new(0, std::env::temp_dir());
+    let mut spilled = analyzer
+        .extract_analysis_spilled(&options, &budget)
+        .expect("fail to extract functions");
+    spilled.signatures.sort_by_name();
+    assert!(spilled.stats.types_spilled > 0);
+    assert_eq!(spilled.stats.registry_types, result.type_registry.len());
+
+    for format in [ExportFormat::Json, ExportFormat::Bincode] {
+        let mut expected = Vec::new();
+        let libraries = [(path.as_path(), result.signatures.as_slice())];
+        dwarffi::write_export(&mut expected, format, libraries, &result.type_registry)
+            .expect("fail to write export");
+        let mut data = Vec::new();
+        dwarffi::write_spilled_export(&mut data, format, &path, &spilled)
+            .expect("fail to write export");
+        assert!(data == expected, "{:?} exports differ", format);
+    }
+}
+
+#[test]
+/// the service answers from memory until the library file changes
+fn test_service_reanalyzes_changed_library() {
+    let dir = std::env::temp_dir().join(format!("dwarffi-service-{}", std::process::id()));
+    std::fs::create_dir_all(&dir).unwrap();
+    let path = dir.join(common::get_test_lib_path().file_name().unwrap());
+    std::fs::copy(common::get_test_lib_path(), &path).unwrap();
+
+    let service = dwarffi::AnalysisService::new(AnalysisOptions::default());
+    let first = service.library(&path).expect("fail to analyze library");
+    let again = service.library(&path).expect("fail to analyze library");
+    assert!(std::sync::Arc::ptr_eq(&first, &again));
+
+    let signature = first.signature("create_point").expect("no create_point");
+    assert_eq!(
+        signature.to_string(&first.type_registry),
+        "Point create_point(int x, int y)"
+    );
+    let closure = first.type_closure("create_point").unwrap();
+    assert!(closure.len() < first.type_registry.len());
+    for type_id in signature.type_ids() {
+        assert!(closure.get_type(type_id).is_some());
+    }
+    assert!(first.signature("no_such_function").is_none());
+
+    let modified = std::fs::metadata(&path).unwrap().modified().unwrap();
+    std::fs::File::options()
+        .write(true)
+        .open(&path)
+        .and_then(|file| file.set_modified(modified - std::time::Duration::from_secs(60)))
+        .unwrap();
+    let changed = service.library(&path).expect("fail to analyze library");
+    assert!(!std::sync::Arc::ptr_eq(&first, &changed));
+    assert_eq!(changed.signatures.len(), first.signatures.len());
+
+    assert!(service.invalidate(&path));
+    assert!(service.loaded().is_empty());
+    std::fs::remove_dir_all(&dir).unwrap();
+}
+
+#[test]
+/// a filtered run finds exactly the functions the filter keeps from a full run
+fn test_function_filter_matches_post_filtering() {
+    let path = common::get_test_lib_path();
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+
+    let mut filter = FunctionFilter::new();
+    filter
+        .include("get_*")
+        .include("add_two_ints")
+        .exclude("get_unsigned_*");
+
+    for exported_only in [true, false] {
+        let names = |filter: &FunctionFilter| {
+            let result = analyzer
+                .extract_analysis_with(&AnalysisOptions {
+                    exported_only,
+                    filter: filter.clone(),
+                    ..AnalysisOptions::default()
+                })
+                .expect("fail to extract functions");
+            let mut names: Vec<String> = result.signatures.into_iter().map(|s| s.name).collect();
+            names.sort();
+            names
+        };
+
+        let expected: Vec<String> = names(&FunctionFilter::new())
+            .into_iter()
+            .filter(|name| filter.matches(name))
+            .collect();
+        let filtered = names(&filter);
+        assert_eq!(filtered, expected);
+        assert!(filtered.contains(&"get_int".to_string()));
+        assert!(filtered.contains(&"add_two_ints".to_string()));
+        assert!(!filtered.contains(&"get_unsigned_int".to_string()));
+    }
+}
+
+#[test]
+/// skipping type members leaves every signature as it was, with fewer types
+fn test_signatures_without_type_members() {
+    let path = common::get_test_lib_path();
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+
+    let render = |type_members| {
+        let result = analyzer
+            .extract_analysis_with(&AnalysisOptions {
+                exported_only: false,
+                type_members,
+                ..AnalysisOptions::default()
+            })
+            .expect("fail to extract functions");
+        let signatures: Vec<String> = result
+            .signatures
+            .iter()
+            .map(|sig| sig.to_string(&result.type_registry))
+            .collect();
+        (signatures, result.type_registry)
+    };
+
+    let (full, full_registry) = render(true);
+    let (names, names_registry) = render(false);
+    assert_eq!(full, names);
+    assert!(names_registry.len() < full_registry.len());
+    assert!(names_registry.all_types().all(|t| match &t.kind {
+        dwarffi::BaseTypeKind::Struct { fields, .. } => fields.is_empty(),
+        dwarffi::BaseTypeKind::Enum { variants, .. } => variants.is_empty(),
+        _ => true,
+    }));
+}
+
+#[test]
+/// looking exported functions up through the name index finds exactly what
+/// the full scan finds
+fn test_name_index_matches_full_scan() {
+    let path = common::get_test_lib_path();
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+
+    let render = |use_name_index| {
+        let result = analyzer
+            .extract_analysis_with(&AnalysisOptions {
+                exported_only: true,
+                use_name_index,
+                ..AnalysisOptions::default()
+            })
+            .expect("fail to extract functions");
+        let mut signatures: Vec<String> = result
+            .signatures
+            .iter()
+            .map(|sig| sig.to_string(&result.type_registry))
+            .collect();
+        signatures.sort();
+        (signatures, result.type_registry.len())
+    };
+
+    let indexed = render(true);
+    assert!(!indexed.0.is_empty());
+    assert_eq!(indexed, render(false));
+}
+
+#[test]
+/// an analysis of the exported functions skips the unit that holds no
+/// exported code, by its address ranges, and finds the same functions as
+/// one that walks every unit
+fn test_units_without_exported_code_are_skipped() {
+    let path = common::get_test_lib_path();
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+    let analyze = |use_name_index| {
+        analyzer
+            .extract_analysis_with(&AnalysisOptions {
+                use_name_index,
+                ..AnalysisOptions::default()
+            })
+            .expect("fail to extract functions")
+    };
+
+    let ranged = analyze(true);
+    let scanned = analyze(false);
+    assert_eq!(ranged.stats.units, 3);
+    assert_eq!(ranged.stats.units_skipped, 1);
+    assert_eq!(scanned.stats.units_skipped, 0);
+
+    let names = |result: &dwarffi::AnalysisResult| {
+        let mut names: Vec<String> = result.signatures.iter().map(|s| s.name.clone()).collect();
+        names.sort();
+        names
+    };
+    assert_eq!(names(&ranged), names(&scanned));
+    assert!(!names(&ranged).contains(&"internal_clamp".to_string()));
+}
+
+#[test]
+#[cfg(target_os = "linux")]
+/// an exported alias has no DIE, it is found through the address it shares
+/// with the function it names
+fn test_aliases_are_found_by_address() {
+    let path = common::get_test_lib_path();
+    let result = DwarfAnalyzer::from_file(&path)
+        .expect("fail to load test library")
+        .extract_analysis(true)
+        .expect("fail to extract functions");
+
+    let signature = |name: &str| {
+        result
+            .signatures
+            .iter()
+            .find(|s| s.name == name)
+            .unwrap_or_else(|| panic!("missing function {}", name))
+            .to_string(&result.type_registry)
+    };
+    assert_eq!(
+        signature("point_taxicab_length"),
+        "int point_taxicab_length(Point p)"
+    );
+    assert_eq!(
+        signature("point_manhattan_length"),
+        "int point_manhattan_length(Point p)"
+    );
+}
+
+#[test]
+/// header types used from both compilation units resolve to one TypeId
+fn test_header_types_shared_across_units() {
+    let path = common::get_test_lib_path();
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+    let result = analyzer
+        .extract_analysis(false)
+        .expect("fail to extract analysis");
+
+    let param_type = |func: &str| {
+        result
+            .signatures
+            .iter()
+            .find(|s| s.name == func)
+            .unwrap_or_else(|| panic!("missing function {}", func))
+            .parameters[0]
+            .type_id
+    };
+
+    // testlib.c and testlib_geometry.c
+    assert_eq!(
+        param_type("calculate_distance"),
+        param_type("point_manhattan_length")
+    );
+    assert_eq!(param_type("destroy_person"), param_type("reset_person"));
+}
+
 #[test]
 /// test properties of function extraction
 fn test_function_extraction_properties() {
@@ -755,3 +1213,323 @@ fn test_function_pointer_signature_formatting() {
         sig_str
     );
 }
+
+#[test]
+/// a warm run loads the cached result instead of analyzing again
+fn test_cached_analysis_round_trip() {
+    let path = common::get_test_lib_path();
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+    let options = AnalysisOptions::default();
+
+    let cache_dir = std::env::temp_dir().join(format!("dwarffi-cache-test-{}", std::process::id()));
+    let cache = AnalysisCache::new(&cache_dir);
+    let key = analyzer
+        .cache_key(&options)
+        .expect("fail to read build id")
+        .expect("test library has no build id");
+
+    let render = |result: &dwarffi::AnalysisResult| {
+        let mut signatures: Vec<String> = result
+            .signatures
+            .iter()
+            .map(|sig| sig.to_string(&result.type_registry))
+            .collect();
+        signatures.sort();
+        (signatures, result.type_registry.len())
+    };
+
+    let cold = analyzer
+        .extract_analysis_cached(&options, &cache)
+        .expect("fail to extract functions");
+    assert!(cache.entry_path(&key).exists());
+
+    let warm = cache.load(&key).expect("cache entry not readable");
+    assert_eq!(render(&cold), render(&warm));
+    assert!(!cold.stats.cache_hit);
+    let warm = analyzer
+        .extract_analysis_cached(&options, &cache)
+        .expect("fail to extract functions");
+    assert!(warm.stats.cache_hit);
+    assert_eq!(warm.stats.functions, cold.signatures.len());
+
+    let unit_entries = || std::fs::read_dir(cache_dir.join("units")).unwrap().count();
+    let cold_unit_entries = unit_entries();
+    assert!(cold_unit_entries > 0);
+
+    // a damaged entry is a miss, the result is put back together from the
+    // entries of its units without storing any new ones
+    std::fs::write(cache.entry_path(&key), b"not a cache entry").unwrap();
+    assert!(cache.load(&key).is_none());
+    let rerun = analyzer
+        .extract_analysis_cached(&options, &cache)
+        .expect("fail to extract functions");
+    assert_eq!(render(&cold), render(&rerun));
+    assert_eq!(unit_entries(), cold_unit_entries);
+    assert!(!rerun.stats.cache_hit);
+    assert!(rerun.stats.units_cached > 0);
+
+    std::fs::remove_dir_all(&cache_dir).unwrap();
+}
+
+#[test]
+#[cfg(target_os = "linux")]
+/// a library linked with one export less only misses on the unit that
+/// defines it, the other units are loaded from the cache
+fn test_unit_cache_survives_a_changed_export_list() {
+    let cache_dir =
+        std::env::temp_dir().join(format!("dwarffi-unit-cache-test-{}", std::process::id()));
+    let cache = AnalysisCache::new(&cache_dir);
+    let options = AnalysisOptions::default();
+    let analyze = |path: &std::path::Path| {
+        DwarfAnalyzer::from_file(path)
+            .expect("fail to load test library")
+            .extract_analysis_cached(&options, &cache)
+            .expect("fail to extract functions")
+    };
+
+    let full = analyze(&common::get_test_lib_path());
+    let fewer = analyze(
+        &common::get_test_lib_dir()
+            .join("exports")
+            .join("libtestlib.so"),
+    );
+    assert!(!fewer.stats.cache_hit);
+    let analyzed = fewer.stats.units - fewer.stats.units_skipped;
+    assert_eq!(fewer.stats.units_cached, analyzed - 1);
+
+    let names = |result: &dwarffi::AnalysisResult| {
+        let mut names: Vec<String> = result
+            .signatures
+            .iter()
+            .map(|sig| sig.name.clone())
+            .collect();
+        names.sort();
+        names
+    };
+    let mut expected = names(&full);
+    expected.retain(|name| name != "reset_person");
+    assert_eq!(names(&fewer), expected);
+
+    std::fs::remove_dir_all(&cache_dir).unwrap();
+}
+
+#[test]
+/// streamed units carry the same signatures, in the same order, as a full
+/// analysis, and each unit can be rendered on its own
+fn test_streaming_matches_full_analysis() {
+    let path = common::get_test_lib_path();
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+    let full = analyzer
+        .extract_analysis(true)
+        .expect("fail to extract functions");
+
+    for threads in [1, 4] {
+        let options = AnalysisOptions {
+            threads,
+            ..AnalysisOptions::default()
+        };
+        let mut streamed = Vec::new();
+        let mut units = Vec::new();
+        let registry = analyzer
+            .analyze_streaming(&options, |unit| {
+                units.push(unit.unit);
+                let unit_registry = unit.registry()?;
+                for sig in &unit.signatures {
+                    streamed.push((sig.name.clone(), sig.to_string(&unit_registry)));
+                }
+                Ok(())
+            })
+            .expect("fail to stream functions");
+
+        assert!(units.is_sorted(), "units out of order: {:?}", units);
+        let expected: Vec<_> = full
+            .signatures
+            .iter()
+            .map(|sig| (sig.name.clone(), sig.to_string(&full.type_registry)))
+            .collect();
+        assert_eq!(streamed, expected);
+        assert_eq!(registry.len(), full.type_registry.len());
+    }
+}
+
+#[test]
+/// an error from the callback ends the analysis
+fn test_streaming_stops_on_callback_error() {
+    let path = common::get_test_lib_path();
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+
+    for threads in [1, 4] {
+        let options = AnalysisOptions {
+            threads,
+            ..AnalysisOptions::default()
+        };
+        let mut calls = 0;
+        let result = analyzer.analyze_streaming(&options, |_| {
+            calls += 1;
+            Err(anyhow::anyhow!("stop"))
+        });
+
+        assert_eq!(result.unwrap_err().to_string(), "stop");
+        assert_eq!(calls, 1);
+    }
+}
+
+#[test]
+#[cfg(target_os = "linux")]
+/// debug info in .dwo files, in a .dwp package, in a separate file found
+/// through .gnu_debuglink or in compressed sections gives the same result as
+/// embedded debug info
+fn test_separate_debug_info_matches_embedded() {
+    let render = |path: &std::path::Path| {
+        let analyzer = DwarfAnalyzer::from_file(path).expect("fail to load test library");
+        let result = analyzer
+            .extract_analysis(false)
+            .expect("fail to extract functions");
+        let mut signatures: Vec<String> = result
+            .signatures
+            .iter()
+            .map(|sig| sig.to_string(&result.type_registry))
+            .collect();
+        signatures.sort();
+        (signatures, result.type_registry.len())
+    };
+
+    let embedded = render(&common::get_test_lib_path());
+    assert!(!embedded.0.is_empty());
+
+    for variant in ["split", "packed", "debuglink", "compressed"] {
+        let path = common::get_test_lib_dir()
+            .join(variant)
+            .join("libtestlib.so");
+        assert_eq!(render(&path), embedded, "{} differs", variant);
+    }
+}
+
+#[test]
+#[cfg(target_os = "linux")]
+/// types moved into DWARF 4 or DWARF 5 type units resolve to the same types
+/// as when every unit carries them, on one thread or several
+fn test_type_units_match_embedded() {
+    let render = |path: &std::path::Path, threads| {
+        let analyzer = DwarfAnalyzer::from_file(path).expect("fail to load test library");
+        let options = AnalysisOptions {
+            threads,
+            ..AnalysisOptions::default()
+        };
+        let result = analyzer
+            .extract_analysis_with(&options)
+            .expect("fail to extract functions");
+        let mut signatures: Vec<String> = result
+            .signatures
+            .iter()
+            .map(|sig| sig.to_string(&result.type_registry))
+            .collect();
+        signatures.sort();
+        let types = result.type_registry.len();
+        ((signatures, types), result.stats)
+    };
+
+    let (embedded, stats) = render(&common::get_test_lib_path(), 1);
+    assert_eq!(stats.type_units, 0);
+
+    for variant in ["typeunits", "typeunits5"] {
+        let path = common::get_test_lib_dir()
+            .join(variant)
+            .join("libtestlib.so");
+        let (sequential, stats) = render(&path, 1);
+        assert_eq!(sequential, embedded, "{} differs", variant);
+        assert!(stats.type_units > 0, "{} has no type units", variant);
+        // type units are not compilation units
+        assert_eq!(stats.units, 3);
+
+        let (parallel, _) = render(&path, 4);
+        assert_eq!(parallel, embedded, "{} differs on 4 threads", variant);
+    }
+}
+
+#[test]
+#[cfg(target_os = "linux")]
+/// a compressed section that does not inflate, or inflates to something else
+/// than was compressed, fails the analysis instead of reading as empty or
+/// as other debug info
+fn test_corrupt_compressed_section_is_an_error() {
+    use object::{Object, ObjectSection};
+
+    let path = common::get_test_lib_dir()
+        .join("compressed")
+        .join("libtestlib.so");
+    let original = std::fs::read(&path).expect("fail to read test library");
+    let (offset, size) = object::File::parse(original.as_slice())
+        .expect("fail to parse test library")
+        .section_by_name(".debug_info")
+        .and_then(|section| section.file_range())
+        .expect("test library has no .debug_info");
+    // the start of the zlib stream, right after the compression header, and
+    // the middle of it, which may still inflate to the right size
+    for at in [offset + 24, offset + size / 2] {
+        let mut data = original.clone();
+        let at = at as usize;
+        for byte in &mut data[at..at + 16] {
+            *byte = !*byte;
+        }
+
+        let error = DwarfAnalyzer::new(data)
+            .extract_analysis(false)
+            .err()
+            .expect("corrupt section analyzed");
+        assert!(format!("{:#}", error).contains("failed to decompress section .debug_info"));
+    }
+}
+
+/// the primitive behind the first field of the struct parameter `function`
+/// takes, through its typedefs
+fn first_field_primitive(
+    registry: &dwarffi::TypeRegistry,
+    function: &dwarffi::FunctionSignature,
+) -> String {
+    use dwarffi::BaseTypeKind;
+
+    let mut id = function.parameters[0].type_id;
+    loop {
+        let type_ = registry.get_type(id).expect("dangling type");
+        match &type_.kind {
+            BaseTypeKind::Typedef {
+                aliased_type_id, ..
+            } => id = *aliased_type_id,
+            BaseTypeKind::Struct { fields, .. } => id = fields[0].type_id,
+            BaseTypeKind::Primitive { name, .. } => return name.clone(),
+            other => panic!("unexpected {:?}", other),
+        }
+    }
+}
+
+#[test]
+#[cfg(target_os = "linux")]
+/// one header declares another Sample in units compiled with -DFLOATY. both
+/// come out as they were compiled, however the units are scheduled
+fn test_header_under_different_macros() {
+    let path = common::get_test_lib_dir()
+        .join("macros")
+        .join("libsample.so");
+    let analyzer = DwarfAnalyzer::from_file(&path).expect("fail to load test library");
+
+    for threads in [1, 4] {
+        let options = AnalysisOptions {
+            threads,
+            ..AnalysisOptions::default()
+        };
+        let result = analyzer
+            .extract_analysis_with(&options)
+            .expect("fail to extract functions");
+        let primitive = |name: &str| {
+            let function = result
+                .signatures
+                .iter()
+                .find(|sig| sig.name == name)
+                .expect("function not found");
+            first_field_primitive(&result.type_registry, function)
+        };
+        assert_eq!(primitive("take"), "int");
+        assert_eq!(primitive("take2"), "float");
+    }
+}
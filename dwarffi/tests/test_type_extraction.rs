@@ -340,3 +340,79 @@ fn test_typedef_chain_closure() {
     println!("  Typedefs found: {}", typedef_count);
     println!("  Chains verified: {}", chain_verified);
 }
+
+#[test]
+fn test_struct_layouts() {
+    use dwarffi::BaseTypeKind;
+
+    let analyzer = DwarfAnalyzer::from_file(&common::get_test_lib_path())
+        .expect("Failed to load test library");
+    let registry = analyzer
+        .extract_analysis(true)
+        .expect("Failed to extract analysis")
+        .type_registry;
+
+    // the fields as (name, offset, size, alignment), the size and the
+    // alignment of the struct a typedef names. Person is only ever used
+    // through a pointer
+    let layout = |typedef: &str| {
+        let typedef = registry
+            .get_by_name(typedef)
+            .into_iter()
+            .find(|t| matches!(t.kind, BaseTypeKind::Typedef { .. }))
+            .unwrap_or_else(|| panic!("no typedef {}", typedef));
+        let BaseTypeKind::Typedef {
+            aliased_type_id, ..
+        } = &typedef.kind
+        else {
+            unreachable!()
+        };
+        match &registry.get_type(*aliased_type_id).unwrap().kind {
+            BaseTypeKind::Struct {
+                fields,
+                size,
+                alignment,
+                ..
+            } => {
+                let fields: Vec<(&str, usize, usize, usize)> = fields
+                    .iter()
+                    .map(|f| (f.name.as_str(), f.offset, f.size, f.alignment))
+                    .collect();
+                (fields, *size, *alignment)
+            }
+            other => panic!("not a struct: {:?}", other),
+        }
+    };
+
+    // LP64 on both supported platforms
+    assert_eq!(
+        layout("Person"),
+        (
+            vec![
+                ("name", 0, 64, 1),
+                ("age", 64, 4, 4),
+                ("salary", 68, 4, 4),
+                ("balance", 72, 8, 8),
+                ("status", 80, 4, 4),
+                ("flags", 84, 1, 1),
+                ("timestamp", 88, 8, 8),
+                ("userdata", 96, 8, 8),
+            ],
+            104,
+            8
+        )
+    );
+    assert_eq!(
+        layout("BoundingBox"),
+        (vec![("top_left", 0, 8, 4), ("bottom_right", 8, 8, 4)], 16, 4)
+    );
+    // packed: the fields keep their own alignment, the struct has none
+    assert_eq!(
+        layout("PacketHeader"),
+        (
+            vec![("kind", 0, 1, 1), ("length", 1, 4, 4), ("checksum", 5, 1, 1)],
+            6,
+            1
+        )
+    );
+}
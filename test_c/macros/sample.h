@@ -0,0 +1,18 @@
+// the same header seen through different macros: units compiled with
+// -DFLOATY get another `real`, and so another Sample, at the same lines
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#define EXPORT __attribute__((visibility("default")))
+
+#ifdef FLOATY
+typedef float real;
+#else
+typedef int real;
+#endif
+
+typedef struct Sample {
+    real v;
+} Sample;
+
+#endif
@@ -0,0 +1,4 @@
+// compiled with -DFLOATY
+#include "sample.h"
+
+EXPORT real take2(Sample s) { return s.v; }
@@ -0,0 +1,3 @@
+#include "sample.h"
+
+EXPORT real take(Sample s) { return s.v; }
@@ -318,6 +318,11 @@ void set_person_userdata(Person *p, void *data)
     }
 }
 
+uint32_t packet_length(const PacketHeader *header)
+{
+    return (uint32_t)sizeof(PacketHeader) + header->length;
+}
+
 InternalState *init_state(void)
 {
     InternalState *state = (InternalState *)malloc(sizeof(InternalState));
@@ -51,6 +51,14 @@ typedef struct {
     void *userdata;
 } Person;
 
+// packed structs: no padding between the fields
+
+typedef struct __attribute__((packed)) {
+    uint8_t kind;
+    uint32_t length;
+    uint8_t checksum;
+} PacketHeader;
+
 // opaque types (forward declarations)
 
 typedef struct InternalState InternalState;
@@ -212,6 +220,10 @@ void update_person_status(Person* p, Status new_status);
 __attribute__((visibility("default")))
 void set_person_userdata(Person* p, void* data);
 
+// packed structs
+__attribute__((visibility("default")))
+uint32_t packet_length(const PacketHeader* header);
+
 // opaque types
 __attribute__((visibility("default")))
 InternalState* init_state(void);
@@ -288,6 +300,24 @@ int multiply_operation(int a, int b);
 __attribute__((visibility("default")))
 int subtract_operation(int a, int b);
 
+// defined in testlib_geometry.c, a second compilation unit that sees the
+// same header types
+__attribute__((visibility("default")))
+int point_manhattan_length(Point p);
+
+__attribute__((visibility("default")))
+Rectangle bounding_box_size(BoundingBox box);
+
+__attribute__((visibility("default")))
+void reset_person(Person* p);
+
+#ifdef __ELF__
+// a second exported name for point_manhattan_length. the alias has no DIE of
+// its own, only its address ties it to the function. Mach-O has no aliases
+__attribute__((visibility("default")))
+int point_taxicab_length(Point p);
+#endif
+
 // internal/hidden functions
 
 // These are helper functions without visibility attribute
@@ -297,4 +327,7 @@ int internal_compute(int a, int b);
 void internal_process_data(const char* data, size_t len);
 int multiply_internal(int a, int b);
 
+// defined in testlib_internal.c, a compilation unit without exported code
+int internal_clamp(int value, int low, int high);
+
 #endif // TESTLIB_H
\ No newline at end of file
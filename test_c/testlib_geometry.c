@@ -0,0 +1,32 @@
+#include "testlib.h"
+#include <stdlib.h>
+#include <string.h>
+
+// second compilation unit. shares Point, BoundingBox and Person with
+// testlib.c through the header.
+
+int point_manhattan_length(Point p)
+{
+    return abs(p.x) + abs(p.y);
+}
+
+#ifdef __ELF__
+int point_taxicab_length(Point p) __attribute__((alias("point_manhattan_length")));
+#endif
+
+Rectangle bounding_box_size(BoundingBox box)
+{
+    Rectangle r;
+    r.width = (float)(box.bottom_right.x - box.top_left.x);
+    r.height = (float)(box.bottom_right.y - box.top_left.y);
+    return r;
+}
+
+void reset_person(Person* p)
+{
+    if (p)
+    {
+        memset(p, 0, sizeof(*p));
+        p->status = STATUS_OK;
+    }
+}
@@ -0,0 +1,13 @@
+#include "testlib.h"
+
+// third compilation unit. nothing in it is exported, so an analysis of the
+// exported functions never has to decode it.
+
+int internal_clamp(int value, int low, int high)
+{
+    if (value < low)
+    {
+        return low;
+    }
+    return value > high ? high : value;
+}